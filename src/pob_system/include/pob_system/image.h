@@ -1,10 +1,13 @@
 #pragma once
+#include <tasks/cancellation.h>
+#include <tasks/static_thread_pool.h>
 #include <tasks/task.h>
 
 #include <atomic>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <utility>
 
 struct SDL_Surface;
 
@@ -15,44 +18,69 @@ class Image
     inline static const std::string_view CLAMP_FLAG = "CLAMP";
     inline static const std::string_view MIPMAP_FLAG = "MIPMAP";
 
-    Image(const char* filename, bool mipmaps, bool clamp, bool load_async);
+    using priority = cb::static_thread_pool::priority;
+
+    Image(const char* filename, bool mipmaps, bool clamp, bool load_async, priority loading_priority);
     ~Image();
 
     void wait_for_load() const;
 
-    bool is_loading() const { return is_loaded_; }
+    // Moves a load that is still queued ahead of less urgent loads. A queued load can't be made less urgent.
+    void set_loading_priority(priority loading_priority);
+
+    bool is_loading() const { return load_status_ && load_status_->is_loaded; }
 
     int width() const
     {
-        if (is_loaded_)
-            return width_;
+        if (load_status_ && load_status_->is_loaded)
+            return load_status_->width;
         return 0;
     }
 
     int height() const
     {
-        if (is_loaded_)
-            return height_;
+        if (load_status_ && load_status_->is_loaded)
+            return load_status_->height;
         return 0;
     }
 
    private:
-    cb::task<> load_image();
+    // Shared between the image and every hop onto the thread pool that may load it. The load
+    // only ever touches this, so the image can go away without waiting for it.
+    struct load_status
+    {
+        explicit load_status(std::string filename) : filename(std::move(filename)) {}
+        ~load_status();  // Frees the surface
+
+        const std::string filename;
+        std::atomic<bool> claimed = false;  // Set by whoever loads the image, or by ~Image to cancel the load
+        std::atomic<bool> finished = false;
+
+        // Written by the load, before it sets is_loaded
+        SDL_Surface* surface = nullptr;
+        int width = 0;
+        int height = 0;
+        std::atomic<bool> is_loaded = false;
+        std::atomic<bool> is_loading = false;
+    };
+
+    static cb::task<> load_image(std::shared_ptr<load_status> status, cb::cancellation_token cancel,
+                                 priority loading_priority);
 
     std::string filename_;
     bool mipmaps_;  // Currently ignored
     bool clamp_;    // Currently ignored
     bool load_async_;
 
-    cb::task<> image_load_task_;
-    std::atomic<bool> is_loaded_ = false;
-    std::atomic<bool> is_loading_ = false;
-    SDL_Surface* surface_ = nullptr;
-    int width_ = 0;
-    int height_ = 0;
+    std::shared_ptr<load_status> load_status_;
+    cb::cancellation_source cancel_load_;  // Requested by ~Image, the load is of no use to anyone after that
+    priority queued_priority_;
 };
 
 struct ImageHandle
 {
     std::unique_ptr<Image> image;
+
+    // Async loads are background prefetch unless the script asks for them sooner.
+    Image::priority loading_priority = Image::priority::low;
 };
\ No newline at end of file
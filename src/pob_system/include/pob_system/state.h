@@ -2,12 +2,22 @@
 #include <SDL.h>
 #include <pob_system/image.h>
 #include <pob_system/lua_helper.h>
+#include <tasks/async_scope.h>
+#include <tasks/async_semaphore.h>
+#include <tasks/cancellation.h>
+#include <tasks/file_io.h>
 #include <tasks/static_thread_pool.h>
+#include <tasks/strand.h>
 #include <tasks/task.h>
+#include <tasks/task_category.h>
 #include <pob_system/commands/viewport_command.h>
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdio>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <pob_system/draw_layer.h>
@@ -19,6 +29,17 @@ struct SDL_Renderer;
 
 class state_t;
 
+// The kinds of work the global thread pool keeps queue wait and run time histograms for
+namespace task_kinds
+{
+inline const cb::task_category image_load{"image-load"};
+inline const cb::task_category image_decode{"image-decode"};
+inline const cb::task_category sub_script{"sub-script"};
+inline const cb::task_category sub_call{"sub-call"};
+inline const cb::task_category lua_event{"lua-event"};
+inline const cb::task_category lua_frame{"lua-frame"};
+}  // namespace task_kinds
+
 // All lua specific state with a pointer to application state
 // Is also the home for all API callbacks
 class lua_state_t
@@ -54,6 +75,9 @@ class lua_state_t
     bool is_image_handle(int index) const;
     static lua_state_t* get_current_state(lua_State* l);
     ImageHandle& get_image_handle(int index) const;
+    // Like luaL_loadfile, but reads the file through the file I/O service
+    int load_file(const std::string& fileName);
+    int load_chunk(const cb::file_contents& contents, const std::string& fileName);
 
     // Callbacks
     int set_window_title();
@@ -65,6 +89,8 @@ class lua_state_t
     int p_load_module();
     int p_call();
     int launch_sub_script();
+    int abort_sub_script();
+    int is_sub_script_running();
     int get_script_path();
     int get_runtime_path();
     int get_user_path();
@@ -96,6 +122,10 @@ class lua_state_t
 
     // SubScript Helpers
     int call_main_from_sub(bool sync);
+    // Runs the script loaded into 'sub' on the thread pool, returns what lua_pcall returned
+    static cb::task<int> run_sub_script(lua_state_t& sub, cb::cancellation_token cancel, int argsCount,
+                                        const std::string& sync_override_calls,
+                                        const std::string& async_override_calls);
 
     int id;
     state_t* state;
@@ -130,8 +160,34 @@ class state_t
     // No getters and setters, know what you change
     lua_state_t lua_state;
     render_state_t render_state;
-    cb::static_thread_pool global_thread_pool{std::thread::hardware_concurrency() - 1};
-    cb::static_thread_pool main_lua_thread{1};
+    // An interactive session idles between frames and input, let the workers learn how long to spin for
+    cb::static_thread_pool global_thread_pool{std::thread::hardware_concurrency() - 1, {.spin = {.adaptive = true}}};
+    // Serializes everything that touches the main lua state. Runs on the global pool, or inline on the caller
+    // when nothing else holds it.
+    cb::strand lua_strand{global_thread_pool};
+    // Reads files, resuming on the global pool
+    cb::file_io_service file_io{global_thread_pool};
+    // Limits how many images are decoded at once, so a burst of loads leaves workers for everything else.
+    // Waiting loads get to decode in order of their loading priority.
+    cb::async_semaphore image_decodes{std::max(1u, std::thread::hardware_concurrency() / 2)};
+    // Image loads and sub scripts, which nobody waits for. Their frames are freed as they finish.
+    cb::async_scope background_tasks;
+
+    // Print the scheduler counters of the thread pool, e.g. at the end of a session
+    void print_thread_pool_stats(FILE* out) const;
+    // Write how long each kind of work in task_kinds waited for and ran for to a file, false if it can't be opened
+    bool write_task_histograms(const char* path) const;
+
+    // Sub scripts that haven't finished yet, by id, so that they can be aborted from any lua state
+    cb::cancellation_token add_sub_script(int id);
+    void remove_sub_script(int id);
+    void abort_sub_script(int id);
+    void abort_all_sub_scripts();
+    bool is_sub_script_running(int id);
+    // Wait for the background tasks to finish, before the thread pool they run on goes away
+    void wait_for_background_tasks();
+    std::mutex sub_scripts_mutex;
+    std::unordered_map<int, cb::cancellation_source> sub_scripts;
 
     static state_t* instance;
 };
\ No newline at end of file
@@ -1,11 +1,12 @@
 #include <SDL_image.h>
 #include <pob_system/image.h>
 #include <pob_system/state.h>
+#include <tasks/trace.h>
 
 #include <filesystem>
 
-Image::Image(const char* filename, bool mipmaps, bool clamp, bool load_async)
-    : filename_(filename), mipmaps_(mipmaps), clamp_(clamp), load_async_(load_async)
+Image::Image(const char* filename, bool mipmaps, bool clamp, bool load_async, priority loading_priority)
+    : filename_(filename), mipmaps_(mipmaps), clamp_(clamp), load_async_(load_async), queued_priority_(loading_priority)
 {
     if (!std::filesystem::is_regular_file(filename))
     {
@@ -13,48 +14,97 @@ Image::Image(const char* filename, bool mipmaps, bool clamp, bool load_async)
         return;
     }
 
-    image_load_task_ = load_image();
+    load_status_ = std::make_shared<load_status>(filename_);
+    load_status_->is_loading = true;
+    state_t::instance->background_tasks.spawn(load_image(load_status_, cancel_load_.token(), loading_priority));
 }
 
 Image::~Image()
 {
-    // If we are loading right now, wait for it to finish
-    // to not invalidate 'this' which is used by load_image.
-    wait_for_load();
-    if (surface_)
+    // Don't wait for the load, it may need the thread we are on to finish. Queued loads drop
+    // out, one that has started already sees the cancellation once its read completes and skips
+    // decoding. Either way it only touches the load status, which it keeps alive itself.
+    cancel_load_.request_cancellation();
+    if (load_status_)
     {
-        SDL_FreeSurface(surface_);
+        load_status_->claimed = true;
+    }
+}
+
+Image::load_status::~load_status()
+{
+    if (surface)
+    {
+        SDL_FreeSurface(surface);
     }
 }
 
 void Image::wait_for_load() const
 {
-    if (is_loaded_)
-        return;
-    if (!is_loading_)
+    if (!load_status_)
         return;
 
     // Wait synchronously
-    image_load_task_.join();
+    load_status_->finished.wait(false);
+}
+
+void Image::set_loading_priority(priority loading_priority)
+{
+    if (!load_status_ || load_status_->claimed || loading_priority >= queued_priority_)
+        return;
+
+    // Queued work can't move between priorities, so queue another hop at the
+    // new priority. Whichever hop runs first loads the image.
+    queued_priority_ = loading_priority;
+    state_t::instance->background_tasks.spawn(load_image(load_status_, cancel_load_.token(), loading_priority));
 }
 
-cb::task<> Image::load_image()
+cb::task<> Image::load_image(std::shared_ptr<load_status> status, cb::cancellation_token cancel,
+                             priority loading_priority)
 {
-    is_loading_ = true;
     auto state = state_t::instance;
 
-    // Move to other thread and start loading
-    co_await state->global_thread_pool.schedule();
-    surface_ = IMG_Load(filename_.c_str());
-    if (!surface_)
+    // Move to other thread and start loading, unless the image is gone by then
+    if (!co_await state->global_thread_pool.schedule(cancel, task_kinds::image_load, loading_priority))
     {
-        printf("IMG_Load(%s): %s\n", filename_.c_str(), IMG_GetError());
-        is_loading_ = false;
         co_return;
     }
 
-    width_ = surface_->w;
-    height_ = surface_->h;
-    is_loaded_ = true;
-    is_loading_ = false;
+    // Someone else got to do the load, or the image is gone already.
+    if (status->claimed.exchange(true))
+    {
+        co_return;
+    }
+
+    // The file is read without holding on to a worker, only the decoding below runs on one.
+    auto contents = co_await cb::async_read_file(state->file_io, status->filename, loading_priority);
+    if (contents.error)
+    {
+        printf("Reading %s: %s\n", status->filename.c_str(), contents.error.message().c_str());
+    }
+    else if (!cancel.is_cancellation_requested())
+    {
+        auto permit = co_await state->image_decodes.scoped_acquire(loading_priority);
+        // A waiting load is resumed inside the release of the previous decode, go back to the pool
+        // instead of decoding nested on that thread.
+        co_await state->global_thread_pool.schedule(task_kinds::image_decode, loading_priority);
+        CORO_TRACE_SCOPE("image decode");
+
+        SDL_RWops* rw = SDL_RWFromConstMem(contents.data.data(), static_cast<int>(contents.data.size()));
+        status->surface = IMG_Load_RW(rw, 1);
+        if (!status->surface)
+        {
+            printf("IMG_Load(%s): %s\n", status->filename.c_str(), IMG_GetError());
+        }
+        else
+        {
+            status->width = status->surface->w;
+            status->height = status->surface->h;
+            status->is_loaded = true;
+        }
+    }
+    status->is_loading = false;
+
+    status->finished = true;
+    status->finished.notify_all();
 }
\ No newline at end of file
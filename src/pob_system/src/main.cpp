@@ -3,15 +3,26 @@
 #include <pob_system/keys.h>
 #include <pob_system/lua_helper.h>
 #include <pob_system/state.h>
+#include <tasks/trace.h>
 
+#include <cstdlib>
 #include <filesystem>
 #include <lua.hpp>
 
+// Set POB_TASK_STATS to have the thread pool's statistics reported on exit,
+// along with the per task category histograms in task_histograms.txt.
+static bool task_stats_requested()
+{
+    const char* value = std::getenv("POB_TASK_STATS");
+    return value != nullptr && *value != '\0' && *value != '0';
+}
+
 int main(int argc, char* argv[])
 {
     //std::filesystem::current_path("c:\\Projects\\PathOfBuilding\\src");
      std::filesystem::current_path("c:\\Projects\\\PoB_System\\PoBData");
 
+    CORO_TRACE_THREAD_NAME("main");
     SDL_Init(SDL_INIT_VIDEO);
 
     int flags = IMG_INIT_JPG | IMG_INIT_PNG;
@@ -89,8 +100,30 @@ int main(int argc, char* argv[])
         // Fill the screen with the colour
         SDL_SetRenderDrawColor(state.render_state.renderer, red, green, blue, 255);
         SDL_RenderClear(state.render_state.renderer);
-        SDL_RenderPresent(state.render_state.renderer);
+        {
+            CORO_TRACE_SCOPE("SDL_RenderPresent");
+            SDL_RenderPresent(state.render_state.renderer);
+        }
+    }
+
+    // Sub scripts may run for a while yet, abort them rather than wait for them.
+    state.abort_all_sub_scripts();
+    state.wait_for_background_tasks();
+
+    if (task_stats_requested())
+    {
+        state.print_thread_pool_stats(stdout);
+        if (!state.write_task_histograms("task_histograms.txt"))
+        {
+            printf("Could not write task_histograms.txt\n");
+        }
+    }
+#if CORO_TRACE
+    if (!cb::trace::write_json("session_trace.json"))
+    {
+        printf("Could not write session_trace.json\n");
     }
+#endif
 
     IMG_Quit();
     SDL_Quit();
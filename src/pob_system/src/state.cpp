@@ -4,6 +4,8 @@
 #include <pob_system/state.h>
 #include <pob_system/user_path_helper.h>
 #include <pob_system/commands/viewport_command.h>
+#include <tasks/affine_task.h>
+#include <tasks/trace.h>
 
 #include <chrono>
 #include <filesystem>
@@ -57,6 +59,8 @@ lua_state_t::lua_state_t(state_t* state) : state(state)
     LUA_GLOBAL_FUNCTION(PLoadModule, p_load_module);
     LUA_GLOBAL_FUNCTION(PCall, p_call);
     LUA_GLOBAL_FUNCTION(LaunchSubScript, launch_sub_script);
+    LUA_GLOBAL_FUNCTION(AbortSubScript, abort_sub_script);
+    LUA_GLOBAL_FUNCTION(IsSubScriptRunning, is_sub_script_running);
     LUA_GLOBAL_FUNCTION(GetScriptPath, get_script_path);
     LUA_GLOBAL_FUNCTION(GetRuntimePath, get_runtime_path);
     LUA_GLOBAL_FUNCTION(GetUserPath, get_user_path);
@@ -100,6 +104,8 @@ lua_state_t::lua_state_t(state_t* state) : state(state)
     lua_setfield(l, -2, "IsValid");
     LUA_IMAGE_FUNCTION(img_handle_is_loading);
     lua_setfield(l, -2, "IsLoading");
+    LUA_IMAGE_FUNCTION(img_handle_set_loading_priority);
+    lua_setfield(l, -2, "SetLoadingPriority");
     LUA_IMAGE_FUNCTION(img_handle_image_size);
     lua_setfield(l, -2, "ImageSize");
     lua_setfield(l, LUA_REGISTRYINDEX, IMAGE_META_HANDLE);
@@ -202,8 +208,9 @@ void lua_state_t::do_file(const char* file)
 {
     [&]() -> cb::task<>
     {
-        co_await state->main_lua_thread.schedule();
-        if (luaL_dofile(l, file))
+        auto contents = co_await cb::async_read_file(state->file_io, file, cb::static_thread_pool::priority::high);
+        co_await state->lua_strand.schedule(cb::strand::priority::high);
+        if (load_chunk(contents, file) || lua_pcall(l, 0, LUA_MULTRET, 0))
         {
             log_lua_error();
         }
@@ -213,17 +220,18 @@ void lua_state_t::do_file(const char* file)
 
 void lua_state_t::on_init()
 {
-    // We do not run this on the lua main thread which is currently sleeping, because the window needs to be created on
-    // the main thread. If it isnt we will not receive events from it!
+    // We do not run this through the lua strand, which may run it on a pool thread, because the window needs to be
+    // created on the main thread. If it isnt we will not receive events from it!
 
     callParameterlessFunction("OnInit");
 }
 
 void lua_state_t::on_frame()
 {
+    // Frames and input events go ahead of anything sub scripts have queued on the lua strand.
     [&]() -> cb::task<>
     {
-        co_await state->main_lua_thread.schedule();
+        co_await state->lua_strand.schedule(task_kinds::lua_frame, cb::strand::priority::high);
         callParameterlessFunction("OnFrame");
     }()
                  .join();
@@ -233,7 +241,8 @@ void lua_state_t::on_char(char c)
 {
     [c]() -> cb::task<>
     {
-        co_await state_t::instance->main_lua_thread.schedule();
+        co_await state_t::instance->lua_strand.schedule(task_kinds::lua_event, cb::strand::priority::high);
+        CORO_TRACE_SCOPE("OnChar");
         auto& main_state = state_t::instance->lua_state;
         main_state.pushCallableOntoStack("OnChar");
         lua_pushfstring(main_state.l, "%c", c);
@@ -249,7 +258,8 @@ void lua_state_t::on_key_down(SDL_Keycode key)
 {
     [key]() -> cb::task<>
     {
-        co_await state_t::instance->main_lua_thread.schedule();
+        co_await state_t::instance->lua_strand.schedule(task_kinds::lua_event, cb::strand::priority::high);
+        CORO_TRACE_SCOPE("OnKeyDown");
         auto& main_state = state_t::instance->lua_state;
         main_state.pushCallableOntoStack("OnKeyDown");
 
@@ -276,7 +286,8 @@ void lua_state_t::on_key_up(SDL_Keycode key)
 {
     [key]() -> cb::task<>
     {
-        co_await state_t::instance->main_lua_thread.schedule();
+        co_await state_t::instance->lua_strand.schedule(task_kinds::lua_event, cb::strand::priority::high);
+        CORO_TRACE_SCOPE("OnKeyUp");
         auto& main_state = state_t::instance->lua_state;
         main_state.pushCallableOntoStack("OnKeyUp");
 
@@ -302,7 +313,8 @@ void lua_state_t::on_mouse_down(int mb, bool double_click)
 {
     [mb, double_click]() -> cb::task<>
     {
-        co_await state_t::instance->main_lua_thread.schedule();
+        co_await state_t::instance->lua_strand.schedule(task_kinds::lua_event, cb::strand::priority::high);
+        CORO_TRACE_SCOPE("OnMouseDown");
         auto& main_state = state_t::instance->lua_state;
         main_state.pushCallableOntoStack("OnKeyDown");
 
@@ -323,7 +335,8 @@ void lua_state_t::on_mouse_up(int mb)
 {
     [mb]() -> cb::task<>
     {
-        co_await state_t::instance->main_lua_thread.schedule();
+        co_await state_t::instance->lua_strand.schedule(task_kinds::lua_event, cb::strand::priority::high);
+        CORO_TRACE_SCOPE("OnMouseUp");
         auto& main_state = state_t::instance->lua_state;
         main_state.pushCallableOntoStack("OnKeyUp");
 
@@ -342,7 +355,8 @@ void lua_state_t::on_exit()
 {
     []() -> cb::task<>
     {
-        co_await state_t::instance->main_lua_thread.schedule();
+        co_await state_t::instance->lua_strand.schedule(task_kinds::lua_event, cb::strand::priority::high);
+        CORO_TRACE_SCOPE("OnExit");
         auto& main_state = state_t::instance->lua_state;
         main_state.pushCallableOntoStack("OnExit");
         if (lua_pcall(main_state.l, 1, 0, 0))
@@ -356,7 +370,8 @@ bool lua_state_t::can_exit()
 {
     return []() -> cb::task<bool>
     {
-        co_await state_t::instance->main_lua_thread.schedule();
+        co_await state_t::instance->lua_strand.schedule(task_kinds::lua_event, cb::strand::priority::high);
+        CORO_TRACE_SCOPE("CanExit");
         bool ret = true;
         auto& main_state = state_t::instance->lua_state;
         main_state.pushCallableOntoStack("CanExit");
@@ -410,6 +425,32 @@ ImageHandle& lua_state_t::get_image_handle(int index) const
     return *handle;
 }
 
+int lua_state_t::load_file(const std::string& fileName)
+{
+    // On the lua strand, read on this thread. Joining the async read would block the thread holding
+    // the strand while the read completes on the global pool, which may have no other worker to do it.
+    if (state->lua_strand.running_in_this_thread())
+    {
+        return load_chunk(cb::read_file(fileName), fileName);
+    }
+    auto contents = cb::async_read_file(state->file_io, fileName, cb::static_thread_pool::priority::high).join();
+    return load_chunk(contents, fileName);
+}
+
+int lua_state_t::load_chunk(const cb::file_contents& contents, const std::string& fileName)
+{
+    if (contents.error)
+    {
+        // Same message as luaL_loadfile
+        lua_pushfstring(l, "cannot open %s: %s", fileName.c_str(), contents.error.message().c_str());
+        return LUA_ERRFILE;
+    }
+    // The chunk name luaL_loadfile would give it. The lexer skips a BOM and a leading '#' line itself.
+    const std::string chunkName = "@" + fileName;
+    return luaL_loadbuffer(l, reinterpret_cast<const char*>(contents.data.data()), contents.data.size(),
+                           chunkName.c_str());
+}
+
 int lua_state_t::set_window_title()
 {
     luaL_checktype(l, 1, LUA_TSTRING);
@@ -494,7 +535,7 @@ int lua_state_t::load_module()
         fileName = fileName + ".lua";
     }
 
-    int err = luaL_loadfile(l, fileName.c_str());
+    int err = load_file(fileName);
     assert(err == 0, "LoadModule() error loading '%s':\n%s", fileName.c_str(), lua_tostring(l, -1));
     lua_replace(l, 1);  // Replace module name with module main chunk
     lua_call(l, n - 1, LUA_MULTRET);
@@ -512,7 +553,7 @@ int lua_state_t::p_load_module()
     {
         fileName = fileName + ".lua";
     }
-    int err = luaL_loadfile(l, fileName.c_str());
+    int err = load_file(fileName);
     if (err)
     {
         return 1;
@@ -547,11 +588,19 @@ int lua_state_t::p_call()
     return lua_gettop(l);
 }
 
+// Set on a sub script that is being aborted. It stays set, so a pcall in the script can't swallow the abort.
+static void abort_hook(lua_State* l, lua_Debug*)
+{
+    luaL_error(l, "sub script aborted");
+}
+
 int lua_state_t::launch_sub_script()
 {
     int sub_id = -1;
 
-    [[maybe_unused]] auto task = [&]() -> cb::task<>
+    // Launched from the lua strand this stays bound to it, so after the sub script has run on the
+    // pool we are back on the strand to report to the main state.
+    state->background_tasks.spawn([&]() -> cb::affine_task<>
     {
         int n = lua_gettop(l);
         assert(n >= 3, "Usage: LaunchSubScript(scriptText, funcList, subList[, ...])");
@@ -580,41 +629,23 @@ int lua_state_t::launch_sub_script()
         std::string sync_override_calls = lua_tostring(l, 2);   // Sync call to main with return
         std::string async_override_calls = lua_tostring(l, 3);  // Async call to main
 
-        // Put us on another thread, do not use any captured reference beyond this point
-        co_await state->global_thread_pool.schedule();
+        auto cancel = state_t::instance->add_sub_script(sub.get_id());
 
-        // Override global functions that should be called on the main thread
+        // Do not use any captured reference beyond this point.
+        int has_error = co_await run_sub_script(sub, cancel, argsCount, sync_override_calls, async_override_calls);
+        state_t::instance->remove_sub_script(sub.get_id());
+
+        // An aborted script doesn't report back
+        if (cancel.is_cancellation_requested())
         {
-            std::string token;
-            std::istringstream tokenStream(sync_override_calls);
-            while (std::getline(tokenStream, token, ','))
-            {
-                lua_pushstring(sub.l, token.c_str());
-                lua_pushcclosure(
-                    sub.l, [](lua_State* local) -> int { return get_current_state(local)->call_main_from_sub(true); },
-                    1);
-                lua_setglobal(sub.l, token.c_str());
-            }
+            co_return;
         }
 
+        // Only launched off the strand, from OnInit, are we not back on it already.
+        if (!state_t::instance->lua_strand.running_in_this_thread())
         {
-            std::string token;
-            std::istringstream tokenStream(async_override_calls);
-            while (std::getline(tokenStream, token, ','))
-            {
-                lua_pushstring(sub.l, token.c_str());
-                lua_pushcclosure(
-                    sub.l, [](lua_State* local) -> int { return get_current_state(local)->call_main_from_sub(false); },
-                    1);
-                lua_setglobal(sub.l, token.c_str());
-            }
+            co_await state_t::instance->lua_strand.schedule(task_kinds::sub_call);
         }
-
-        // On the other thread start the lua script
-        int has_error = lua_pcall(sub.l, argsCount, LUA_MULTRET, 0);
-
-        // Move back to main lua_thread for OnSubFinished and OnSubError
-        co_await state_t::instance->main_lua_thread.schedule();
         auto& main_state = state_t::instance->lua_state;
 
         if (has_error)
@@ -637,13 +668,77 @@ int lua_state_t::launch_sub_script()
                 main_state.log_lua_error();
             }
         }
-    }();
+    }());
 
     lua_pushinteger(l, sub_id);
 
     return 1;
 }
 
+cb::task<int> lua_state_t::run_sub_script(lua_state_t& sub, cb::cancellation_token cancel, int argsCount,
+                                          const std::string& sync_override_calls,
+                                          const std::string& async_override_calls)
+{
+    // Put us on another thread. Sub scripts are interactive, so they go ahead of background image loading.
+    if (!co_await state_t::instance->global_thread_pool.schedule(cancel, task_kinds::sub_script,
+                                                                 cb::static_thread_pool::priority::normal))
+    {
+        // Aborted before it started
+        co_return 0;
+    }
+
+    // Override global functions that should be called on the main thread
+    {
+        std::string token;
+        std::istringstream tokenStream(sync_override_calls);
+        while (std::getline(tokenStream, token, ','))
+        {
+            lua_pushstring(sub.l, token.c_str());
+            lua_pushcclosure(
+                sub.l, [](lua_State* local) -> int { return get_current_state(local)->call_main_from_sub(true); },
+                1);
+            lua_setglobal(sub.l, token.c_str());
+        }
+    }
+
+    {
+        std::string token;
+        std::istringstream tokenStream(async_override_calls);
+        while (std::getline(tokenStream, token, ','))
+        {
+            lua_pushstring(sub.l, token.c_str());
+            lua_pushcclosure(
+                sub.l, [](lua_State* local) -> int { return get_current_state(local)->call_main_from_sub(false); },
+                1);
+            lua_setglobal(sub.l, token.c_str());
+        }
+    }
+
+    // On the other thread start the lua script. Aborting it sets a hook that raises an error
+    // in it, lua_sethook is the one call that is safe to make while the script is running.
+    // LuaJIT doesn't call hooks from compiled code, so a script may run on for a while.
+    cb::cancellation_registration on_abort{
+        cancel, [sub_l = sub.l] { lua_sethook(sub_l, abort_hook, LUA_MASKCALL | LUA_MASKCOUNT, 1000); }};
+    CORO_TRACE_SCOPE("sub script");
+    co_return lua_pcall(sub.l, argsCount, LUA_MULTRET, 0);
+}
+
+int lua_state_t::abort_sub_script()
+{
+    int n = lua_gettop(l);
+    assert(n >= 1 && lua_isnumber(l, 1), "Usage: AbortSubScript(ssID)");
+    state_t::instance->abort_sub_script(static_cast<int>(lua_tointeger(l, 1)));
+    return 0;
+}
+
+int lua_state_t::is_sub_script_running()
+{
+    int n = lua_gettop(l);
+    assert(n >= 1 && lua_isnumber(l, 1), "Usage: IsSubScriptRunning(ssID)");
+    lua_pushboolean(l, state_t::instance->is_sub_script_running(static_cast<int>(lua_tointeger(l, 1))));
+    return 1;
+}
+
 int lua_state_t::get_script_path()
 {
     lua_pushstring(l, std::filesystem::current_path().string().c_str());
@@ -786,7 +881,9 @@ int lua_state_t::img_handle_load(ImageHandle& handle)
             assert(false, "imgHandle:Load(): unrecognised flag '%s'", flag);
         }
     }
-    handle.image = std::make_unique<Image>(fileName, mipmaps, clamp, async);
+    // Images loaded synchronously are needed right away, so they go ahead of any background loading.
+    auto loading_priority = async ? handle.loading_priority : Image::priority::high;
+    handle.image = std::make_unique<Image>(fileName, mipmaps, clamp, async, loading_priority);
 
     return 0;
 }
@@ -803,6 +900,34 @@ int lua_state_t::img_handle_is_loading(ImageHandle& handle)
     return 1;
 }
 
+int lua_state_t::img_handle_set_loading_priority(ImageHandle& handle)
+{
+    int n = lua_gettop(l);
+    assert(n >= 1, "Usage: imgHandle:SetLoadingPriority(pri)");
+    assert(lua_isnumber(l, 1), "imgHandle:SetLoadingPriority() argument 1: expected number, got %t", 1);
+
+    // Higher numbers load sooner
+    auto pri = lua_tointeger(l, 1);
+    if (pri <= 0)
+    {
+        handle.loading_priority = Image::priority::low;
+    }
+    else if (pri == 1)
+    {
+        handle.loading_priority = Image::priority::normal;
+    }
+    else
+    {
+        handle.loading_priority = Image::priority::high;
+    }
+
+    if (handle.image)
+    {
+        handle.image->set_loading_priority(handle.loading_priority);
+    }
+    return 0;
+}
+
 int lua_state_t::img_handle_image_size(ImageHandle& handle)
 {
     lua_pushinteger(l, handle.image->width());
@@ -841,6 +966,7 @@ void lua_state_t::pushCallableOntoStack(const char* name)
 
 void lua_state_t::callParameterlessFunction(const char* name)
 {
+    CORO_TRACE_SCOPE(name);
     pushCallableOntoStack(name);
 
     // Call on frame
@@ -867,7 +993,7 @@ int lua_state_t::call_main_from_sub(bool sync)
         std::vector<lua_value> values = pop_save_values(l, 1);
         std::string funcName = name;
 
-        co_await state_t::instance->main_lua_thread.schedule();
+        co_await state_t::instance->lua_strand.schedule(task_kinds::sub_call);
         auto main_l = state_t::instance->lua_state.l;
         int ret_n = lua_gettop(main_l) + 1;
 
@@ -945,4 +1071,120 @@ void render_state_t::init()
     is_init = true;
 }
 
+static void print_pool_stats(FILE* out, const char* name, const cb::static_thread_pool& pool)
+{
+    auto print_row = [out](const char* label, const cb::static_thread_pool::thread_stats& s) {
+        fprintf(out,
+                "%8s %10llu %10llu %10llu %10llu %10llu %12llu %8llu %8llu %6llu %8llu %10llu\n",
+                label,
+                (unsigned long long)s.tasksExecuted,
+                (unsigned long long)s.localPops,
+                (unsigned long long)s.globalDequeues,
+                (unsigned long long)s.steals,
+                (unsigned long long)s.failedSteals,
+                (unsigned long long)s.spinIterations,
+                (unsigned long long)s.sleeps,
+                (unsigned long long)s.wakeUps,
+                (unsigned long long)s.localQueueHighWater,
+                (unsigned long long)s.spinCount,
+                (unsigned long long)s.wakeLatency.count());
+    };
+
+    const auto snapshot = pool.stats();
+    fprintf(out, "%s (%u threads)\n", name, pool.thread_count());
+    fprintf(out,
+            "%8s %10s %10s %10s %10s %10s %12s %8s %8s %6s %8s %10s\n",
+            "thread",
+            "executed",
+            "local",
+            "global",
+            "steals",
+            "failed",
+            "spins",
+            "sleeps",
+            "wakeups",
+            "hwm",
+            "spinlim",
+            "wake ns");
+    for (size_t i = 0; i < snapshot.threads.size(); ++i)
+    {
+        char label[16];
+        snprintf(label, sizeof(label), "%zu", i);
+        print_row(label, snapshot.threads[i]);
+    }
+    print_row("total", snapshot.total);
+}
+
+void state_t::print_thread_pool_stats(FILE* out) const
+{
+    print_pool_stats(out, "global_thread_pool", global_thread_pool);
+}
+
+bool state_t::write_task_histograms(const char* path) const
+{
+    FILE* out = fopen(path, "w");
+    if (!out)
+    {
+        return false;
+    }
+    global_thread_pool.write_category_stats(out);
+    fclose(out);
+    return true;
+}
+
+cb::cancellation_token state_t::add_sub_script(int id)
+{
+    std::lock_guard lock{sub_scripts_mutex};
+    return sub_scripts[id].token();
+}
+
+void state_t::remove_sub_script(int id)
+{
+    std::lock_guard lock{sub_scripts_mutex};
+    sub_scripts.erase(id);
+}
+
+void state_t::abort_sub_script(int id)
+{
+    // Requested outside of the lock, the callbacks run before request_cancellation returns
+    cb::cancellation_source source;
+    {
+        std::lock_guard lock{sub_scripts_mutex};
+        auto it = sub_scripts.find(id);
+        if (it == sub_scripts.end())
+        {
+            return;
+        }
+        source = it->second;
+    }
+    source.request_cancellation();
+}
+
+void state_t::abort_all_sub_scripts()
+{
+    std::vector<cb::cancellation_source> sources;
+    {
+        std::lock_guard lock{sub_scripts_mutex};
+        for (auto& [id, source] : sub_scripts)
+        {
+            sources.push_back(source);
+        }
+    }
+    for (auto& source : sources)
+    {
+        source.request_cancellation();
+    }
+}
+
+void state_t::wait_for_background_tasks()
+{
+    [this]() -> cb::task<> { co_await background_tasks.join(); }().join();
+}
+
+bool state_t::is_sub_script_running(int id)
+{
+    std::lock_guard lock{sub_scripts_mutex};
+    return sub_scripts.contains(id);
+}
+
 state_t* state_t::instance = nullptr;
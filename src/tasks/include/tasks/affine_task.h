@@ -0,0 +1,259 @@
+#pragma once
+#include <tasks/detail/frame_allocator.hpp>
+#include <tasks/static_thread_pool.h>
+#include <tasks/strand.h>
+#include <tasks/task.h>
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+namespace cb
+{
+class executor_ref;
+
+namespace detail
+{
+class executor_hop;
+
+// Starts suspended. Once resumed, it resumes its continuation on the executor: inline if it
+// is running on it already, otherwise after a schedule() on it. On a strand that is only if it
+// is still \p turn, the executor's turn() when the awaiting coroutine suspended. Another turn
+// belongs to a coroutine resuming us inline, from a release of some kind, in the middle of its
+// own work on the strand.
+executor_hop hop_to(executor_ref executor, std::uint64_t turn);
+}  // namespace detail
+
+// Refers to a strand or a static_thread_pool, or to no executor at all.
+class executor_ref
+{
+   public:
+    executor_ref() noexcept = default;
+    explicit executor_ref(static_thread_pool& pool) noexcept : pool_{&pool} {}
+    explicit executor_ref(strand& s) noexcept : strand_{&s} {}
+
+    // The strand held by the coroutine the calling thread is running, otherwise the pool the
+    // calling thread is a worker of, otherwise no executor.
+    static executor_ref current() noexcept
+    {
+        if (auto* s = strand::current())
+        {
+            return executor_ref{*s};
+        }
+        if (auto* pool = static_thread_pool::current())
+        {
+            return executor_ref{*pool};
+        }
+        return {};
+    }
+
+    explicit operator bool() const noexcept { return pool_ != nullptr || strand_ != nullptr; }
+
+    // A pool thread running a coroutine that holds a strand runs on the strand, not the pool.
+    bool running_in_this_thread() const noexcept { return *this == current(); }
+
+    // The strand's turn() if this refers to the strand the calling thread is running, otherwise 0.
+    std::uint64_t turn() const noexcept
+    {
+        return strand_ != nullptr && strand_->running_in_this_thread() ? strand_->turn() : 0;
+    }
+
+    friend bool operator==(const executor_ref&, const executor_ref&) noexcept = default;
+
+   private:
+    friend detail::executor_hop detail::hop_to(executor_ref executor, std::uint64_t turn);
+
+    static_thread_pool* pool_ = nullptr;
+    strand* strand_ = nullptr;
+};
+
+namespace detail
+{
+class executor_hop
+{
+   public:
+    struct promise_type : cppcoro::detail::pooled_frame
+    {
+        // The continuation may destroy the coroutine awaiting us, free our frame first.
+        struct final_awaitable
+        {
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) const noexcept
+            {
+                auto continuation = h.promise().continuation;
+                h.destroy();
+                return continuation;
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        executor_hop get_return_object() noexcept
+        {
+            return executor_hop{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        final_awaitable final_suspend() noexcept { return {}; }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        std::coroutine_handle<> continuation;
+    };
+
+    explicit executor_hop(std::coroutine_handle<promise_type> h) noexcept : coroutine{h} {}
+
+    std::coroutine_handle<promise_type> coroutine;
+};
+
+template <typename Awaitable>
+decltype(auto) get_awaiter(Awaitable&& awaitable) noexcept
+{
+    if constexpr (requires { std::forward<Awaitable>(awaitable).operator co_await(); })
+    {
+        return std::forward<Awaitable>(awaitable).operator co_await();
+    }
+    else
+    {
+        // Referring to it is fine, it lives until the end of the co_await expression.
+        return static_cast<Awaitable&>(awaitable);
+    }
+}
+
+template <typename T>
+constexpr bool is_schedule_operation_v =
+    std::is_base_of_v<static_thread_pool::schedule_operation, std::remove_cvref_t<T>> ||
+    std::is_same_v<strand::schedule_operation, std::remove_cvref_t<T>>;
+
+// Hands the awaiter a hop back to the executor in place of the awaiting coroutine.
+template <typename Awaiter>
+class affine_awaiter
+{
+   public:
+    affine_awaiter(Awaiter&& awaiter, executor_ref executor) noexcept
+        : awaiter_{std::forward<Awaiter>(awaiter)}, executor_{executor}
+    {
+    }
+
+    bool await_ready() { return awaiter_.await_ready(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation)
+    {
+        if (!executor_)
+        {
+            return suspend(continuation, continuation);
+        }
+
+        auto hop = hop_to(executor_, executor_.turn()).coroutine;
+        hop.promise().continuation = continuation;
+        return suspend(hop, continuation);
+    }
+
+    decltype(auto) await_resume() { return awaiter_.await_resume(); }
+
+   private:
+    std::coroutine_handle<> suspend(std::coroutine_handle<> resumer, std::coroutine_handle<> continuation)
+    {
+        using result_type = decltype(awaiter_.await_suspend(resumer));
+        if constexpr (std::is_void_v<result_type>)
+        {
+            awaiter_.await_suspend(resumer);
+            return std::noop_coroutine();
+        }
+        else if constexpr (std::is_same_v<result_type, bool>)
+        {
+            if (awaiter_.await_suspend(resumer))
+            {
+                return std::noop_coroutine();
+            }
+            // Not suspended after all, so we are still on the executor.
+            if (resumer != continuation)
+            {
+                resumer.destroy();
+            }
+            return continuation;
+        }
+        else
+        {
+            return awaiter_.await_suspend(resumer);
+        }
+    }
+
+    Awaiter awaiter_;
+    executor_ref executor_;
+};
+
+// Awaits a schedule() on an executor, and binds the coroutine to wherever that resumes it.
+template <typename Awaiter>
+class rebinding_awaiter
+{
+   public:
+    rebinding_awaiter(Awaiter&& awaiter, executor_ref& executor) noexcept
+        : awaiter_{std::forward<Awaiter>(awaiter)}, executor_{executor}
+    {
+    }
+
+    bool await_ready() { return awaiter_.await_ready(); }
+
+    decltype(auto) await_suspend(std::coroutine_handle<> continuation)
+    {
+        return awaiter_.await_suspend(continuation);
+    }
+
+    decltype(auto) await_resume()
+    {
+        executor_ = executor_ref::current();
+        return awaiter_.await_resume();
+    }
+
+   private:
+    Awaiter awaiter_;
+    executor_ref& executor_;
+};
+
+template <typename Task, typename T>
+struct affine_promise : promise<Task, T>
+{
+    Task get_return_object() { return std::coroutine_handle<affine_promise>::from_promise(*this); }
+
+    final_awaitable<affine_promise> final_suspend() noexcept { return {}; }
+
+    template <typename Awaitable>
+    auto await_transform(Awaitable&& awaitable) noexcept
+    {
+        using awaiter_type = decltype(get_awaiter(std::forward<Awaitable>(awaitable)));
+        if constexpr (is_schedule_operation_v<awaiter_type>)
+        {
+            return rebinding_awaiter<awaiter_type>{get_awaiter(std::forward<Awaitable>(awaitable)), executor};
+        }
+        else
+        {
+            return affine_awaiter<awaiter_type>{get_awaiter(std::forward<Awaitable>(awaitable)), executor};
+        }
+    }
+
+    // Where the coroutine runs between its co_awaits. Set on the thread that starts it.
+    executor_ref executor = executor_ref::current();
+};
+}  // namespace detail
+
+// A task that stays on the executor it was started on. Whatever it co_awaits, it is resumed
+// on that strand or pool afterwards: inline if the awaited work completes on it, in the same
+// turn of a strand, otherwise with a schedule() on it. So a coroutine started on a strand can
+// await work on the pool and carry on with the strand's state, without hopping back by hand.
+//
+// co_await on a schedule() of a strand or pool moves it on to that executor for good, the way
+// it does for any other coroutine. Started on a thread that runs no executor, it is resumed
+// wherever the awaited work completes until it schedules itself on one.
+//
+// Each hop back costs a frame from the frame allocator, awaiting something that is ready
+// already costs nothing.
+template <typename T = void>
+using affine_task = task<T, detail::affine_promise>;
+}  // namespace cb
@@ -0,0 +1,76 @@
+#ifndef CPPCORO_ASYNC_LATCH_HPP_INCLUDED
+#define CPPCORO_ASYNC_LATCH_HPP_INCLUDED
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+
+namespace cppcoro
+{
+class async_latch_operation;
+
+/// A count that coroutines can wait to reach zero with 'co_await', e.g. to
+/// wait for a number of pieces of work started elsewhere.
+///
+/// Counting down, and awaiting a latch that is ready, take a single atomic
+/// operation. The coroutines waiting are resumed inside the count_down()
+/// that brings the count to zero.
+class async_latch
+{
+   public:
+    /// A latch that starts with a count of zero or less is ready right away.
+    explicit async_latch(std::ptrdiff_t initialCount) noexcept;
+
+    /// Behaviour is undefined if there are coroutines still waiting.
+    ~async_latch();
+
+    async_latch(const async_latch&) = delete;
+    async_latch& operator=(const async_latch&) = delete;
+
+    bool is_ready() const noexcept;
+
+    /// Decrement the count by \p n. The call that brings the count to zero
+    /// resumes every waiting coroutine before returning.
+    void count_down(std::ptrdiff_t n = 1) noexcept;
+
+    /// Wait for the count to reach zero. Doesn't suspend if it has already.
+    async_latch_operation operator co_await() const noexcept;
+
+   private:
+    friend class async_latch_operation;
+
+    /// The value of m_state once the count has reached zero.
+    void* ready_state() const noexcept { return const_cast<async_latch*>(this); }
+
+    std::atomic<std::ptrdiff_t> m_count;
+
+    // ready_state() once the count has reached zero, otherwise the most
+    // recently queued operation, linked to the earlier ones through m_next,
+    // or nullptr if there are none.
+    mutable std::atomic<void*> m_state;
+};
+
+class async_latch_operation
+{
+   public:
+    explicit async_latch_operation(const async_latch& latch) noexcept : m_latch(latch) {}
+
+    bool await_ready() const noexcept { return m_latch.is_ready(); }
+    bool await_suspend(std::coroutine_handle<> awaiter) noexcept;
+    void await_resume() const noexcept {}
+
+   private:
+    friend class async_latch;
+
+    const async_latch& m_latch;
+    async_latch_operation* m_next = nullptr;
+    std::coroutine_handle<> m_awaiter;
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+using async_latch = cppcoro::async_latch;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#include <tasks/detached_task.h>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace cb
+{
+// Keeps track of work that is started and left to run on its own, so that it can all be
+// waited for later on, e.g. before shutting down the thread pool it runs on.
+//
+// spawn() takes over an awaitable, usually a task that has already started, and awaits it
+// in a detached_task of its own, so each frame is freed as soon as its work is done.
+// 'co_await scope.join()' resumes once all spawned work has completed. After that nothing
+// more may be spawned, and the scope must have been joined before it is destroyed.
+//
+// No <cassert> here, pob_system has an assert() of its own that the macro would clobber.
+class async_scope
+{
+   public:
+    async_scope() noexcept = default;
+
+    async_scope(const async_scope&) = delete;
+    async_scope& operator=(const async_scope&) = delete;
+
+    // Must have been joined.
+    ~async_scope() = default;
+
+    template <typename Awaitable>
+    void spawn(Awaitable&& awaitable)
+    {
+        on_work_started();
+        [](async_scope* scope, std::decay_t<Awaitable> work) -> detached_task
+        {
+            co_await std::move(work);
+            scope->on_work_finished();
+        }(this, std::forward<Awaitable>(awaitable));
+    }
+
+    class join_operation
+    {
+       public:
+        explicit join_operation(async_scope& scope) noexcept : scope_(scope) {}
+
+        bool await_ready() const noexcept { return scope_.count_.load(std::memory_order_acquire) == 0; }
+
+        bool await_suspend(std::coroutine_handle<> continuation) noexcept
+        {
+            scope_.continuation_ = continuation;
+            // Drop the count the scope started with, whoever drops the last one resumes us.
+            return scope_.count_.fetch_sub(1, std::memory_order_acq_rel) > 1;
+        }
+
+        void await_resume() const noexcept {}
+
+       private:
+        async_scope& scope_;
+    };
+
+    // Resumes the awaiting coroutine once all spawned work has completed, on the thread that
+    // completed the last of it, or inline if it has already.
+    [[nodiscard]] join_operation join() noexcept { return join_operation{*this}; }
+
+   private:
+    // Must not have been joined yet.
+    void on_work_started() noexcept { count_.fetch_add(1, std::memory_order_relaxed); }
+
+    void on_work_finished() noexcept
+    {
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            continuation_.resume();
+        }
+    }
+
+    // The work in flight, plus one until join() is awaited.
+    std::atomic<std::size_t> count_{1};
+    std::coroutine_handle<> continuation_;
+};
+}  // namespace cb
@@ -0,0 +1,145 @@
+#ifndef CPPCORO_ASYNC_SEMAPHORE_HPP_INCLUDED
+#define CPPCORO_ASYNC_SEMAPHORE_HPP_INCLUDED
+
+#include <tasks/static_thread_pool.h>
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+
+namespace cppcoro
+{
+class spin_mutex;
+class async_semaphore_acquire_operation;
+class async_semaphore_scoped_acquire_operation;
+
+/// A counting semaphore that coroutines acquire with 'co_await', to limit
+/// how many of them do something at once.
+///
+/// Acquiring an available permit, and releasing one nobody is waiting for,
+/// take a single atomic operation each. Coroutines waiting for a permit are
+/// not blocking any thread, they are handed the released permits in order
+/// of priority, in the order they started waiting within the same priority,
+/// and are resumed inside the call to release().
+class async_semaphore
+{
+   public:
+    using priority = static_thread_pool::priority;
+
+    explicit async_semaphore(std::uint32_t initialCount);
+
+    /// Behaviour is undefined if there are coroutines still waiting.
+    ~async_semaphore();
+
+    async_semaphore(const async_semaphore&) = delete;
+    async_semaphore& operator=(const async_semaphore&) = delete;
+
+    /// Take a permit if one is available, without waiting.
+    bool try_acquire() noexcept;
+
+    /// Take a permit, waiting for one to be released if none is available.
+    /// The caller has to release() it again.
+    [[nodiscard]] async_semaphore_acquire_operation acquire(priority p = priority::normal) noexcept;
+
+    /// Take a permit like acquire(). The result of 'co_await' is an
+    /// async_semaphore_permit that releases it when it goes out of scope.
+    [[nodiscard]] async_semaphore_scoped_acquire_operation scoped_acquire(priority p = priority::normal) noexcept;
+
+    /// Return \p count permits, resuming up to that many waiting coroutines
+    /// inside this call.
+    void release(std::uint32_t count = 1) noexcept;
+
+    /// The number of permits available. Can be out of date by the time it returns.
+    std::int64_t available() const noexcept;
+
+   private:
+    friend class async_semaphore_acquire_operation;
+
+    /// Pop the most urgent waiting operation, or nullptr if there is none.
+    /// Only called with m_mutex held.
+    async_semaphore_acquire_operation* pop_next() noexcept;
+
+    // The permits available, or minus the number of coroutines waiting (or
+    // about to wait) for one. Only when this goes negative, or from negative
+    // back up, do the operations take the lock.
+    std::atomic<std::int64_t> m_count;
+
+    // Guards everything below.
+    const std::unique_ptr<spin_mutex> m_mutex;
+
+    // Permits released to coroutines that took part in m_count but hadn't
+    // queued themselves yet. The next of them to get to the lock takes one.
+    std::uint64_t m_handedOver;
+
+    // Waiting operations by priority, linked through m_next in the order they arrived.
+    async_semaphore_acquire_operation* m_heads[static_thread_pool::priority_count];
+    async_semaphore_acquire_operation* m_tails[static_thread_pool::priority_count];
+};
+
+/// Holds on to a permit of an async_semaphore and releases it when destroyed.
+class async_semaphore_permit
+{
+   public:
+    explicit async_semaphore_permit(async_semaphore& semaphore) noexcept : m_semaphore(&semaphore) {}
+
+    async_semaphore_permit(async_semaphore_permit&& other) noexcept : m_semaphore(other.m_semaphore)
+    {
+        other.m_semaphore = nullptr;
+    }
+
+    async_semaphore_permit(const async_semaphore_permit&) = delete;
+    async_semaphore_permit& operator=(const async_semaphore_permit&) = delete;
+
+    ~async_semaphore_permit()
+    {
+        if (m_semaphore != nullptr)
+        {
+            m_semaphore->release();
+        }
+    }
+
+   private:
+    async_semaphore* m_semaphore;
+};
+
+class async_semaphore_acquire_operation
+{
+   public:
+    explicit async_semaphore_acquire_operation(async_semaphore& semaphore,
+                                               async_semaphore::priority p = async_semaphore::priority::normal) noexcept
+        : m_semaphore(semaphore), m_priority(p)
+    {
+    }
+
+    bool await_ready() const noexcept { return m_semaphore.try_acquire(); }
+    bool await_suspend(std::coroutine_handle<> awaiter) noexcept;
+    void await_resume() const noexcept {}
+
+   protected:
+    friend class async_semaphore;
+
+    async_semaphore& m_semaphore;
+
+   private:
+    async_semaphore::priority m_priority;
+    async_semaphore_acquire_operation* m_next = nullptr;
+    std::coroutine_handle<> m_awaiter;
+};
+
+class async_semaphore_scoped_acquire_operation : public async_semaphore_acquire_operation
+{
+   public:
+    using async_semaphore_acquire_operation::async_semaphore_acquire_operation;
+
+    [[nodiscard]] async_semaphore_permit await_resume() const noexcept { return async_semaphore_permit{m_semaphore}; }
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+using async_semaphore = cppcoro::async_semaphore;
+using async_semaphore_permit = cppcoro::async_semaphore_permit;
+}  // namespace cb
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef CPPCORO_CANCELLATION_HPP_INCLUDED
+#define CPPCORO_CANCELLATION_HPP_INCLUDED
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace cppcoro
+{
+namespace detail
+{
+class cancellation_state;
+}
+
+class cancellation_registration;
+
+/// Lets work that has been started find out whether it is still wanted.
+///
+/// Cancellation is cooperative: requesting it doesn't stop anything by
+/// itself, the work has to check the token at points where it can stop, or
+/// register a callback that makes it stop.
+class cancellation_token
+{
+   public:
+    /// Construct a token that can never be cancelled.
+    cancellation_token() noexcept : m_state(nullptr) {}
+
+    cancellation_token(const cancellation_token& other) noexcept;
+    cancellation_token(cancellation_token&& other) noexcept;
+
+    ~cancellation_token();
+
+    cancellation_token& operator=(const cancellation_token& other) noexcept;
+    cancellation_token& operator=(cancellation_token&& other) noexcept;
+
+    /// false if cancellation hasn't been requested and never will be,
+    /// because every source of the token is gone. Checks and callbacks can
+    /// then be skipped.
+    bool can_be_cancelled() const noexcept;
+
+    bool is_cancellation_requested() const noexcept;
+
+   private:
+    friend class cancellation_source;
+    friend class cancellation_registration;
+
+    explicit cancellation_token(detail::cancellation_state* state) noexcept;
+
+    detail::cancellation_state* m_state;
+};
+
+/// Requests the cancellation of the work holding one of its tokens. Copies
+/// of a source all request cancellation of the same tokens.
+class cancellation_source
+{
+   public:
+    cancellation_source();
+
+    cancellation_source(const cancellation_source& other) noexcept;
+    cancellation_source(cancellation_source&& other) noexcept;
+
+    ~cancellation_source();
+
+    cancellation_source& operator=(const cancellation_source& other) noexcept;
+    cancellation_source& operator=(cancellation_source&& other) noexcept;
+
+    /// false if this source has been moved from.
+    bool can_be_cancelled() const noexcept { return m_state != nullptr; }
+
+    cancellation_token token() const noexcept;
+
+    /// Flag the tokens as cancelled and run the callbacks registered with
+    /// them, on the calling thread, before returning. Only the first call
+    /// does anything.
+    void request_cancellation();
+
+    bool is_cancellation_requested() const noexcept;
+
+   private:
+    detail::cancellation_state* m_state;
+};
+
+/// Calls a callback on the thread that requests cancellation of a token, or
+/// straight away in the constructor if cancellation has been requested
+/// already. The callback must not throw.
+///
+/// The destructor deregisters the callback. If the callback is running on
+/// another thread at that moment, the destructor waits for it to return, so
+/// whatever the callback uses only needs to outlive the registration.
+class cancellation_registration
+{
+   public:
+    template <typename Fn, typename = std::enable_if_t<std::is_constructible_v<std::function<void()>, Fn&&>>>
+    cancellation_registration(cancellation_token token, Fn&& callback)
+        : m_token(std::move(token)), m_callback(std::forward<Fn>(callback))
+    {
+        register_callback();
+    }
+
+    cancellation_registration(const cancellation_registration&) = delete;
+    cancellation_registration& operator=(const cancellation_registration&) = delete;
+
+    ~cancellation_registration();
+
+   private:
+    friend class detail::cancellation_state;
+
+    void register_callback();
+
+    cancellation_token m_token;
+    std::function<void()> m_callback;
+
+    // Links in the list of callbacks of the token, guarded by its lock.
+    cancellation_registration* m_next = nullptr;
+    cancellation_registration* m_prev = nullptr;
+    bool m_registered = false;
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+using cancellation_token = cppcoro::cancellation_token;
+using cancellation_source = cppcoro::cancellation_source;
+using cancellation_registration = cppcoro::cancellation_registration;
+}  // namespace cb
+
+#endif
@@ -14,4 +14,15 @@
 #define CORO_WINDOWS _WIN32_WINNT
 #else
 #define CORO_WINDOWS 0
-#endif
\ No newline at end of file
+#endif
+
+#if defined(__linux__)
+#define CORO_LINUX 1
+#else
+#define CORO_LINUX 0
+#endif
+
+// Set by the TASKS_TRACE cmake option. See tasks/trace.h.
+#if !defined(CORO_TRACE)
+#define CORO_TRACE 0
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+#include <tasks/detail/frame_allocator.hpp>
+
+#include <coroutine>
+#include <exception>
+
+namespace cb
+{
+// The return type of a coroutine that nobody awaits or joins. Like task it starts running
+// straight away, but there is nothing to hold on to: the coroutine frees its own frame as
+// soon as it completes. An exception escaping it terminates the program, nobody else would
+// ever see it.
+//
+// To be able to wait for detached work to finish, e.g. at shutdown, spawn it on an
+// async_scope instead.
+class detached_task
+{
+   public:
+    struct promise_type : cppcoro::detail::pooled_frame
+    {
+        detached_task get_return_object() noexcept { return {}; }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+}  // namespace cb
@@ -0,0 +1,113 @@
+#ifndef CPPCORO_DETAIL_CHANNEL_HPP_INCLUDED
+#define CPPCORO_DETAIL_CHANNEL_HPP_INCLUDED
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace cppcoro
+{
+namespace detail
+{
+/// Storage for an item in a channel's ring buffer, constructed when it is
+/// sent and destroyed when it is received.
+template <typename T>
+class channel_storage
+{
+   public:
+    template <typename U>
+    void construct(U&& value)
+    {
+        ::new (static_cast<void*>(m_storage)) T(std::forward<U>(value));
+    }
+
+    /// Move the item out and destroy what is left of it.
+    T take() noexcept(std::is_nothrow_move_constructible_v<T>)
+    {
+        T* item = std::launder(reinterpret_cast<T*>(m_storage));
+        T value = std::move(*item);
+        item->~T();
+        return value;
+    }
+
+    void destroy() noexcept { std::launder(reinterpret_cast<T*>(m_storage))->~T(); }
+
+   private:
+    alignas(T) unsigned char m_storage[sizeof(T)];
+};
+
+/// The one coroutine that may be waiting on a side of a channel, for the
+/// item with a given index to be sent or for its slot to be freed. Whoever
+/// does that resumes it, inside the call that did.
+///
+/// The waiting side publishes the index it waits for and then checks again,
+/// the other side publishes the change and then checks for a waiter, each
+/// with a seq_cst fence in between. So at least one of them sees the other
+/// and the wake-up can't be lost.
+///
+/// While the waiting side checks again, the other side may take the wait but
+/// not resume it. The waiter goes on without suspending then. Otherwise it
+/// could be resumed, and the channel destroyed, while it is still checking.
+class channel_waiter
+{
+   public:
+    /// Wait for slot \p index, after finding it not ready.
+    ///
+    /// \return
+    /// false if \p isReady() turned true in the meantime, in which case the
+    /// caller is not resumed and mustn't suspend.
+    template <typename Ready>
+    bool suspend(std::coroutine_handle<> awaiter, std::uint64_t index, Ready isReady) noexcept
+    {
+        m_awaiter = awaiter;
+        m_waitingFor.store((index + 1) | checking, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (isReady())
+        {
+            // Take the wait back. If the other side took it first it didn't resume us either.
+            m_waitingFor.store(0, std::memory_order_relaxed);
+            return false;
+        }
+
+        // From here on we may be resumed, so this is the last use of the channel.
+        std::uint64_t expected = (index + 1) | checking;
+        return m_waitingFor.compare_exchange_strong(expected, index + 1, std::memory_order_release,
+                                                    std::memory_order_acquire);
+    }
+
+    /// Resume the coroutine waiting for slot \p index, if any. Called after
+    /// the change it waits for has been published.
+    void notify(std::uint64_t index) noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::uint64_t waitingFor = m_waitingFor.load(std::memory_order_relaxed);
+        while ((waitingFor & ~checking) == index + 1)
+        {
+            if (m_waitingFor.compare_exchange_weak(waitingFor, 0, std::memory_order_acquire,
+                                                   std::memory_order_relaxed))
+            {
+                if ((waitingFor & checking) == 0)
+                {
+                    m_awaiter.resume();
+                }
+                return;
+            }
+        }
+    }
+
+   private:
+    // Set in m_waitingFor while the waiting side checks again.
+    static constexpr std::uint64_t checking = std::uint64_t{1} << 63;
+
+    // One more than the index waited for, 0 if nobody is waiting.
+    std::atomic<std::uint64_t> m_waitingFor{0};
+    std::coroutine_handle<> m_awaiter;
+};
+}  // namespace detail
+}  // namespace cppcoro
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef CPPCORO_DETAIL_COMPLETION_LISTENER_HPP_INCLUDED
+#define CPPCORO_DETAIL_COMPLETION_LISTENER_HPP_INCLUDED
+
+#include <coroutine>
+
+namespace cppcoro
+{
+namespace detail
+{
+/// Notified in place of an awaiting coroutine when a task completes.
+///
+/// This lets when_all() and when_any() wait on many tasks at once without
+/// starting an extra coroutine for each of them.
+class completion_listener
+{
+   public:
+    /// Called on the thread that completed the task.
+    ///
+    /// \return
+    /// The coroutine to resume next, or std::noop_coroutine().
+    virtual std::coroutine_handle<> on_complete() noexcept = 0;
+
+   protected:
+    ~completion_listener() = default;
+};
+}  // namespace detail
+}  // namespace cppcoro
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef CPPCORO_DETAIL_FRAME_ALLOCATOR_HPP_INCLUDED
+#define CPPCORO_DETAIL_FRAME_ALLOCATOR_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cppcoro
+{
+namespace detail
+{
+/// Allocator for coroutine frames.
+///
+/// Frames are rounded up to one of a small number of size classes and kept
+/// on thread-local free lists when they are freed, so that the next coroutine
+/// of a similar size started on that thread reuses the memory without going
+/// through the global heap. A frame freed on a thread other than the one that
+/// allocated it is queued up on the freeing thread and handed back to its
+/// owner in batches, costing the owner a single atomic exchange to take back
+/// a whole batch. Frames too large for any size class use the global heap.
+class frame_allocator
+{
+   public:
+    /// Allocate memory for a coroutine frame of \p size bytes.
+    ///
+    /// \throw std::bad_alloc
+    /// If the memory could not be allocated.
+    static void* allocate(std::size_t size);
+
+    /// Free a frame returned by allocate(). May be called from any thread.
+    static void deallocate(void* frame) noexcept;
+
+    /// The number of frames allocated from the global heap so far, on any
+    /// thread, rather than reused from a free list.
+    static std::uint64_t heap_allocations() noexcept;
+};
+
+/// Base class for promise types whose coroutine frames are allocated
+/// with frame_allocator.
+struct pooled_frame
+{
+    static void* operator new(std::size_t size) { return frame_allocator::allocate(size); }
+
+    static void operator delete(void* frame) noexcept { frame_allocator::deallocate(frame); }
+};
+}  // namespace detail
+}  // namespace cppcoro
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef CPPCORO_DETAIL_POOL_JOIN_HPP_INCLUDED
+#define CPPCORO_DETAIL_POOL_JOIN_HPP_INCLUDED
+
+#include <tasks/detail/completion_listener.hpp>
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+
+namespace cppcoro
+{
+class static_thread_pool;
+
+namespace detail
+{
+/// Lets a worker of a static_thread_pool that joins a task keep running the
+/// pool's queued work until the task completes, rather than sit blocked
+/// while the work it may be waiting for piles up.
+///
+/// The worker only sleeps when the pool has nothing for it to do. It sleeps
+/// on a word of its own, so the task completing wakes it alone, and new work
+/// wakes it when there is no idle worker asleep to take the work instead.
+class pool_join final : public completion_listener
+{
+   public:
+    /// Join from the worker thread of the calling thread's pool.
+    /// Only valid if can_help().
+    pool_join() noexcept;
+
+    pool_join(const pool_join&) = delete;
+    pool_join& operator=(const pool_join&) = delete;
+
+    /// Whether the calling thread is a worker of a static_thread_pool that
+    /// may run the pool's work while it joins. Not if it is running a
+    /// coroutine that holds a strand: the work would run with the strand
+    /// still held, and could wait on it forever.
+    static bool can_help() noexcept;
+
+    std::coroutine_handle<> on_complete() noexcept override;
+
+    /// Run the pool's queued work on the calling thread until on_complete()
+    /// has been called.
+    void help_until_complete() noexcept;
+
+   private:
+    friend class cppcoro::static_thread_pool;
+
+    // The values of m_state.
+    static constexpr std::uint32_t awake = 0;
+    static constexpr std::uint32_t asleep = 1;
+    static constexpr std::uint32_t complete = 2;
+
+    /// Wake the joining thread if it is asleep, for new work.
+    ///
+    /// \return
+    /// false if it wasn't asleep.
+    bool try_wake() noexcept;
+
+    static_thread_pool& m_threadPool;
+
+    // The joining thread sleeps on this, alone.
+    std::atomic<std::uint32_t> m_state;
+
+    // Links the joins asleep in the same pool, see static_thread_pool::sleeping_joins.
+    pool_join* m_nextAsleep;
+};
+}  // namespace detail
+}  // namespace cppcoro
+
+#endif
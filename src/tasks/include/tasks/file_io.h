@@ -0,0 +1,225 @@
+#ifndef CPPCORO_FILE_IO_HPP_INCLUDED
+#define CPPCORO_FILE_IO_HPP_INCLUDED
+
+#include <tasks/config.h>
+#include <tasks/static_thread_pool.h>
+#include <tasks/task.h>
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace cppcoro
+{
+namespace detail
+{
+class io_uring_queue;
+}
+
+class spin_mutex;
+
+/// A file opened for reading. Closed when destroyed.
+class read_only_file
+{
+   public:
+#if CORO_WINDOWS
+    using native_handle_type = void*;
+#else
+    using native_handle_type = int;
+#endif
+
+    /// Construct a file that isn't open.
+    read_only_file() noexcept;
+
+    read_only_file(read_only_file&& other) noexcept;
+    read_only_file& operator=(read_only_file&& other) noexcept;
+
+    ~read_only_file();
+
+    /// Open an existing file.
+    ///
+    /// \param error
+    /// Set if the file couldn't be opened, in which case the returned file isn't open.
+    static read_only_file open(const std::filesystem::path& path, std::error_code& error) noexcept;
+
+    bool is_open() const noexcept;
+
+    /// The size of the file in bytes.
+    std::uint64_t size(std::error_code& error) const noexcept;
+
+    /// Read up to \p size bytes starting at \p offset, blocking the calling thread.
+    ///
+    /// \return
+    /// The number of bytes read, which is 0 at the end of the file.
+    std::size_t read_at(std::uint64_t offset, void* buffer, std::size_t size, std::error_code& error) const noexcept;
+
+    native_handle_type native_handle() const noexcept { return m_handle; }
+
+   private:
+    explicit read_only_file(native_handle_type handle) noexcept : m_handle(handle) {}
+
+    void close() noexcept;
+
+    native_handle_type m_handle;
+};
+
+struct read_result
+{
+    /// The number of bytes read. May be less than asked for, and is 0 at the end of the file.
+    std::size_t bytesRead = 0;
+    std::error_code error;
+};
+
+/// Reads files without blocking the threads of a static_thread_pool.
+///
+/// On Linux reads are handed to the kernel through io_uring, and a single
+/// thread of the service waits for their completions. Elsewhere, or where
+/// io_uring isn't available, a few threads of the service do blocking reads
+/// instead. Either way the coroutine awaiting a read is resumed on the
+/// completion pool, so the pool's workers only ever run the code before and
+/// after a read, never wait for one.
+class file_io_service
+{
+   public:
+    struct options
+    {
+        /// Reads that can be in flight in the kernel at once. Any more wait
+        /// in the service until some of those complete.
+        std::uint32_t queueDepth = 64;
+
+        /// Threads doing blocking reads, when io_uring isn't used.
+        std::uint32_t fallbackThreadCount = 2;
+
+        /// Use blocking reads even if io_uring is available.
+        bool forceFallback = false;
+    };
+
+    explicit file_io_service(static_thread_pool& completionPool);
+
+    file_io_service(static_thread_pool& completionPool, const options& opts);
+
+    file_io_service(const file_io_service&) = delete;
+    file_io_service& operator=(const file_io_service&) = delete;
+
+    /// Every read must have completed before the service is destroyed.
+    ~file_io_service();
+
+    bool uses_io_uring() const noexcept { return m_ring != nullptr; }
+
+    static_thread_pool& completion_pool() const noexcept { return m_completionPool; }
+
+    class read_operation
+    {
+       public:
+        read_operation(file_io_service* service, const read_only_file& file, std::uint64_t offset, void* buffer,
+                       std::size_t size, static_thread_pool::priority p) noexcept
+            : m_service(service),
+              m_file(&file),
+              m_offset(offset),
+              m_buffer(buffer),
+              m_size(size),
+              m_resumeOnPool(&service->m_completionPool, p)
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept;
+        read_result await_resume() const noexcept { return m_result; }
+
+       private:
+        friend class file_io_service;
+
+        /// Schedule the awaiting coroutine on the completion pool. The
+        /// operation may be destroyed as soon as this has been called.
+        void complete() noexcept { m_resumeOnPool.await_suspend(m_awaitingCoroutine); }
+
+        file_io_service* m_service;
+        const read_only_file* m_file;
+        std::uint64_t m_offset;
+        void* m_buffer;
+        std::size_t m_size;
+        static_thread_pool::schedule_operation m_resumeOnPool;
+        std::coroutine_handle<> m_awaitingCoroutine;
+        read_result m_result;
+        read_operation* m_next = nullptr;
+    };
+
+    /// Read up to \p size bytes of \p file starting at \p offset. The
+    /// awaiting coroutine is resumed on the completion pool, at priority
+    /// \p p, once the read has completed.
+    ///
+    /// The file and the buffer must stay alive until then.
+    [[nodiscard]] read_operation read_at(const read_only_file& file, std::uint64_t offset, void* buffer,
+                                         std::size_t size,
+                                         static_thread_pool::priority p = static_thread_pool::priority::normal) noexcept
+    {
+        return read_operation{this, file, offset, buffer, size, p};
+    }
+
+   private:
+    class fallback_queue;
+
+    void submit(read_operation* operation) noexcept;
+
+    /// Queue reads that are waiting for room in the ring onto it. Called with
+    /// m_submitMutex held, the caller hands them to the kernel after releasing it.
+    ///
+    /// \return
+    /// true if any were queued.
+    bool prepare_pending() noexcept;
+
+    void run_completion_thread() noexcept;
+
+    void run_fallback_thread() noexcept;
+
+    static_thread_pool& m_completionPool;
+
+    // Null if the fallback threads do the reads.
+    std::unique_ptr<detail::io_uring_queue> m_ring;
+
+    // Guards queuing onto the ring and everything below, but not the system
+    // call that hands the queued reads to the kernel.
+    const std::unique_ptr<spin_mutex> m_submitMutex;
+    std::uint32_t m_inFlight;
+    read_operation* m_pendingHead;
+    read_operation* m_pendingTail;
+
+    const std::unique_ptr<fallback_queue> m_fallback;
+
+    std::vector<std::thread> m_threads;
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+using read_only_file = cppcoro::read_only_file;
+using read_result = cppcoro::read_result;
+using file_io_service = cppcoro::file_io_service;
+
+// The whole of a file, or why it couldn't be read.
+struct file_contents
+{
+    std::vector<std::byte> data;
+    std::error_code error;
+};
+
+// Read a whole file through the service. Resumes on its completion pool, at priority p, once the
+// last read has completed.
+//
+// The file is opened, and its size looked up, on the calling thread. Only the reads themselves
+// are asynchronous.
+task<file_contents> async_read_file(file_io_service& io, std::filesystem::path path,
+                                   static_thread_pool::priority p = static_thread_pool::priority::normal);
+
+// Read a whole file on the calling thread, blocking it until done. For callers that can't wait for
+// async_read_file, such as a coroutine holding a strand: joining from it would keep its thread from
+// the pool, which may have no other thread to complete the read on.
+file_contents read_file(const std::filesystem::path& path);
+}  // namespace cb
+
+#endif
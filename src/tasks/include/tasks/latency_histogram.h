@@ -0,0 +1,114 @@
+#ifndef CPPCORO_LATENCY_HISTOGRAM_HPP_INCLUDED
+#define CPPCORO_LATENCY_HISTOGRAM_HPP_INCLUDED
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace cppcoro
+{
+/// A histogram of durations, HDR style: the buckets get wider as the
+/// durations get longer, so that every duration from a nanosecond up to
+/// several hours is counted with the same relative precision, of one part
+/// in sub_bucket_count, in a fixed number of buckets.
+///
+/// Durations up to 2 * sub_bucket_count ns have a bucket each, after that
+/// every power of two is split into sub_bucket_count equal buckets.
+class latency_histogram
+{
+   public:
+    using duration = std::chrono::nanoseconds;
+
+    static constexpr std::uint32_t sub_bucket_bits = 4;
+    static constexpr std::uint32_t sub_bucket_count = 1u << sub_bucket_bits;
+
+    /// Longer durations are counted as this one, about 4.9 hours.
+    static constexpr std::uint64_t max_trackable_ns = (std::uint64_t{1} << 44) - 1;
+
+    static constexpr std::size_t bucket_count = (44 - sub_bucket_bits + 1) * sub_bucket_count;
+
+    static constexpr std::size_t bucket_index(std::uint64_t ns) noexcept
+    {
+        if (ns > max_trackable_ns)
+        {
+            ns = max_trackable_ns;
+        }
+        if (ns < sub_bucket_count)
+        {
+            return ns;
+        }
+        const std::uint32_t shift = static_cast<std::uint32_t>(std::bit_width(ns)) - 1 - sub_bucket_bits;
+        return (shift + 1) * sub_bucket_count + ((ns >> shift) - sub_bucket_count);
+    }
+
+    /// The shortest duration, in nanoseconds, counted in bucket \p index.
+    static constexpr std::uint64_t bucket_lowest_ns(std::size_t index) noexcept
+    {
+        if (index < sub_bucket_count)
+        {
+            return index;
+        }
+        const std::size_t shift = index / sub_bucket_count - 1;
+        return (index % sub_bucket_count + sub_bucket_count) << shift;
+    }
+
+    /// The longest duration, in nanoseconds, counted in bucket \p index.
+    static constexpr std::uint64_t bucket_highest_ns(std::size_t index) noexcept
+    {
+        return index + 1 < bucket_count ? bucket_lowest_ns(index + 1) - 1 : max_trackable_ns;
+    }
+
+    void record(duration d, std::uint64_t count = 1) noexcept
+    {
+        const auto ns = d.count() > 0 ? static_cast<std::uint64_t>(d.count()) : 0;
+        m_counts[bucket_index(ns)] += count;
+        m_totalCount += count;
+    }
+
+    std::uint64_t count() const noexcept { return m_totalCount; }
+
+    /// The number of durations counted in bucket \p index.
+    std::uint64_t bucket(std::size_t index) const noexcept { return m_counts[index]; }
+
+    /// The duration that \p percentile percent of the recorded durations
+    /// are shorter than or as long as, rounded up to the end of its bucket.
+    /// Zero if nothing was recorded.
+    duration value_at_percentile(double percentile) const noexcept
+    {
+        if (m_totalCount == 0)
+        {
+            return duration::zero();
+        }
+
+        auto wanted = static_cast<std::uint64_t>(percentile / 100.0 * static_cast<double>(m_totalCount) + 0.5);
+        wanted = wanted < 1 ? 1 : (wanted > m_totalCount ? m_totalCount : wanted);
+
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            seen += m_counts[i];
+            if (seen >= wanted)
+            {
+                return duration{bucket_highest_ns(i)};
+            }
+        }
+        return duration{max_trackable_ns};
+    }
+
+    /// The longest duration recorded, rounded up to the end of its bucket.
+    duration max() const noexcept { return value_at_percentile(100.0); }
+
+   private:
+    std::array<std::uint64_t, bucket_count> m_counts{};
+    std::uint64_t m_totalCount = 0;
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+using latency_histogram = cppcoro::latency_histogram;
+}
+
+#endif
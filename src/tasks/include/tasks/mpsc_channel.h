@@ -0,0 +1,216 @@
+#ifndef CPPCORO_MPSC_CHANNEL_HPP_INCLUDED
+#define CPPCORO_MPSC_CHANNEL_HPP_INCLUDED
+
+#include <tasks/async_semaphore.h>
+#include <tasks/detail/channel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace cppcoro
+{
+/// A bounded first-in first-out channel from any number of sending
+/// coroutines or threads to one receiving coroutine or thread. See
+/// spsc_channel for a single sender, which is cheaper.
+///
+/// Items are kept in a ring buffer with a sequence number per slot. A sender
+/// takes one of the free slots counted by an async_semaphore, claims the next
+/// index with a single atomic increment and publishes the item through its
+/// slot's sequence number. The receiver takes items in index order, so an
+/// item sent while an earlier index is still being written waits for it.
+/// Only one coroutine may receive at a time.
+///
+/// A receiver waiting for an item is resumed inside the send() or try_send()
+/// of that item. Senders waiting for room are resumed in the order they
+/// started waiting, inside the receive() or try_receive() that makes it.
+template <typename T>
+class mpsc_channel
+{
+    // A sender can't back out of a claimed index, the item has to be moved into the slot.
+    static_assert(std::is_nothrow_move_constructible_v<T>, "mpsc_channel items must be nothrow move constructible");
+
+    struct slot
+    {
+        // For the next index i to use the slot: i while it is free, i + 1 once it holds item i.
+        std::atomic<std::uint64_t> sequence;
+        detail::channel_storage<T> item;
+    };
+
+   public:
+    /// \p capacity is rounded up to a power of two.
+    explicit mpsc_channel(std::size_t capacity)
+        : m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 1)) - 1),
+          m_slots(std::make_unique<slot[]>(m_mask + 1)),
+          m_freeSlots(static_cast<std::uint32_t>(m_mask + 1)),
+          m_tail(0),
+          m_head(0)
+    {
+        for (std::size_t i = 0; i <= m_mask; ++i)
+        {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// Destroys the items that haven't been received. Behaviour is undefined
+    /// if a coroutine is still waiting or sending.
+    ~mpsc_channel()
+    {
+        for (std::uint64_t i = m_head; is_ready(i); ++i)
+        {
+            m_slots[i & m_mask].item.destroy();
+        }
+    }
+
+    mpsc_channel(const mpsc_channel&) = delete;
+    mpsc_channel& operator=(const mpsc_channel&) = delete;
+
+    std::size_t capacity() const noexcept { return m_mask + 1; }
+
+    /// Send \p value if there is room for it, without waiting. It is only
+    /// moved from if this returns true.
+    bool try_send(T&& value)
+    {
+        if (!m_freeSlots.try_acquire())
+        {
+            return false;
+        }
+        push(std::move(value));
+        return true;
+    }
+
+    bool try_send(const T& value)
+    {
+        T copy(value);
+        return try_send(std::move(copy));
+    }
+
+    /// Take the next item if there is one, without waiting.
+    std::optional<T> try_receive()
+    {
+        if (!is_ready(m_head))
+        {
+            return std::nullopt;
+        }
+
+        const std::uint64_t head = m_head++;
+        auto& s = m_slots[head & m_mask];
+        std::optional<T> value{s.item.take()};
+        s.sequence.store(head + capacity(), std::memory_order_release);
+        m_freeSlots.release();
+        return value;
+    }
+
+    class send_operation
+    {
+       public:
+        send_operation(mpsc_channel& channel, T&& value)
+            : m_channel(channel), m_value(std::move(value)), m_acquire(channel.m_freeSlots.acquire())
+        {
+        }
+
+        bool await_ready() noexcept
+        {
+            m_sent = m_channel.try_send(std::move(m_value));
+            return m_sent;
+        }
+
+        bool await_suspend(std::coroutine_handle<> awaiter) noexcept { return m_acquire.await_suspend(awaiter); }
+
+        void await_resume() noexcept
+        {
+            if (!m_sent)
+            {
+                // Holding a free slot now.
+                m_channel.push(std::move(m_value));
+            }
+        }
+
+       private:
+        mpsc_channel& m_channel;
+        T m_value;
+        bool m_sent = false;
+        async_semaphore_acquire_operation m_acquire;
+    };
+
+    class receive_operation
+    {
+       public:
+        explicit receive_operation(mpsc_channel& channel) noexcept : m_channel(channel) {}
+
+        bool await_ready() noexcept { return m_channel.is_ready(m_channel.m_head); }
+
+        bool await_suspend(std::coroutine_handle<> awaiter) noexcept
+        {
+            const std::uint64_t head = m_channel.m_head;
+            return m_channel.m_receiver.suspend(awaiter, head,
+                                                [&channel = m_channel, head] { return channel.is_ready(head); });
+        }
+
+        T await_resume() { return std::move(*m_channel.try_receive()); }
+
+       private:
+        mpsc_channel& m_channel;
+    };
+
+    /// Send \p value, waiting for room if the channel is full.
+    [[nodiscard]] send_operation send(T value) { return send_operation{*this, std::move(value)}; }
+
+    /// Take the next item, waiting for one to be sent if there is none.
+    /// The result of 'co_await' is the item.
+    [[nodiscard]] receive_operation receive() noexcept { return receive_operation{*this}; }
+
+   private:
+    /// Send \p value into a free slot the caller has taken from m_freeSlots.
+    void push(T&& value) noexcept
+    {
+        const std::uint64_t index = m_tail.fetch_add(1, std::memory_order_relaxed);
+        auto& s = m_slots[index & m_mask];
+
+        // The item that was in the slot has been received, but that may not be
+        // visible on this thread just yet.
+        while (s.sequence.load(std::memory_order_acquire) != index)
+        {
+            std::this_thread::yield();
+        }
+
+        s.item.construct(std::move(value));
+        s.sequence.store(index + 1, std::memory_order_release);
+        m_receiver.notify(index);
+    }
+
+    bool is_ready(std::uint64_t index) const noexcept
+    {
+        return m_slots[index & m_mask].sequence.load(std::memory_order_acquire) == index + 1;
+    }
+
+    const std::size_t m_mask;
+    const std::unique_ptr<slot[]> m_slots;
+
+    async_semaphore m_freeSlots;
+
+    // The next index to claim for sending.
+    alignas(64) std::atomic<std::uint64_t> m_tail;
+
+    // Only touched by the receiver. The index of the next item to receive.
+    alignas(64) std::uint64_t m_head;
+
+    alignas(64) detail::channel_waiter m_receiver;
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+template <typename T>
+using mpsc_channel = cppcoro::mpsc_channel<T>;
+}
+
+#endif
@@ -0,0 +1,260 @@
+#pragma once
+#include <tasks/detail/frame_allocator.hpp>
+#include <tasks/static_thread_pool.h>
+#include <tasks/task.h>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace cb
+{
+// The half-open range of indices [begin, end).
+struct index_range
+{
+    std::size_t begin = 0;
+    std::size_t end = 0;
+
+    std::size_t size() const noexcept { return end > begin ? end - begin : 0; }
+};
+
+namespace detail
+{
+// Counts the parts of a range still being worked on, plus one for the coroutine waiting for them.
+class parallel_counter
+{
+   public:
+    // Only called while holding a count already, so this can never race with the last finish().
+    void add() noexcept { m_count.fetch_add(1, std::memory_order_relaxed); }
+
+    // Returns false if every part has finished already and the awaiting coroutine should not suspend.
+    bool try_await(std::coroutine_handle<> awaitingCoroutine) noexcept
+    {
+        m_awaitingCoroutine = awaitingCoroutine;
+        return m_count.fetch_sub(1, std::memory_order_acq_rel) > 1;
+    }
+
+    std::coroutine_handle<> finish() noexcept
+    {
+        if (m_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            return m_awaitingCoroutine;
+        }
+        return std::noop_coroutine();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept { return try_await(awaitingCoroutine); }
+
+    void await_resume() const noexcept {}
+
+   private:
+    std::atomic<std::size_t> m_count = 1;
+    std::coroutine_handle<> m_awaitingCoroutine;
+};
+
+// Works on part of a parallel_for() or parallel_reduce() range. Nothing awaits it, it counts
+// down the counter of the whole range and destroys itself when it is done.
+class parallel_range_task
+{
+   public:
+    struct promise_type;
+
+    struct final_awaitable
+    {
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) const noexcept
+        {
+            auto next = h.promise().counter->finish();
+            h.destroy();
+            return next;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type : cppcoro::detail::pooled_frame
+    {
+        template <typename State>
+        promise_type(State& state, index_range) noexcept : counter(&state.counter)
+        {
+        }
+
+        parallel_range_task get_return_object() noexcept { return {}; }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        final_awaitable final_suspend() noexcept { return {}; }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept {}
+
+        parallel_counter* counter;
+    };
+};
+
+// Lazy binary splitting: work through the range a grain at a time and, whenever the local
+// queue has run dry because what we queued there before has been stolen, queue the upper half
+// of what is left for the next thief. A pool with nothing to steal splits only log2 times.
+template <typename State>
+parallel_range_task run_parallel_range(State& state, index_range range)
+{
+    co_await state.pool.schedule();
+
+    auto partial = state.make_partial();
+    while (range.size() > state.grain)
+    {
+        if (state.pool.is_local_queue_empty())
+        {
+            const std::size_t middle = range.begin + range.size() / 2;
+            state.counter.add();
+            run_parallel_range(state, index_range{middle, range.end});
+            range.end = middle;
+        }
+        else
+        {
+            const index_range chunk{range.begin, range.begin + state.grain};
+            state.process(chunk, partial);
+            range.begin = chunk.end;
+        }
+    }
+    state.process(range, partial);
+    state.finish_partial(std::move(partial));
+}
+
+template <typename Fn>
+struct parallel_for_state
+{
+    parallel_for_state(static_thread_pool& threadPool, std::size_t grainSize, Fn& func) noexcept
+        : pool(threadPool), grain(grainSize > 0 ? grainSize : 1), fn(func)
+    {
+    }
+
+    struct no_partial
+    {
+    };
+
+    no_partial make_partial() const noexcept { return {}; }
+
+    void process(index_range chunk, no_partial&)
+    {
+        if constexpr (std::is_invocable_v<Fn&, index_range>)
+        {
+            fn(chunk);
+        }
+        else
+        {
+            for (std::size_t i = chunk.begin; i < chunk.end; ++i)
+            {
+                fn(i);
+            }
+        }
+    }
+
+    void finish_partial(no_partial&&) noexcept {}
+
+    static_thread_pool& pool;
+    const std::size_t grain;
+    Fn& fn;
+    parallel_counter counter;
+};
+
+template <typename T, typename Fn, typename Combine>
+struct parallel_reduce_state
+{
+    parallel_reduce_state(static_thread_pool& threadPool, std::size_t grainSize, const T& identityValue, Fn& func,
+                          Combine& combineFunc)
+        : pool(threadPool),
+          grain(grainSize > 0 ? grainSize : 1),
+          identity(identityValue),
+          fn(func),
+          combine(combineFunc),
+          result(identityValue)
+    {
+    }
+
+    T make_partial() const { return identity; }
+
+    void process(index_range chunk, T& partial)
+    {
+        if constexpr (std::is_invocable_v<Fn&, T, index_range>)
+        {
+            partial = fn(std::move(partial), chunk);
+        }
+        else
+        {
+            for (std::size_t i = chunk.begin; i < chunk.end; ++i)
+            {
+                partial = fn(std::move(partial), i);
+            }
+        }
+    }
+
+    // Only called once for each part the range was split into, so this lock is rarely contended.
+    void finish_partial(T&& partial)
+    {
+        std::lock_guard lock{mutex};
+        result = combine(std::move(result), std::move(partial));
+    }
+
+    static_thread_pool& pool;
+    const std::size_t grain;
+    const T& identity;
+    Fn& fn;
+    Combine& combine;
+    T result;
+    std::mutex mutex;
+    parallel_counter counter;
+};
+}  // namespace detail
+
+// Call fn for every index in the range on the threads of the pool, either as fn(index) or, if it
+// takes an index_range, as fn(chunk) for chunks of up to grain indices. The range is split
+// further only while other threads are stealing from the threads working on it, so grain only
+// needs to be large enough to make a single call worth it.
+//
+// Returns once fn has been called for every index, resuming on whichever pool thread finished
+// last. fn must not throw.
+template <typename Fn>
+task<> parallel_for(static_thread_pool& pool, index_range range, std::size_t grain, Fn fn)
+{
+    if (range.size() == 0)
+    {
+        co_return;
+    }
+
+    detail::parallel_for_state<Fn> state{pool, grain, fn};
+    state.counter.add();
+    detail::run_parallel_range(state, range);
+    co_await state.counter;
+}
+
+// Fold every index in the range into a result on the threads of the pool. Each part of the range
+// starts from identity and calls either acc = fn(acc, index) or, if it takes an index_range,
+// acc = fn(acc, chunk) for chunks of up to grain indices. The parts are then folded together with
+// combine(a, b), in no particular order, so combine has to be associative and commutative.
+//
+// Resumes on whichever pool thread finished last. fn and combine must not throw.
+template <typename T, typename Fn, typename Combine>
+task<T> parallel_reduce(static_thread_pool& pool, index_range range, std::size_t grain, T identity, Fn fn,
+                        Combine combine)
+{
+    if (range.size() == 0)
+    {
+        co_return identity;
+    }
+
+    detail::parallel_reduce_state<T, Fn, Combine> state{pool, grain, identity, fn, combine};
+    state.counter.add();
+    detail::run_parallel_range(state, range);
+    co_await state.counter;
+    co_return std::move(state.result);
+}
+
+}  // namespace cb
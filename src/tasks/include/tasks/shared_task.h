@@ -1,4 +1,7 @@
 #pragma once
+#include <tasks/detail/completion_listener.hpp>
+#include <tasks/detail/frame_allocator.hpp>
+
 #include <coroutine>
 #include <iostream>
 #include <semaphore>
@@ -12,6 +15,11 @@ struct shared_task_waiter
 {
     std::coroutine_handle<> continuation_;
     shared_task_waiter* next_ = nullptr;
+
+    // Notified instead of resuming continuation_ when set.
+    cppcoro::detail::completion_listener* listener_ = nullptr;
+
+    void resume() noexcept { (listener_ != nullptr ? listener_->on_complete() : continuation_).resume(); }
 };
 
 template <typename P>
@@ -38,18 +46,18 @@ struct shared_final_awaitable
                 // Read the m_next pointer before resuming the coroutine
                 // since resuming the coroutine may destroy the shared_task_waiter value.
                 auto* next = waiter->next_;
-                waiter->continuation_.resume();
+                waiter->resume();
                 waiter = next;
             }
 
             // Resume last waiter in tail position to allow it to potentially
             // be compiled as a tail-call.
-            waiter->continuation_.resume();
+            waiter->resume();
         }
     }
 };
 
-struct shared_promise_base
+struct shared_promise_base : cppcoro::detail::pooled_frame
 {
     std::suspend_never initial_suspend() { return {}; }
 
@@ -184,6 +192,7 @@ class [[nodiscard]] shared_task
 {
    public:
     using promise_type = detail::shared_promise<shared_task, T>;
+    using value_type = T;
 
     shared_task() noexcept = default;
     ~shared_task() { destroy(); }
@@ -234,6 +243,7 @@ class [[nodiscard]] shared_task
     bool await_suspend(std::coroutine_handle<> continuation) noexcept
     {
         waiter_.continuation_ = continuation;
+        waiter_.listener_ = nullptr;
         return coroutine_.promise().try_await(&waiter_, coroutine_);
     }
 
@@ -249,6 +259,27 @@ class [[nodiscard]] shared_task
         }
     }
 
+    // Used by when_all() and when_any() in place of co_await. Has the listener notified when
+    // the coroutine completes, queueing \p waiter on the list of waiters to do so. The waiter
+    // must stay alive until then. Returns false, without notifying, if it has already completed.
+    bool try_notify_on_completion(cppcoro::detail::completion_listener& listener,
+                                  detail::shared_task_waiter& waiter) noexcept
+    {
+        if (!coroutine_)
+        {
+            return false;
+        }
+
+        waiter.listener_ = &listener;
+        return coroutine_.promise().try_await(&waiter, coroutine_);
+    }
+
+    // As above, using the waiter that this shared_task uses for co_await.
+    bool try_notify_on_completion(cppcoro::detail::completion_listener& listener) noexcept
+    {
+        return try_notify_on_completion(listener, waiter_);
+    }
+
    protected:
     std::coroutine_handle<promise_type> coroutine_ = nullptr;
     detail::shared_task_waiter waiter_;
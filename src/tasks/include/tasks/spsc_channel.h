@@ -0,0 +1,199 @@
+#ifndef CPPCORO_SPSC_CHANNEL_HPP_INCLUDED
+#define CPPCORO_SPSC_CHANNEL_HPP_INCLUDED
+
+#include <tasks/detail/channel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace cppcoro
+{
+/// A bounded first-in first-out channel from one sending coroutine or thread
+/// to one receiving coroutine or thread, for streaming items between the
+/// stages of a pipeline without a hop per item.
+///
+/// Items are kept in a ring buffer. Each side owns the index it advances and
+/// keeps a copy of the other side's, so that sending and receiving without
+/// having to wait touch no cache line the other side writes, most of the
+/// time. Only one coroutine may send at a time, and only one may receive.
+///
+/// A receiver waiting for an item is resumed inside the send() or try_send()
+/// of that item, a sender waiting for room inside the receive() or
+/// try_receive() that makes it.
+template <typename T>
+class spsc_channel
+{
+   public:
+    /// \p capacity is rounded up to a power of two.
+    explicit spsc_channel(std::size_t capacity)
+        : m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 1)) - 1),
+          m_slots(std::make_unique<detail::channel_storage<T>[]>(m_mask + 1)),
+          m_head(0),
+          m_cachedTail(0),
+          m_tail(0),
+          m_cachedHead(0)
+    {
+    }
+
+    /// Destroys the items that haven't been received. Behaviour is undefined
+    /// if a coroutine is still waiting.
+    ~spsc_channel()
+    {
+        const std::uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        for (std::uint64_t i = m_head.load(std::memory_order_relaxed); i != tail; ++i)
+        {
+            m_slots[i & m_mask].destroy();
+        }
+    }
+
+    spsc_channel(const spsc_channel&) = delete;
+    spsc_channel& operator=(const spsc_channel&) = delete;
+
+    std::size_t capacity() const noexcept { return m_mask + 1; }
+
+    /// Send \p value if there is room for it, without waiting. It is only
+    /// moved from if this returns true.
+    bool try_send(T&& value) { return try_push(std::move(value)); }
+    bool try_send(const T& value) { return try_push(value); }
+
+    /// Take the next item if there is one, without waiting.
+    std::optional<T> try_receive()
+    {
+        if (!has_item())
+        {
+            return std::nullopt;
+        }
+
+        const std::uint64_t head = m_head.load(std::memory_order_relaxed);
+        std::optional<T> value{m_slots[head & m_mask].take()};
+        m_head.store(head + 1, std::memory_order_release);
+        m_sender.notify(head + capacity());
+        return value;
+    }
+
+    class send_operation
+    {
+       public:
+        send_operation(spsc_channel& channel, T&& value) : m_channel(channel), m_value(std::move(value)) {}
+
+        bool await_ready()
+        {
+            m_sent = m_channel.try_send(std::move(m_value));
+            return m_sent;
+        }
+
+        bool await_suspend(std::coroutine_handle<> awaiter) noexcept
+        {
+            const std::uint64_t tail = m_channel.m_tail.load(std::memory_order_relaxed);
+            return m_channel.m_sender.suspend(awaiter, tail, [&channel = m_channel, tail] {
+                return tail - channel.m_head.load(std::memory_order_acquire) < channel.capacity();
+            });
+        }
+
+        void await_resume()
+        {
+            if (!m_sent)
+            {
+                // There is room now, and nobody else to take it.
+                m_channel.try_send(std::move(m_value));
+            }
+        }
+
+       private:
+        spsc_channel& m_channel;
+        T m_value;
+        bool m_sent = false;
+    };
+
+    class receive_operation
+    {
+       public:
+        explicit receive_operation(spsc_channel& channel) noexcept : m_channel(channel) {}
+
+        bool await_ready() noexcept { return m_channel.has_item(); }
+
+        bool await_suspend(std::coroutine_handle<> awaiter) noexcept
+        {
+            const std::uint64_t head = m_channel.m_head.load(std::memory_order_relaxed);
+            return m_channel.m_receiver.suspend(awaiter, head, [&channel = m_channel, head] {
+                return channel.m_tail.load(std::memory_order_acquire) != head;
+            });
+        }
+
+        T await_resume() { return std::move(*m_channel.try_receive()); }
+
+       private:
+        spsc_channel& m_channel;
+    };
+
+    /// Send \p value, waiting for room if the channel is full.
+    [[nodiscard]] send_operation send(T value) { return send_operation{*this, std::move(value)}; }
+
+    /// Take the next item, waiting for one to be sent if the channel is empty.
+    /// The result of 'co_await' is the item.
+    [[nodiscard]] receive_operation receive() noexcept { return receive_operation{*this}; }
+
+   private:
+    template <typename U>
+    bool try_push(U&& value)
+    {
+        const std::uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead > m_mask)
+        {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead > m_mask)
+            {
+                return false;
+            }
+        }
+
+        m_slots[tail & m_mask].construct(std::forward<U>(value));
+        m_tail.store(tail + 1, std::memory_order_release);
+        m_receiver.notify(tail);
+        return true;
+    }
+
+    /// Whether there is an item for the receiver to take.
+    bool has_item() noexcept
+    {
+        const std::uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head != m_cachedTail)
+        {
+            return true;
+        }
+        m_cachedTail = m_tail.load(std::memory_order_acquire);
+        return head != m_cachedTail;
+    }
+
+    const std::size_t m_mask;
+    const std::unique_ptr<detail::channel_storage<T>[]> m_slots;
+
+    // Written by the receiver. The index of the next item to receive, and
+    // the tail as the receiver last saw it.
+    alignas(64) std::atomic<std::uint64_t> m_head;
+    std::uint64_t m_cachedTail;
+
+    // Written by the sender. The index of the next item to send, and the
+    // head as the sender last saw it.
+    alignas(64) std::atomic<std::uint64_t> m_tail;
+    std::uint64_t m_cachedHead;
+
+    alignas(64) detail::channel_waiter m_receiver;
+    alignas(64) detail::channel_waiter m_sender;
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+template <typename T>
+using spsc_channel = cppcoro::spsc_channel<T>;
+}
+
+#endif
@@ -5,19 +5,75 @@
 #ifndef CPPCORO_STATIC_THREAD_POOL_HPP_INCLUDED
 #define CPPCORO_STATIC_THREAD_POOL_HPP_INCLUDED
 
+#include <tasks/cancellation.h>
+#include <tasks/latency_histogram.h>
+#include <tasks/task_category.h>
+
 #include <atomic>
+#include <chrono>
 #include <coroutine>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <memory>
-#include <mutex>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace cppcoro
 {
+class event_count;
+class spin_mutex;
+class timer_wheel;
+
+template <typename T>
+class mpmc_queue;
+
+namespace detail
+{
+class pool_join;
+}
+
 class static_thread_pool
 {
    public:
+    /// How long a worker that has run out of work keeps polling for more
+    /// before it goes to sleep. Spinning longer wastes CPU when work arrives
+    /// rarely, spinning shorter makes work that arrives shortly after pay for
+    /// waking a sleeping worker up.
+    struct spin_policy
+    {
+        /// Polls for new work before going to sleep. With adaptive, the
+        /// number each worker starts out with.
+        std::uint32_t spinCount = 30;
+
+        /// Of those polls, the number that busy-wait with a CPU pause in
+        /// between. The rest yield the thread to the OS in between.
+        std::uint32_t yieldThreshold = 10;
+
+        /// Have each worker tune its own spin count, between minSpinCount
+        /// and maxSpinCount. It measures how long it takes a sleeping worker
+        /// to get to new work after being woken up, and spins for about as
+        /// long only if work tends to arrive within that time. Sessions with
+        /// long idle gaps, like an interactive app waiting for input, end up
+        /// barely spinning. A steady stream of short gaps, like a batch run,
+        /// ends up spinning long enough to never sleep.
+        bool adaptive = false;
+        std::uint32_t minSpinCount = 1;
+        std::uint32_t maxSpinCount = 2000;
+    };
+
+    struct options
+    {
+        /// Pin each worker thread to its own CPU and have workers try to
+        /// steal from the workers closest to them first: the same core,
+        /// then the same last-level cache, then the same NUMA node, then
+        /// everything else. Only supported on Linux, ignored elsewhere.
+        bool topologyAware = false;
+
+        spin_policy spin;
+    };
+
     /// Initialise to a number of threads equal to the number of cores
     /// on the current machine.
     static_thread_pool();
@@ -28,12 +84,37 @@ class static_thread_pool
     /// The number of threads in the pool that will be used to execute work.
     explicit static_thread_pool(std::uint32_t threadCount);
 
+    /// Construct a thread pool with the specified number of threads and options.
+    static_thread_pool(std::uint32_t threadCount, const options& opts);
+
     ~static_thread_pool();
 
+    /// Scheduled work is dequeued in order of priority, first-in first-out
+    /// within the same priority. To stop a steady stream of more urgent work
+    /// from starving less urgent work, each worker regularly gives the lower
+    /// priorities a turn to go first.
+    enum class priority : std::uint8_t
+    {
+        high,
+        normal,
+        low
+    };
+
+    static constexpr std::size_t priority_count = 3;
+
+    using clock = std::chrono::steady_clock;
+
+    class schedule_batch;
+    class timed_schedule_operation;
+
     class schedule_operation
     {
        public:
-        schedule_operation(static_thread_pool* tp) noexcept : m_threadPool(tp) {}
+        schedule_operation(static_thread_pool* tp, priority p = priority::normal,
+                           const task_category* category = nullptr) noexcept
+            : m_threadPool(tp), m_priority(p), m_category(category)
+        {
+        }
 
         bool await_ready() noexcept { return false; }
         void await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept;
@@ -41,49 +122,351 @@ class static_thread_pool
 
        private:
         friend class static_thread_pool;
+        friend class schedule_batch;
+        friend class timed_schedule_operation;
 
         static_thread_pool* m_threadPool;
+        priority m_priority;
+        const task_category* m_category;
         std::coroutine_handle<> m_awaitingCoroutine;
         schedule_operation* m_next = nullptr;
+
+        // Only set if there is a category to record the time spent queued for.
+        clock::time_point m_enqueuedAt;
+    };
+
+    /// Resumes the awaiting coroutine on the pool once its deadline has passed.
+    class timed_schedule_operation : public schedule_operation
+    {
+       public:
+        timed_schedule_operation(static_thread_pool* tp, clock::time_point deadline, priority p) noexcept
+            : schedule_operation(tp, p), m_deadline(deadline)
+        {
+        }
+
+        void await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept;
+
+       private:
+        friend class static_thread_pool;
+        friend class timer_wheel;
+
+        clock::time_point m_deadline;
+        timed_schedule_operation* m_timerNext = nullptr;
+    };
+
+    /// Like schedule_operation, but checks a cancellation token both before
+    /// suspending and once resumed on the pool. co_await yields false if
+    /// cancellation was requested by either point, in which case the caller
+    /// should drop the work. A token that has been cancelled already doesn't
+    /// suspend at all, the awaiting coroutine continues on the calling thread.
+    class cancellable_schedule_operation : public schedule_operation
+    {
+       public:
+        cancellable_schedule_operation(static_thread_pool* tp, cancellation_token token, priority p,
+                                       const task_category* category = nullptr) noexcept
+            : schedule_operation(tp, p, category), m_token(std::move(token))
+        {
+        }
+
+        bool await_ready() const noexcept { return m_token.is_cancellation_requested(); }
+
+        [[nodiscard]] bool await_resume() const noexcept { return !m_token.is_cancellation_requested(); }
+
+       private:
+        cancellation_token m_token;
+    };
+
+    /// Collects coroutines that want to be scheduled so that they can be
+    /// handed to the pool in one go, waking as many sleeping threads as
+    /// needed at once rather than one schedule() and wake-up at a time.
+    ///
+    /// Coroutines join the batch by awaiting schedule() on it, and run once
+    /// submit() is called or the batch is destroyed. A batch must only be
+    /// used from one thread at a time.
+    class schedule_batch
+    {
+       public:
+        explicit schedule_batch(static_thread_pool& tp) noexcept;
+
+        schedule_batch(const schedule_batch&) = delete;
+        schedule_batch& operator=(const schedule_batch&) = delete;
+
+        /// Submits any operations that haven't been submitted yet.
+        ~schedule_batch();
+
+        class schedule_operation : public static_thread_pool::schedule_operation
+        {
+           public:
+            schedule_operation(schedule_batch* batch, priority p) noexcept
+                : static_thread_pool::schedule_operation(batch->m_threadPool, p), m_batch(batch)
+            {
+            }
+
+            void await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept;
+
+           private:
+            schedule_batch* m_batch;
+        };
+
+        [[nodiscard]] schedule_operation schedule(priority p = priority::normal) noexcept
+        {
+            return schedule_operation{this, p};
+        }
+
+        /// Number of operations waiting for submit().
+        std::size_t size() const noexcept { return m_size; }
+
+        /// Hand all the operations collected so far to the thread pool.
+        void submit() noexcept;
+
+       private:
+        void add(static_thread_pool::schedule_operation* operation,
+                 std::coroutine_handle<> awaitingCoroutine) noexcept;
+
+        static_thread_pool* m_threadPool;
+
+        // One list per priority, linked through schedule_operation::m_next.
+        static_thread_pool::schedule_operation* m_heads[priority_count];
+        static_thread_pool::schedule_operation* m_tails[priority_count];
+        std::size_t m_counts[priority_count];
+        std::size_t m_size;
+    };
+
+    /// Counters for a single worker thread since the pool was created.
+    struct thread_stats
+    {
+        /// Operations resumed. The sum of the three counters below.
+        std::uint64_t tasksExecuted = 0;
+        std::uint64_t localPops = 0;
+        std::uint64_t globalDequeues = 0;
+        std::uint64_t steals = 0;
+
+        /// Passes over the other threads, for a single priority, that found nothing to steal.
+        std::uint64_t failedSteals = 0;
+
+        /// Iterations spent spinning while waiting for new work.
+        std::uint64_t spinIterations = 0;
+        std::uint64_t sleeps = 0;
+        std::uint64_t wakeUps = 0;
+
+        /// Most operations ever queued on this thread at a single priority,
+        /// including any in its overflow queue.
+        std::uint64_t localQueueHighWater = 0;
+
+        /// The polls for new work before going to sleep, currently. Only
+        /// changes with spin_policy::adaptive.
+        std::uint64_t spinCount = 0;
+
+        /// How long it takes, on average, from waking this thread up for new
+        /// work to it running that work. Only measured with spin_policy::adaptive.
+        std::chrono::nanoseconds wakeLatency{0};
+
+        thread_stats& operator+=(const thread_stats& other) noexcept;
+    };
+
+    struct stats_snapshot
+    {
+        /// The counters summed over all threads. The high-water mark, spin
+        /// count and wake latency are the highest of any thread.
+        thread_stats total;
+
+        /// The counters of each worker thread.
+        std::vector<thread_stats> threads;
+    };
+
+    /// Read the counters of every worker thread.
+    ///
+    /// May be called from any thread. Each counter is read atomically, but
+    /// the workers keep running so the snapshot as a whole is not.
+    stats_snapshot stats() const;
+
+    /// Where the time went for the work of one task_category.
+    struct category_snapshot
+    {
+        const task_category* category = nullptr;
+
+        /// From schedule() to the coroutine being resumed by a worker.
+        latency_histogram queueWait;
+
+        /// From the coroutine being resumed until it next suspends or
+        /// completes, and control returns to the worker.
+        latency_histogram runTime;
     };
 
+    /// Read the histograms of every category that work was scheduled with.
+    ///
+    /// May be called from any thread. Like stats(), the workers keep
+    /// recording while the histograms are copied.
+    std::vector<category_snapshot> category_stats() const;
+
+    /// Write category_stats() to \p out as text: a summary line per category,
+    /// then the non-empty buckets of each of its histograms.
+    void write_category_stats(std::FILE* out) const;
+
+    /// Record one run of work of \p category that was queued for \p queueWait
+    /// and ran for \p runTime. The pool records the work scheduled on it by
+    /// itself, this is for executors that run their work on top of the pool,
+    /// like strand. May be called from any thread.
+    void record_category(const task_category& category, clock::duration queueWait,
+                         clock::duration runTime) noexcept;
+
     std::uint32_t thread_count() const noexcept { return m_threadCount; }
 
-    [[nodiscard]] schedule_operation schedule() noexcept { return schedule_operation{this}; }
+    /// The pool the calling thread is a worker of, nullptr if it isn't one.
+    static static_thread_pool* current() noexcept;
+
+    /// Whether the calling thread is one of this pool's threads with no work of
+    /// priority \p p queued locally.
+    ///
+    /// Work queued locally is taken by other threads only when they have run
+    /// out of their own, so an empty queue means that anything queued there
+    /// earlier has been stolen. parallel_for() uses this to hand out more of
+    /// its range only when there are threads asking for it.
+    ///
+    /// \return
+    /// false when called from any other thread.
+    bool is_local_queue_empty(priority p = priority::normal) const noexcept;
+
+    [[nodiscard]] schedule_operation schedule(priority p = priority::normal) noexcept
+    {
+        return schedule_operation{this, p};
+    }
+
+    /// Like schedule(), and records how long the work waits in the queues and
+    /// how long it runs for under \p category. See category_stats().
+    [[nodiscard]] schedule_operation schedule(const task_category& category, priority p = priority::normal) noexcept
+    {
+        return schedule_operation{this, p, &category};
+    }
+
+    /// Resume the awaiting coroutine on the pool, unless \p token is cancelled
+    /// first. See cancellable_schedule_operation.
+    ///
+    /// Work queued on the pool can't be taken off it again, so a cancelled
+    /// operation still takes its turn on a worker, if it was queued before the
+    /// cancellation. But that turn is only as long as it takes to see the flag.
+    [[nodiscard]] cancellable_schedule_operation schedule(cancellation_token token,
+                                                          priority p = priority::normal) noexcept
+    {
+        return cancellable_schedule_operation{this, std::move(token), p};
+    }
+
+    /// Like schedule(cancellation_token, priority), recorded under \p category.
+    [[nodiscard]] cancellable_schedule_operation schedule(cancellation_token token, const task_category& category,
+                                                          priority p = priority::normal) noexcept
+    {
+        return cancellable_schedule_operation{this, std::move(token), p, &category};
+    }
+
+    /// Resume the awaiting coroutine on the pool once \p deadline has passed,
+    /// or as soon as possible if it has passed already.
+    ///
+    /// The timers are kept in a timer wheel with a resolution of a
+    /// millisecond and are serviced by the worker threads themselves: busy
+    /// workers check for expired timers every so often and, when all of them
+    /// are idle, one of them sleeps only until the next deadline. So a timer
+    /// may fire late by up to a millisecond, or by however long the worker
+    /// threads are all kept busy by a single operation.
+    ///
+    /// Timers can't be cancelled. Like any other scheduled work they must
+    /// all have fired before the pool is destroyed.
+    [[nodiscard]] timed_schedule_operation schedule_at(clock::time_point deadline,
+                                                       priority p = priority::normal) noexcept
+    {
+        return timed_schedule_operation{this, deadline, p};
+    }
+
+    /// Resume the awaiting coroutine on the pool once \p delay has passed.
+    /// See schedule_at().
+    template <typename Rep, typename Period>
+    [[nodiscard]] timed_schedule_operation schedule_after(std::chrono::duration<Rep, Period> delay,
+                                                          priority p = priority::normal) noexcept
+    {
+        return schedule_at(clock::now() + std::chrono::ceil<clock::duration>(delay), p);
+    }
 
    private:
     friend class schedule_operation;
+    friend class schedule_batch;
+    friend class timed_schedule_operation;
+    friend class detail::pool_join;
 
     void run_worker_thread(std::uint32_t threadIndex) noexcept;
 
+    /// The next operation for worker \p threadIndex to run, or nullptr if
+    /// none of the queues it looks at have any.
+    schedule_operation* try_get_work(std::uint32_t threadIndex) noexcept;
+
+    /// Resume the coroutine of \p operation on the calling worker, timing it
+    /// if it has a category.
+    void resume(schedule_operation* operation) noexcept;
+
+    /// Run queued work on the calling worker thread until \p join completes,
+    /// sleeping on the join when there is none. See detail::pool_join.
+    void help_until(detail::pool_join& join) noexcept;
+
+    void place_worker_threads(const options& opts);
+
     void shutdown();
 
     void schedule_impl(schedule_operation* operation) noexcept;
 
     void remote_enqueue(schedule_operation* operation) noexcept;
 
+    /// Enqueue \p count operations of the same priority linked through m_next.
+    void enqueue_bulk(schedule_operation* head, std::size_t count) noexcept;
+
+    /// As enqueue_bulk(), but always on the global queue, which runs them in order.
+    void remote_enqueue_bulk(schedule_operation* head, std::size_t count) noexcept;
+
     bool has_any_queued_work_for(std::uint32_t threadIndex) noexcept;
 
     bool approx_has_any_queued_work_for(std::uint32_t threadIndex) const noexcept;
 
     bool is_shutdown_requested() const noexcept;
 
-    void notify_intent_to_sleep(std::uint32_t threadIndex) noexcept;
-    void try_clear_intent_to_sleep(std::uint32_t threadIndex) noexcept;
-
-    schedule_operation* try_global_dequeue() noexcept;
+    schedule_operation* try_global_dequeue(std::size_t lane) noexcept;
 
-    /// Try to steal a task from another thread.
+    /// Try to steal a task of the given priority from another thread. Along
+    /// with it, up to half of the victim's queue is moved to this thread's
+    /// local queue.
     ///
     /// \return
     /// A pointer to the operation that was stolen if one could be stolen
     /// from another thread. Otherwise returns nullptr if none of the other
     /// threads had any tasks that could be stolen.
-    schedule_operation* try_steal_from_other_thread(std::uint32_t thisThreadIndex) noexcept;
+    schedule_operation* try_steal_from_other_thread(std::uint32_t thisThreadIndex, std::size_t lane) noexcept;
 
     void wake_one_thread() noexcept;
 
+    void wake_threads(std::size_t count) noexcept;
+
+    /// Wake a worker asleep joining a task if there is no idle one to wake.
+    void wake_join_if_no_idle_thread() noexcept;
+
+    /// Record when a sleeping worker is woken up, see m_lastWakeRequest.
+    void note_wake_request() noexcept;
+
+    void add_timer(timed_schedule_operation* operation) noexcept;
+
+    /// Move the operations of every timer that has expired onto the queues.
+    ///
+    /// \return
+    /// true if any were moved.
+    bool poll_timers() noexcept;
+
+    /// Called by a worker thread that is about to sleep, after prepare_wait().
+    ///
+    /// \return
+    /// The deadline of the next timer if the calling thread has become the
+    /// one responsible for waking up for it, clock::time_point::max() if
+    /// some other thread is or there are no timers, or clock::time_point::min()
+    /// if the timers changed in the meantime and the caller shouldn't sleep.
+    clock::time_point try_become_timer_keeper() noexcept;
+
     class thread_state;
+    class category_histograms;
+    class sleeping_joins;
 
     static thread_local thread_state* s_currentState;
     static thread_local static_thread_pool* s_currentThreadPool;
@@ -91,18 +474,40 @@ class static_thread_pool
     const std::uint32_t m_threadCount;
     const std::unique_ptr<thread_state[]> m_threadStates;
 
+    const spin_policy m_spinPolicy;
+
     std::vector<std::thread> m_threads;
 
     std::atomic<bool> m_stopRequested;
 
-    std::mutex m_globalQueueMutex;
-    std::atomic<schedule_operation*> m_globalQueueHead;
+    // One global queue per priority.
+    const std::unique_ptr<mpmc_queue<schedule_operation*>[]> m_globalQueues;
+
+    // Worker threads that have run out of work register here before going to sleep.
+    const std::unique_ptr<event_count> m_sleepingThreads;
+
+    // Workers that join a task sleep apart from the idle workers, see help_until().
+    const std::unique_ptr<sleeping_joins> m_sleepingJoins;
+
+    const std::unique_ptr<spin_mutex> m_timerMutex;
+    const std::unique_ptr<timer_wheel> m_timers;
+
+    // The time since the epoch of the clock, in clock ticks, at which the
+    // timer wheel next needs servicing, or the maximum if it is empty. Only
+    // written with m_timerMutex held, but read by workers without it.
+    std::atomic<clock::rep> m_nextTimerDeadline;
+
+    // The deadline the thread sleeping on behalf of the timers will wake up
+    // at, or the maximum if no thread is.
+    std::atomic<clock::rep> m_timerKeeperDeadline;
 
-    // alignas(std::hardware_destructive_interference_size)
-    std::atomic<schedule_operation*> m_globalQueueTail;
+    // When, in clock ticks since the epoch, a sleeping worker was last woken
+    // up for new work. Only kept with spin_policy::adaptive, so that the
+    // worker can measure how long it took to get to the work.
+    std::atomic<clock::rep> m_lastWakeRequest;
 
-    // alignas(std::hardware_destructive_interference_size)
-    std::atomic<std::uint32_t> m_sleepingThreadCount;
+    // Indexed by task_category::id().
+    const std::unique_ptr<category_histograms[]> m_categoryHistograms;
 };
 }  // namespace cppcoro
 
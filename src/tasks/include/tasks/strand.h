@@ -0,0 +1,151 @@
+#ifndef CPPCORO_STRAND_HPP_INCLUDED
+#define CPPCORO_STRAND_HPP_INCLUDED
+
+#include <tasks/static_thread_pool.h>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+
+namespace cppcoro
+{
+/// Runs coroutines one at a time, on whichever thread of a static_thread_pool
+/// is free, instead of on a thread of its own.
+///
+/// A coroutine enters the strand with 'co_await strand.schedule()' and holds
+/// it until it next suspends or completes. Coroutines waiting to enter are
+/// resumed in order of priority, first-in first-out within the same
+/// priority.
+///
+/// Entering a strand nobody holds takes a single atomic operation and runs
+/// the coroutine inline on the calling thread, without a hop to the pool.
+/// Coroutines that had to wait are run by the pool. The strand yields its
+/// pool thread regularly so that a busy strand doesn't hog it.
+class strand
+{
+    class runner;
+
+   public:
+    using priority = static_thread_pool::priority;
+
+    explicit strand(static_thread_pool& threadPool);
+
+    /// Waits for the thread that last held the strand to let go of it.
+    /// Behaviour is undefined if there are coroutines still waiting.
+    ~strand();
+
+    strand(const strand&) = delete;
+    strand& operator=(const strand&) = delete;
+
+    class schedule_operation
+    {
+       public:
+        schedule_operation(strand& s, priority p, const task_category* category = nullptr) noexcept
+            : m_strand(s), m_priority(p), m_category(category)
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept;
+        void await_resume() const noexcept {}
+
+       private:
+        friend class strand;
+
+        strand& m_strand;
+        priority m_priority;
+        const task_category* m_category;
+        std::coroutine_handle<> m_awaitingCoroutine;
+        schedule_operation* m_next = nullptr;
+
+        // Only set if there is a category to record the time spent queued for.
+        static_thread_pool::clock::time_point m_enqueuedAt;
+    };
+
+    /// Resume the awaiting coroutine once it holds the strand: inline if the
+    /// strand is free, otherwise on the pool after those ahead of it.
+    [[nodiscard]] schedule_operation schedule(priority p = priority::normal) noexcept
+    {
+        return schedule_operation{*this, p};
+    }
+
+    /// Like schedule(), and records how long the coroutine waits for the
+    /// strand and how long it holds it for under \p category, in the thread
+    /// pool's category_stats().
+    [[nodiscard]] schedule_operation schedule(const task_category& category, priority p = priority::normal) noexcept
+    {
+        return schedule_operation{*this, p, &category};
+    }
+
+    /// Whether the calling thread is running a coroutine that holds this strand.
+    bool running_in_this_thread() const noexcept;
+
+    /// The strand held by the coroutine the calling thread is running, if any.
+    static strand* current() noexcept;
+
+    /// Counts the times the strand has resumed a coroutine that holds it.
+    /// Only meaningful while running_in_this_thread(). A coroutine resumed
+    /// inline by the holder, from a release of some kind, runs in the
+    /// holder's turn, not a turn of its own.
+    std::uint64_t turn() const noexcept { return m_turn; }
+
+    static_thread_pool& thread_pool() noexcept { return m_threadPool; }
+
+   private:
+    static constexpr std::uintptr_t idle = 1;
+
+    // assume == reinterpret_cast<std::uintptr_t>(static_cast<void*>(nullptr))
+    static constexpr std::uintptr_t running_no_waiters = 0;
+
+    runner run_loop();
+
+    /// Run the queued coroutines until there are none left, or until this
+    /// thread has run enough of them and should hand the rest to the pool.
+    void run_queued() noexcept;
+
+    /// Give up the strand after running a coroutine inline, or hand it to
+    /// the pool if others queued up in the meantime.
+    void release() noexcept;
+
+    /// Move the operations queued in m_state since the last call on to the
+    /// lanes, in the order they arrived.
+    void take_queued(std::uintptr_t state) noexcept;
+
+    /// The most urgent lane with operations waiting, or priority_count if they are empty.
+    std::size_t next_lane() const noexcept;
+
+    /// Pop the next operation to run from the lanes, or nullptr if they are empty.
+    schedule_operation* pop_next() noexcept;
+
+    /// Resume the runner on the pool, at the priority of the next operation in line.
+    void post_runner() noexcept;
+
+    /// Resume the coroutine of \p operation, timing it if it has a category.
+    void resume(schedule_operation* operation) noexcept;
+
+    static_thread_pool& m_threadPool;
+
+    // Either idle, running_no_waiters or a pointer to the most recently
+    // queued schedule_operation, linked to the earlier ones through m_next.
+    std::atomic<std::uintptr_t> m_state;
+
+    // Only touched by the thread holding the strand. The waiting operations
+    // by priority, linked through m_next in the order they arrived.
+    schedule_operation* m_heads[static_thread_pool::priority_count];
+    schedule_operation* m_tails[static_thread_pool::priority_count];
+    std::uint64_t m_turn;
+
+    // A coroutine that runs run_queued() each time it is resumed, and the
+    // operation that resumes it on the pool.
+    std::coroutine_handle<> m_runner;
+    static_thread_pool::schedule_operation m_runnerOperation;
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+using strand = cppcoro::strand;
+}
+
+#endif
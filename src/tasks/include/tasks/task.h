@@ -1,14 +1,40 @@
 ﻿#pragma once
+#include <tasks/detail/completion_listener.hpp>
+#include <tasks/detail/frame_allocator.hpp>
+#include <tasks/detail/pool_join.hpp>
+#include <tasks/trace.h>
+
+#include <atomic>
 #include <coroutine>
+#include <cstdint>
 #include <iostream>
-#include <semaphore>
 #include <thread>
 
 namespace cb
 {
 namespace detail
 {
-template <typename P, bool Joinable>
+enum class task_state : std::uint32_t
+{
+    // The coroutine is running and nothing is waiting for it yet.
+    running,
+
+    // A coroutine has co_awaited the task and is stored in the continuation slot,
+    // or a listener was registered for when_all() or when_any().
+    has_continuation,
+
+    // A thread is blocked in join(), waiting for the state to change.
+    joining,
+
+    // The coroutine has reached its final suspend point and its result is ready.
+    completed,
+
+    // The task was destroyed while the coroutine was still running. Nobody is left to
+    // destroy the coroutine frame, so the coroutine does that itself once it completes.
+    detached
+};
+
+template <typename P>
 struct final_awaitable
 {
     bool await_ready() const noexcept { return false; }
@@ -17,47 +43,46 @@ struct final_awaitable
 
     std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) const noexcept
     {
-        if (h.promise().hasContinuation.exchange(true, std::memory_order_acquire))
+        // 'release' so that whoever is waiting sees the result, 'acquire' so
+        // that we see the continuation written by an awaiting coroutine.
+        auto& promise = h.promise();
+        switch (promise.state.exchange(task_state::completed, std::memory_order_acq_rel))
         {
-            return h.promise().continuation;
+            case task_state::has_continuation:
+                return promise.listener != nullptr ? promise.listener->on_complete() : promise.continuation;
+            case task_state::joining:
+                // The joining thread may return and destroy the task as soon as it sees the
+                // new state, so this may be a notify on an address that is no longer in use.
+                // That can at worst wake some other waiter spuriously.
+                promise.state.notify_one();
+                break;
+            case task_state::detached:
+                h.destroy();
+                break;
+            default:
+                break;
         }
         return std::noop_coroutine();
     }
 };
 
-template <typename P>
-struct final_awaitable<P, true>
-{
-    bool await_ready() const noexcept { return false; }
-
-    void await_resume() const noexcept {}
-
-    void await_suspend(std::coroutine_handle<P> h) const noexcept { h.promise().sem.release(); }
-};
-
-template <bool Joinable>
-struct promise_base
+struct promise_base : cppcoro::detail::pooled_frame
 {
     std::suspend_never initial_suspend() { return {}; }
 
     void unhandled_exception() {}
 
     std::coroutine_handle<> continuation;
-    std::atomic<bool> hasContinuation = false;
-};
-
-template <>
-struct promise_base<true> : public promise_base<false>
-{
-    std::binary_semaphore sem{0};
+    cppcoro::detail::completion_listener* listener = nullptr;
+    std::atomic<task_state> state = task_state::running;
 };
 
-template <typename Task, typename T, bool Joinable>
-struct promise : promise_base<Joinable>
+template <typename Task, typename T>
+struct promise : promise_base
 {
     Task get_return_object() { return std::coroutine_handle<promise>::from_promise(*this); }
 
-    final_awaitable<promise, Joinable> final_suspend() noexcept { return {}; }
+    final_awaitable<promise> final_suspend() noexcept { return {}; }
 
     void return_value(T const& value) noexcept(std::is_nothrow_copy_assignable_v<T>) { data = value; }
 
@@ -71,22 +96,22 @@ struct promise : promise_base<Joinable>
     T data;
 };
 
-template <typename Task, bool Joinable>
-struct promise<Task, void, Joinable> : promise_base<Joinable>
+template <typename Task>
+struct promise<Task, void> : promise_base
 {
     Task get_return_object() { return std::coroutine_handle<promise>::from_promise(*this); }
 
-    final_awaitable<promise, Joinable> final_suspend() noexcept { return {}; }
+    final_awaitable<promise> final_suspend() noexcept { return {}; }
 
     void return_void() {}
 };
 
-template <typename Task, typename T, bool Joinable>
-struct promise<Task, T&, Joinable> : promise_base<Joinable>
+template <typename Task, typename T>
+struct promise<Task, T&> : promise_base
 {
     Task get_return_object() { return std::coroutine_handle<promise>::from_promise(*this); }
 
-    final_awaitable<promise, Joinable> final_suspend() noexcept { return {}; }
+    final_awaitable<promise> final_suspend() noexcept { return {}; }
 
     void return_value(T& value) noexcept(std::is_nothrow_move_assignable_v<T>) { data = std::addressof(value); }
 
@@ -98,11 +123,14 @@ struct promise<Task, T&, Joinable> : promise_base<Joinable>
 
 }  // namespace detail
 
-template <typename T = void, bool Joinable = false>
+// Promise is the promise type to use, instantiated as Promise<task, T>. Anything other than
+// detail::promise must derive from it, see affine_task.
+template <typename T = void, template <typename, typename> class Promise = detail::promise>
 class [[nodiscard]] task
 {
    public:
-    using promise_type = detail::promise<task, T, Joinable>;
+    using promise_type = Promise<task, T>;
+    using value_type = T;
 
     task() noexcept = default;
     task(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine_{coroutine} {}
@@ -117,34 +145,35 @@ class [[nodiscard]] task
     {
         if (this != &other)
         {
-            if (coroutine_)
-            {
-                coroutine_.destroy();
-            }
+            release();
             coroutine_ = other.coroutine_;
             other.coroutine_ = nullptr;
         }
         return *this;
     }
 
-    [[nodiscard]] bool await_ready() const noexcept { return !coroutine_ || coroutine_.done(); }
+    // Frees the coroutine frame, or leaves that to the coroutine if it is still running.
+    // It must not be awaited or joined at the time.
+    ~task() { release(); }
+
+    // coroutine_.done() can't be used here, the coroutine may still be running on another thread.
+    [[nodiscard]] bool await_ready() const noexcept
+    {
+        return !coroutine_ ||
+               coroutine_.promise().state.load(std::memory_order_acquire) == detail::task_state::completed;
+    }
 
     std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) const noexcept
     {
-        if constexpr (Joinable)
-        {
-            // This should never happen because joinable tasks are not continuable. Use .join() instead.
-            __debugbreak();
-            std::terminate();
-        }
-        else
+        auto& basePromise = coroutine_.promise();
+        basePromise.continuation = continuation;
+        basePromise.listener = nullptr;
+        auto expected = detail::task_state::running;
+        if (!basePromise.state.compare_exchange_strong(expected, detail::task_state::has_continuation,
+                                                       std::memory_order_release, std::memory_order_acquire))
         {
-            auto& basePromise = coroutine_.promise();
-            basePromise.continuation = continuation;
-            if (basePromise.hasContinuation.exchange(true, std::memory_order_release))
-            {
-                return continuation;
-            }
+            // Completed in the meantime, resume the continuation right away.
+            return continuation;
         }
         return std::noop_coroutine();
     }
@@ -161,28 +190,96 @@ class [[nodiscard]] task
         }
     }
 
-    // If the Task is Joinable waits for the semaphore to be set
-    // Otherwise starts a new Joinable coroutine and sets it as the continuation of this coroutine
-    // Once the newly created Joinable coroutine is resumed its semaphore will be set. The calling thread will
-    // wait for that semaphore.
-    decltype(auto) join() const noexcept
+    // Blocks the calling thread until the coroutine has completed and returns its result.
+    // The promise's state doubles as the word to wait on so this allocates nothing and
+    // resumes no other coroutine, the thread that completes the coroutine wakes us directly.
+    //
+    // Called from a worker of a static_thread_pool it instead keeps running the pool's queued
+    // work until the coroutine completes, so the worker isn't lost to the pool in the meantime.
+    // That work runs nested inside this call. Unless the caller holds a strand, then it blocks.
+    T join() const noexcept
     {
-        if constexpr (Joinable)
+        if (coroutine_ && cppcoro::detail::pool_join::can_help())
         {
-            coroutine_.promise().sem.acquire();
-            return await_resume();
+            cppcoro::detail::pool_join poolJoin;
+            if (try_notify_on_completion(poolJoin))
+            {
+                CORO_TRACE_SCOPE("join");
+                poolJoin.help_until_complete();
+            }
         }
-        else
+        else if (coroutine_)
+        {
+            auto& basePromise = coroutine_.promise();
+            auto expected = detail::task_state::running;
+            if (basePromise.state.compare_exchange_strong(expected, detail::task_state::joining,
+                                                          std::memory_order_acquire, std::memory_order_acquire))
+            {
+                CORO_TRACE_SCOPE("join");
+                basePromise.state.wait(detail::task_state::joining, std::memory_order_acquire);
+            }
+        }
+        return await_resume();
+    }
+
+    // Used by when_all() and when_any() in place of co_await. Has the listener notified when
+    // the coroutine completes. Returns false, without notifying, if it has already completed.
+    bool try_notify_on_completion(cppcoro::detail::completion_listener& listener) const noexcept
+    {
+        if (!coroutine_)
+        {
+            return false;
+        }
+
+        auto& basePromise = coroutine_.promise();
+        basePromise.listener = &listener;
+        auto expected = detail::task_state::running;
+        return basePromise.state.compare_exchange_strong(expected, detail::task_state::has_continuation,
+                                                         std::memory_order_release, std::memory_order_acquire);
+    }
+
+    // Used by when_any() to stop listening to the tasks that did not complete first, so that they
+    // can be awaited again. Returns false if the listener is notified anyway because the coroutine
+    // has completed in the meantime, or if it was never registered.
+    bool try_cancel_notify(cppcoro::detail::completion_listener& listener) const noexcept
+    {
+        if (!coroutine_ || coroutine_.promise().listener != &listener)
+        {
+            return false;
+        }
+
+        auto& basePromise = coroutine_.promise();
+        auto expected = detail::task_state::has_continuation;
+        if (!basePromise.state.compare_exchange_strong(expected, detail::task_state::running,
+                                                       std::memory_order_relaxed))
         {
-            // Not joinable, create a new joinable task that co_awaits this coroutine
-            // The newly created coroutine will be joinable via the semaphore
-            auto joinableTask = [this]() -> task<T, true> { co_return co_await *this; }();
-            return joinableTask.join();
+            return false;
         }
+        basePromise.listener = nullptr;
+        return true;
     }
 
    protected:
+    void release() noexcept
+    {
+        if (!coroutine_)
+        {
+            return;
+        }
+
+        // 'acquire' so that we don't free the frame before the coroutine is done with it.
+        auto expected = detail::task_state::running;
+        if (coroutine_.promise().state.compare_exchange_strong(expected, detail::task_state::detached,
+                                                              std::memory_order_acquire, std::memory_order_acquire))
+        {
+            return;
+        }
+        // Otherwise it has completed, no one may be awaiting or joining a task while it is destroyed.
+        coroutine_.destroy();
+        coroutine_ = nullptr;
+    }
+
     std::coroutine_handle<promise_type> coroutine_ = nullptr;
 };
 
-}  // namespace cb
\ No newline at end of file
+}  // namespace cb
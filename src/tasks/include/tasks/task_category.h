@@ -0,0 +1,50 @@
+#ifndef CPPCORO_TASK_CATEGORY_HPP_INCLUDED
+#define CPPCORO_TASK_CATEGORY_HPP_INCLUDED
+
+#include <cstdint>
+
+namespace cppcoro
+{
+/// Names a kind of work, like "image-decode", so that a static_thread_pool
+/// can tell how long that work waits in its queues and how long it runs for,
+/// apart from everything else. Pass it to static_thread_pool::schedule() or
+/// strand::schedule(), see static_thread_pool::category_stats().
+///
+/// Categories are meant to be declared once, at namespace scope, and live
+/// for the rest of the program. Each gets an id of its own on construction.
+/// Only the first max_count categories are recorded, the ones after that
+/// are accepted but ignored.
+class task_category
+{
+   public:
+    static constexpr std::uint32_t max_count = 32;
+
+    /// The id of a category that isn't recorded.
+    static constexpr std::uint32_t no_id = max_count;
+
+    /// \param name
+    /// Must outlive the category, typically a string literal.
+    explicit task_category(const char* name) noexcept;
+
+    task_category(const task_category&) = delete;
+    task_category& operator=(const task_category&) = delete;
+
+    const char* name() const noexcept { return m_name; }
+
+    std::uint32_t id() const noexcept { return m_id; }
+
+    /// The category with \p id, or nullptr if there isn't one (yet).
+    static const task_category* find(std::uint32_t id) noexcept;
+
+   private:
+    const char* m_name;
+    std::uint32_t m_id;
+};
+}  // namespace cppcoro
+
+namespace cb
+{
+using task_category = cppcoro::task_category;
+}
+
+#endif
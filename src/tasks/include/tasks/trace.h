@@ -0,0 +1,85 @@
+#ifndef CPPCORO_TRACE_HPP_INCLUDED
+#define CPPCORO_TRACE_HPP_INCLUDED
+
+#include <tasks/config.h>
+
+/// A timeline recorder, for loading a session into chrome://tracing or
+/// Perfetto. Only built with the TASKS_TRACE cmake option, otherwise the
+/// CORO_TRACE_* macros below expand to nothing and their arguments are not
+/// evaluated.
+///
+/// Each thread records into a ring buffer of its own, that keeps the most
+/// recent events once it is full. Recording an event takes a clock read and
+/// an uncontended lock of that buffer. Event names are not copied, they must
+/// be string literals or otherwise live until the trace has been written.
+///
+/// Spans must begin and end on the same thread, so a span in a coroutine
+/// mustn't cross a co_await that may resume it elsewhere.
+#if CORO_TRACE
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace cppcoro::trace
+{
+void begin(const char* name) noexcept;
+void end() noexcept;
+void instant(const char* name) noexcept;
+
+/// An arrow from the enclosing span on this thread to the span enclosing the
+/// matching flow_end() with the same \p id, typically on another thread.
+void flow_start(const char* name, std::uint64_t id) noexcept;
+void flow_end(const char* name, std::uint64_t id) noexcept;
+
+/// Name the calling thread in the trace.
+void set_thread_name(std::string name);
+
+/// Write every thread's buffer as a JSON trace. Other threads may carry on
+/// recording meanwhile, each buffer is copied under its lock.
+void write_json(std::FILE* out);
+
+/// Like write_json(std::FILE*), false if \p path can't be opened.
+bool write_json(const char* path);
+
+/// Records a span over the lifetime of the scope.
+class scope
+{
+   public:
+    explicit scope(const char* name) noexcept { begin(name); }
+    ~scope() { end(); }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+};
+}  // namespace cppcoro::trace
+
+namespace cb
+{
+namespace trace = cppcoro::trace;
+}
+
+#define CORO_TRACE_CONCAT_IMPL(a, b) a##b
+#define CORO_TRACE_CONCAT(a, b) CORO_TRACE_CONCAT_IMPL(a, b)
+
+#define CORO_TRACE_SCOPE(name) ::cppcoro::trace::scope CORO_TRACE_CONCAT(coroTraceScope, __LINE__){name}
+#define CORO_TRACE_BEGIN(name) ::cppcoro::trace::begin(name)
+#define CORO_TRACE_END() ::cppcoro::trace::end()
+#define CORO_TRACE_INSTANT(name) ::cppcoro::trace::instant(name)
+#define CORO_TRACE_FLOW_START(name, id) ::cppcoro::trace::flow_start(name, id)
+#define CORO_TRACE_FLOW_END(name, id) ::cppcoro::trace::flow_end(name, id)
+#define CORO_TRACE_THREAD_NAME(name) ::cppcoro::trace::set_thread_name(name)
+
+#else
+
+#define CORO_TRACE_SCOPE(name) static_cast<void>(0)
+#define CORO_TRACE_BEGIN(name) static_cast<void>(0)
+#define CORO_TRACE_END() static_cast<void>(0)
+#define CORO_TRACE_INSTANT(name) static_cast<void>(0)
+#define CORO_TRACE_FLOW_START(name, id) static_cast<void>(0)
+#define CORO_TRACE_FLOW_END(name, id) static_cast<void>(0)
+#define CORO_TRACE_THREAD_NAME(name) static_cast<void>(0)
+
+#endif
+
+#endif
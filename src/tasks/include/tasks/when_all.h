@@ -0,0 +1,208 @@
+#pragma once
+#include <tasks/detail/completion_listener.hpp>
+#include <tasks/shared_task.h>
+#include <tasks/task.h>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cb
+{
+namespace detail
+{
+// Stands in for the result of a task<void> in the tuple returned by when_all().
+struct void_value
+{
+};
+
+template <typename Task>
+using when_all_result_t =
+    std::conditional_t<std::is_void_v<typename std::remove_cvref_t<Task>::value_type>, void_value,
+                       typename std::remove_cvref_t<Task>::value_type>;
+
+// Counts down as the tasks complete and resumes the awaiting coroutine after the last one.
+class when_all_counter final : public cppcoro::detail::completion_listener
+{
+   public:
+    // One more than the number of tasks, for the awaiting coroutine itself. That way
+    // nothing can resume it before it has registered with every task and suspended.
+    explicit when_all_counter(std::size_t count) noexcept : m_count(count + 1) {}
+
+    template <typename Task>
+    void start(Task& task) noexcept
+    {
+        if (!task.try_notify_on_completion(*this))
+        {
+            // Already completed. Never the last one to count down, the awaiting coroutine is.
+            on_complete();
+        }
+    }
+
+    // Returns false if every task has completed already and the awaiting coroutine should not suspend.
+    bool try_await(std::coroutine_handle<> awaitingCoroutine) noexcept
+    {
+        m_awaitingCoroutine = awaitingCoroutine;
+        return m_count.fetch_sub(1, std::memory_order_acq_rel) > 1;
+    }
+
+    std::coroutine_handle<> on_complete() noexcept override
+    {
+        if (m_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            return m_awaitingCoroutine;
+        }
+        return std::noop_coroutine();
+    }
+
+   private:
+    std::atomic<std::size_t> m_count;
+    std::coroutine_handle<> m_awaitingCoroutine;
+};
+
+template <typename TaskContainer>
+class when_all_ready_awaitable
+{
+   public:
+    explicit when_all_ready_awaitable(TaskContainer&& tasks) noexcept
+        : m_tasks(std::move(tasks)), m_counter(m_tasks.size())
+    {
+    }
+
+    bool await_ready() const noexcept { return m_tasks.empty(); }
+
+    bool await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept
+    {
+        for (auto& task : m_tasks)
+        {
+            m_counter.start(task);
+        }
+        return m_counter.try_await(awaitingCoroutine);
+    }
+
+    TaskContainer await_resume() noexcept { return std::move(m_tasks); }
+
+   protected:
+    TaskContainer m_tasks;
+    when_all_counter m_counter;
+};
+
+template <typename... Tasks>
+class when_all_ready_awaitable<std::tuple<Tasks...> >
+{
+   public:
+    template <typename... TaskArgs>
+    explicit when_all_ready_awaitable(TaskArgs&&... tasks) noexcept
+        : m_tasks(std::forward<TaskArgs>(tasks)...), m_counter(sizeof...(Tasks))
+    {
+    }
+
+    bool await_ready() const noexcept { return sizeof...(Tasks) == 0; }
+
+    bool await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept
+    {
+        std::apply([this](auto&... tasks) { (m_counter.start(tasks), ...); }, m_tasks);
+        return m_counter.try_await(awaitingCoroutine);
+    }
+
+    std::tuple<Tasks...> await_resume() noexcept { return std::move(m_tasks); }
+
+   protected:
+    std::tuple<Tasks...> m_tasks;
+    when_all_counter m_counter;
+};
+
+template <typename TaskContainer>
+class when_all_awaitable : public when_all_ready_awaitable<TaskContainer>
+{
+    using task_type = typename TaskContainer::value_type;
+    using result_type = typename task_type::value_type;
+
+   public:
+    using when_all_ready_awaitable<TaskContainer>::when_all_ready_awaitable;
+
+    auto await_resume()
+    {
+        if constexpr (std::is_void_v<result_type>)
+        {
+            return;
+        }
+        else
+        {
+            std::vector<result_type> results;
+            results.reserve(this->m_tasks.size());
+            for (auto& task : this->m_tasks)
+            {
+                results.push_back(task.await_resume());
+            }
+            return results;
+        }
+    }
+};
+
+template <typename... Tasks>
+class when_all_awaitable<std::tuple<Tasks...> > : public when_all_ready_awaitable<std::tuple<Tasks...> >
+{
+   public:
+    using when_all_ready_awaitable<std::tuple<Tasks...> >::when_all_ready_awaitable;
+
+    std::tuple<when_all_result_t<Tasks>...> await_resume()
+    {
+        return std::apply(
+            [](auto&... tasks) { return std::tuple<when_all_result_t<Tasks>...>(result_of(tasks)...); },
+            this->m_tasks);
+    }
+
+   private:
+    template <typename Task>
+    static decltype(auto) result_of(Task& task)
+    {
+        if constexpr (std::is_void_v<typename std::remove_cvref_t<Task>::value_type>)
+        {
+            return void_value{};
+        }
+        else
+        {
+            return task.await_resume();
+        }
+    }
+};
+}  // namespace detail
+
+// Wait for every task to complete, without blocking a thread and without starting a coroutine
+// for each task. The awaiting coroutine is resumed on the thread that completes the last task.
+//
+// Tasks passed as lvalues are referred to, tasks passed as rvalues are moved in. co_await
+// returns them again, all completed, so their results can be co_awaited without suspending.
+template <typename... Tasks>
+[[nodiscard]] auto when_all_ready(Tasks&&... tasks)
+{
+    return detail::when_all_ready_awaitable<std::tuple<Tasks...> >(std::forward<Tasks>(tasks)...);
+}
+
+template <typename Task>
+[[nodiscard]] auto when_all_ready(std::vector<Task> tasks)
+{
+    return detail::when_all_ready_awaitable<std::vector<Task> >(std::move(tasks));
+}
+
+// As when_all_ready() but co_await returns the results of the tasks instead: a tuple, holding a
+// detail::void_value for each task<void>, or a vector, or nothing for a vector of task<void>.
+// Results of a task<T> are moved out of it, results of a shared_task<T> are copied.
+template <typename... Tasks>
+[[nodiscard]] auto when_all(Tasks&&... tasks)
+{
+    return detail::when_all_awaitable<std::tuple<Tasks...> >(std::forward<Tasks>(tasks)...);
+}
+
+template <typename Task>
+[[nodiscard]] auto when_all(std::vector<Task> tasks)
+{
+    return detail::when_all_awaitable<std::vector<Task> >(std::move(tasks));
+}
+
+}  // namespace cb
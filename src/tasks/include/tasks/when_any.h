@@ -0,0 +1,247 @@
+#pragma once
+#include <tasks/detail/completion_listener.hpp>
+#include <tasks/shared_task.h>
+#include <tasks/task.h>
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cb
+{
+namespace detail
+{
+class when_any_state;
+
+// Listens to a single task on behalf of a when_any_state.
+class when_any_listener final : public cppcoro::detail::completion_listener
+{
+   public:
+    when_any_listener(when_any_state* state, std::size_t index) noexcept : m_state(state), m_index(index) {}
+
+    std::coroutine_handle<> on_complete() noexcept override;
+
+    template <typename T, template <typename, typename> class Promise>
+    bool start(task<T, Promise>& task) noexcept
+    {
+        return task.try_notify_on_completion(*this);
+    }
+
+    template <typename T>
+    bool start(shared_task<T>& task) noexcept
+    {
+        return task.try_notify_on_completion(*this, m_waiter);
+    }
+
+    template <typename T, template <typename, typename> class Promise>
+    bool try_cancel(task<T, Promise>& task) noexcept
+    {
+        return task.try_cancel_notify(*this);
+    }
+
+    template <typename T>
+    bool try_cancel(shared_task<T>&) noexcept
+    {
+        // There is no way to take a waiter back off a shared_task, it
+        // stays queued until the shared_task completes.
+        return false;
+    }
+
+   private:
+    when_any_state* m_state;
+    std::size_t m_index;
+    shared_task_waiter m_waiter;
+};
+
+// Shared by the awaiting coroutine and the tasks that have not completed yet. Unlike when_all()
+// the awaiting coroutine carries on while some tasks are still running, so this is allocated
+// once per when_any(), together with a listener for each task, and freed by whoever is last.
+class when_any_state
+{
+   public:
+    static constexpr std::size_t no_winner = std::numeric_limits<std::size_t>::max();
+
+    static when_any_state* create(std::size_t count, std::coroutine_handle<> awaitingCoroutine)
+    {
+        void* memory = ::operator new(sizeof(when_any_state) + count * sizeof(when_any_listener));
+        auto* state = new (memory) when_any_state(count, awaitingCoroutine);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            new (state->listeners() + i) when_any_listener(state, i);
+        }
+        return state;
+    }
+
+    when_any_listener& listener(std::size_t index) noexcept { return listeners()[index]; }
+
+    bool has_winner() const noexcept { return m_winner.load(std::memory_order_acquire) != no_winner; }
+
+    std::size_t winner() const noexcept { return m_winner.load(std::memory_order_acquire); }
+
+    // Called by the listener of each task, or by the awaiting coroutine for a task that it
+    // found already completed. The first one resumes the awaiting coroutine.
+    std::coroutine_handle<> on_complete(std::size_t index) noexcept
+    {
+        std::coroutine_handle<> next = std::noop_coroutine();
+        std::size_t expected = no_winner;
+        if (m_winner.compare_exchange_strong(expected, index, std::memory_order_acq_rel,
+                                             std::memory_order_relaxed) &&
+            m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            next = m_awaitingCoroutine;
+        }
+
+        // The awaiting coroutine holds its own reference until it has resumed, so this
+        // never frees the state while 'next' still needs to run.
+        release();
+        return next;
+    }
+
+    // Returns false if a task has completed already and the awaiting coroutine should not suspend.
+    bool try_await() noexcept { return m_pending.fetch_sub(1, std::memory_order_acq_rel) > 1; }
+
+    void release() noexcept
+    {
+        if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            for (std::size_t i = 0; i < m_count; ++i)
+            {
+                listeners()[i].~when_any_listener();
+            }
+            this->~when_any_state();
+            ::operator delete(this);
+        }
+    }
+
+   private:
+    when_any_state(std::size_t count, std::coroutine_handle<> awaitingCoroutine) noexcept
+        : m_refCount(count + 1), m_awaitingCoroutine(awaitingCoroutine), m_count(count)
+    {
+    }
+
+    when_any_listener* listeners() noexcept { return reinterpret_cast<when_any_listener*>(this + 1); }
+
+    // One for every listener that may still be notified and one for the awaiting coroutine.
+    std::atomic<std::size_t> m_refCount;
+
+    // One for the first task to complete and one for the awaiting coroutine having suspended.
+    std::atomic<std::size_t> m_pending = 2;
+
+    std::atomic<std::size_t> m_winner = no_winner;
+    std::coroutine_handle<> m_awaitingCoroutine;
+    std::size_t m_count;
+};
+
+static_assert(sizeof(when_any_state) % alignof(when_any_listener) == 0);
+
+inline std::coroutine_handle<> when_any_listener::on_complete() noexcept { return m_state->on_complete(m_index); }
+
+template <typename TaskRange>
+class when_any_awaitable
+{
+   public:
+    explicit when_any_awaitable(TaskRange tasks) noexcept : m_tasks(std::forward<TaskRange>(tasks)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> awaitingCoroutine)
+    {
+        m_state = when_any_state::create(size(), awaitingCoroutine);
+
+        std::size_t index = 0;
+        for_each_task([&](auto& task) {
+            auto& listener = m_state->listener(index);
+            if (m_state->has_winner())
+            {
+                // No need to listen to the rest.
+                m_state->release();
+            }
+            else if (!listener.start(task))
+            {
+                m_state->on_complete(index);
+            }
+            ++index;
+        });
+
+        return m_state->try_await();
+    }
+
+    std::size_t await_resume() noexcept
+    {
+        const std::size_t winner = m_state->winner();
+
+        // Stop listening to the tasks that are still running so that they can be awaited again.
+        std::size_t index = 0;
+        for_each_task([&](auto& task) {
+            if (index != winner && m_state->listener(index).try_cancel(task))
+            {
+                m_state->release();
+            }
+            ++index;
+        });
+
+        m_state->release();
+        return winner;
+    }
+
+   private:
+    std::size_t size() const noexcept
+    {
+        if constexpr (requires { std::tuple_size<TaskRange>::value; })
+        {
+            return std::tuple_size_v<TaskRange>;
+        }
+        else
+        {
+            return m_tasks.size();
+        }
+    }
+
+    template <typename F>
+    void for_each_task(F&& f)
+    {
+        if constexpr (requires { std::tuple_size<TaskRange>::value; })
+        {
+            std::apply([&](auto&... tasks) { (f(tasks), ...); }, m_tasks);
+        }
+        else
+        {
+            for (auto& task : m_tasks)
+            {
+                f(task);
+            }
+        }
+    }
+
+    TaskRange m_tasks;
+    when_any_state* m_state = nullptr;
+};
+}  // namespace detail
+
+// Wait for the first of the tasks to complete, without blocking a thread, and return its index.
+// The awaiting coroutine is resumed on the thread that completes that task. The other tasks
+// keep running and can be awaited again afterwards. There must be at least one task.
+//
+// The tasks are referred to rather than moved in, they have to outlive their coroutines.
+template <typename... Tasks>
+[[nodiscard]] auto when_any(Tasks&... tasks)
+{
+    static_assert(sizeof...(Tasks) > 0, "when_any() needs at least one task");
+    return detail::when_any_awaitable<std::tuple<Tasks&...> >(std::tuple<Tasks&...>(tasks...));
+}
+
+template <typename Task>
+[[nodiscard]] auto when_any(std::vector<Task>& tasks)
+{
+    assert(!tasks.empty());
+    return detail::when_any_awaitable<std::vector<Task>&>(tasks);
+}
+
+}  // namespace cb
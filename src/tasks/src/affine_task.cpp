@@ -0,0 +1,24 @@
+#include <tasks/affine_task.h>
+
+namespace cb::detail
+{
+executor_hop hop_to(executor_ref executor, std::uint64_t turn)
+{
+    const bool stayInline =
+        executor.strand_ != nullptr ? turn != 0 && executor.turn() == turn : executor.running_in_this_thread();
+    if (stayInline)
+    {
+        co_return;
+    }
+
+    CORO_TRACE_INSTANT("affine hop");
+    if (executor.strand_ != nullptr)
+    {
+        co_await executor.strand_->schedule();
+    }
+    else
+    {
+        co_await executor.pool_->schedule();
+    }
+}
+}  // namespace cb::detail
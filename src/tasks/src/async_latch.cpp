@@ -0,0 +1,76 @@
+#include <tasks/async_latch.h>
+
+#include <cassert>
+
+namespace cppcoro
+{
+async_latch::async_latch(std::ptrdiff_t initialCount) noexcept
+    : m_count(initialCount), m_state(initialCount <= 0 ? ready_state() : nullptr)
+{
+}
+
+async_latch::~async_latch()
+{
+    [[maybe_unused]] void* state = m_state.load(std::memory_order_relaxed);
+    assert(state == nullptr || state == ready_state());
+}
+
+bool async_latch::is_ready() const noexcept
+{
+    return m_state.load(std::memory_order_acquire) == ready_state();
+}
+
+void async_latch::count_down(std::ptrdiff_t n) noexcept
+{
+    const std::ptrdiff_t oldCount = m_count.fetch_sub(n, std::memory_order_acq_rel);
+    if (oldCount <= 0 || oldCount > n)
+    {
+        // Not the call that reached zero, either still counting or reached it before.
+        return;
+    }
+
+    void* oldState = m_state.exchange(ready_state(), std::memory_order_acq_rel);
+
+    // The operations were pushed on to the front, reverse them to resume them in the order they arrived.
+    async_latch_operation* waiters = nullptr;
+    auto* operation = static_cast<async_latch_operation*>(oldState);
+    while (operation != nullptr)
+    {
+        auto* next = operation->m_next;
+        operation->m_next = waiters;
+        waiters = operation;
+        operation = next;
+    }
+
+    while (waiters != nullptr)
+    {
+        // The coroutine may destroy its operation as soon as it is resumed.
+        auto* next = waiters->m_next;
+        waiters->m_awaiter.resume();
+        waiters = next;
+    }
+}
+
+async_latch_operation async_latch::operator co_await() const noexcept
+{
+    return async_latch_operation{*this};
+}
+
+bool async_latch_operation::await_suspend(std::coroutine_handle<> awaiter) noexcept
+{
+    m_awaiter = awaiter;
+
+    void* oldState = m_latch.m_state.load(std::memory_order_acquire);
+    do
+    {
+        if (oldState == m_latch.ready_state())
+        {
+            return false;
+        }
+        m_next = static_cast<async_latch_operation*>(oldState);
+    } while (!m_latch.m_state.compare_exchange_weak(oldState, this, std::memory_order_release,
+                                                    std::memory_order_acquire));
+
+    return true;
+}
+}  // namespace cppcoro
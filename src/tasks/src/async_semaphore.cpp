@@ -0,0 +1,152 @@
+#include <tasks/async_semaphore.h>
+
+#include "spin_mutex.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+
+namespace cppcoro
+{
+async_semaphore::async_semaphore(std::uint32_t initialCount)
+    : m_count(initialCount), m_mutex(std::make_unique<spin_mutex>()), m_handedOver(0), m_heads{}, m_tails{}
+{
+}
+
+async_semaphore::~async_semaphore()
+{
+    for (auto* head : m_heads)
+    {
+        assert(head == nullptr);
+    }
+}
+
+bool async_semaphore::try_acquire() noexcept
+{
+    std::int64_t count = m_count.load(std::memory_order_relaxed);
+    while (count > 0)
+    {
+        if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+async_semaphore_acquire_operation async_semaphore::acquire(priority p) noexcept
+{
+    return async_semaphore_acquire_operation{*this, p};
+}
+
+async_semaphore_scoped_acquire_operation async_semaphore::scoped_acquire(priority p) noexcept
+{
+    return async_semaphore_scoped_acquire_operation{*this, p};
+}
+
+void async_semaphore::release(std::uint32_t count) noexcept
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Every count below zero is a coroutine that has committed to waiting,
+    // so those get the permits first.
+    const std::int64_t oldCount = m_count.fetch_add(count, std::memory_order_acq_rel);
+    if (oldCount >= 0)
+    {
+        return;
+    }
+
+    auto toWake = static_cast<std::uint32_t>(std::min<std::int64_t>(-oldCount, count));
+
+    async_semaphore_acquire_operation* wakeHead = nullptr;
+    {
+        std::lock_guard lock{*m_mutex};
+        async_semaphore_acquire_operation* wakeTail = nullptr;
+        for (; toWake > 0; --toWake)
+        {
+            auto* operation = pop_next();
+            if (operation == nullptr)
+            {
+                break;
+            }
+
+            operation->m_next = nullptr;
+            if (wakeTail == nullptr)
+            {
+                wakeHead = operation;
+            }
+            else
+            {
+                wakeTail->m_next = operation;
+            }
+            wakeTail = operation;
+        }
+
+        // The rest haven't queued themselves yet, they'll find their permit when they do.
+        m_handedOver += toWake;
+    }
+
+    while (wakeHead != nullptr)
+    {
+        auto* next = wakeHead->m_next;
+        wakeHead->m_awaiter.resume();
+        wakeHead = next;
+    }
+}
+
+std::int64_t async_semaphore::available() const noexcept
+{
+    return std::max<std::int64_t>(m_count.load(std::memory_order_relaxed), 0);
+}
+
+async_semaphore_acquire_operation* async_semaphore::pop_next() noexcept
+{
+    for (std::size_t lane = 0; lane < static_thread_pool::priority_count; ++lane)
+    {
+        auto* operation = m_heads[lane];
+        if (operation != nullptr)
+        {
+            m_heads[lane] = operation->m_next;
+            if (m_heads[lane] == nullptr)
+            {
+                m_tails[lane] = nullptr;
+            }
+            return operation;
+        }
+    }
+    return nullptr;
+}
+
+bool async_semaphore_acquire_operation::await_suspend(std::coroutine_handle<> awaiter) noexcept
+{
+    m_awaiter = awaiter;
+
+    // Commit to taking a permit. If one was released since await_ready(), we have it.
+    if (m_semaphore.m_count.fetch_sub(1, std::memory_order_acq_rel) > 0)
+    {
+        return false;
+    }
+
+    std::lock_guard lock{*m_semaphore.m_mutex};
+    if (m_semaphore.m_handedOver > 0)
+    {
+        --m_semaphore.m_handedOver;
+        return false;
+    }
+
+    const auto lane = static_cast<std::size_t>(m_priority);
+    if (m_semaphore.m_tails[lane] == nullptr)
+    {
+        m_semaphore.m_heads[lane] = this;
+    }
+    else
+    {
+        m_semaphore.m_tails[lane]->m_next = this;
+    }
+    m_semaphore.m_tails[lane] = this;
+    return true;
+}
+}  // namespace cppcoro
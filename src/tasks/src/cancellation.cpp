@@ -0,0 +1,321 @@
+#include <tasks/cancellation.h>
+
+#include "spin_mutex.hpp"
+#include "spin_wait.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace cppcoro
+{
+namespace detail
+{
+/// Shared by a source, its copies, their tokens and the registrations with those.
+class cancellation_state
+{
+   public:
+    /// Created on behalf of a single source.
+    cancellation_state() noexcept
+        : m_refCount(1),
+          m_sourceCount(1),
+          m_cancellationRequested(false),
+          m_head(nullptr),
+          m_executingCallback(nullptr)
+    {
+    }
+
+    void add_token_ref() noexcept { m_refCount.fetch_add(1, std::memory_order_relaxed); }
+
+    void release_token_ref() noexcept
+    {
+        if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete this;
+        }
+    }
+
+    void add_source_ref() noexcept
+    {
+        m_sourceCount.fetch_add(1, std::memory_order_relaxed);
+        add_token_ref();
+    }
+
+    void release_source_ref() noexcept
+    {
+        m_sourceCount.fetch_sub(1, std::memory_order_release);
+        release_token_ref();
+    }
+
+    bool can_be_cancelled() const noexcept
+    {
+        return m_cancellationRequested.load(std::memory_order_acquire) ||
+               m_sourceCount.load(std::memory_order_acquire) > 0;
+    }
+
+    bool is_cancellation_requested() const noexcept
+    {
+        return m_cancellationRequested.load(std::memory_order_acquire);
+    }
+
+    void request_cancellation()
+    {
+        if (m_cancellationRequested.exchange(true, std::memory_order_acq_rel))
+        {
+            return;
+        }
+
+        // Registrations made from here on see the flag and call their callback
+        // themselves, so the list can only shrink.
+        std::unique_lock lock{m_mutex};
+        while (m_head != nullptr)
+        {
+            auto* registration = m_head;
+            unlink(registration);
+
+            m_executingCallback.store(registration, std::memory_order_relaxed);
+            m_executingThread = std::this_thread::get_id();
+            lock.unlock();
+
+            registration->m_callback();
+
+            lock.lock();
+            m_executingCallback.store(nullptr, std::memory_order_release);
+        }
+    }
+
+    /// \return
+    /// false, without registering it, if cancellation has been requested already.
+    bool try_register(cancellation_registration* registration) noexcept
+    {
+        if (is_cancellation_requested())
+        {
+            return false;
+        }
+
+        std::lock_guard lock{m_mutex};
+        if (m_cancellationRequested.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+
+        registration->m_prev = nullptr;
+        registration->m_next = m_head;
+        if (m_head != nullptr)
+        {
+            m_head->m_prev = registration;
+        }
+        m_head = registration;
+        registration->m_registered = true;
+        return true;
+    }
+
+    void deregister(cancellation_registration* registration) noexcept
+    {
+        bool waitForCallback = false;
+        {
+            std::lock_guard lock{m_mutex};
+            if (registration->m_registered)
+            {
+                unlink(registration);
+                return;
+            }
+
+            // Not in the list any more, so its callback has been called or is being called.
+            // A callback deregistering itself mustn't wait for itself to return.
+            waitForCallback = m_executingCallback.load(std::memory_order_relaxed) == registration &&
+                              m_executingThread != std::this_thread::get_id();
+        }
+
+        if (waitForCallback)
+        {
+            spin_wait wait;
+            while (m_executingCallback.load(std::memory_order_acquire) == registration)
+            {
+                wait.spin_one();
+            }
+        }
+    }
+
+   private:
+    ~cancellation_state() { assert(m_head == nullptr); }
+
+    void unlink(cancellation_registration* registration) noexcept
+    {
+        if (registration->m_prev != nullptr)
+        {
+            registration->m_prev->m_next = registration->m_next;
+        }
+        else
+        {
+            m_head = registration->m_next;
+        }
+        if (registration->m_next != nullptr)
+        {
+            registration->m_next->m_prev = registration->m_prev;
+        }
+        registration->m_next = nullptr;
+        registration->m_prev = nullptr;
+        registration->m_registered = false;
+    }
+
+    // Sources, tokens and registrations. The state is deleted when the last goes.
+    std::atomic<std::uint32_t> m_refCount;
+    std::atomic<std::uint32_t> m_sourceCount;
+    std::atomic<bool> m_cancellationRequested;
+
+    // Guards the list of registrations and the thread running a callback.
+    spin_mutex m_mutex;
+    cancellation_registration* m_head;
+
+    // The registration whose callback request_cancellation() is running, if any.
+    std::atomic<cancellation_registration*> m_executingCallback;
+    std::thread::id m_executingThread;
+};
+}  // namespace detail
+
+cancellation_token::cancellation_token(detail::cancellation_state* state) noexcept : m_state(state)
+{
+    if (m_state != nullptr)
+    {
+        m_state->add_token_ref();
+    }
+}
+
+cancellation_token::cancellation_token(const cancellation_token& other) noexcept : cancellation_token(other.m_state)
+{
+}
+
+cancellation_token::cancellation_token(cancellation_token&& other) noexcept : m_state(other.m_state)
+{
+    other.m_state = nullptr;
+}
+
+cancellation_token::~cancellation_token()
+{
+    if (m_state != nullptr)
+    {
+        m_state->release_token_ref();
+    }
+}
+
+cancellation_token& cancellation_token::operator=(const cancellation_token& other) noexcept
+{
+    if (m_state != other.m_state)
+    {
+        *this = cancellation_token{other.m_state};
+    }
+    return *this;
+}
+
+cancellation_token& cancellation_token::operator=(cancellation_token&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (m_state != nullptr)
+        {
+            m_state->release_token_ref();
+        }
+        m_state = other.m_state;
+        other.m_state = nullptr;
+    }
+    return *this;
+}
+
+bool cancellation_token::can_be_cancelled() const noexcept
+{
+    return m_state != nullptr && m_state->can_be_cancelled();
+}
+
+bool cancellation_token::is_cancellation_requested() const noexcept
+{
+    return m_state != nullptr && m_state->is_cancellation_requested();
+}
+
+cancellation_source::cancellation_source() : m_state(new detail::cancellation_state()) {}
+
+cancellation_source::cancellation_source(const cancellation_source& other) noexcept : m_state(other.m_state)
+{
+    if (m_state != nullptr)
+    {
+        m_state->add_source_ref();
+    }
+}
+
+cancellation_source::cancellation_source(cancellation_source&& other) noexcept : m_state(other.m_state)
+{
+    other.m_state = nullptr;
+}
+
+cancellation_source::~cancellation_source()
+{
+    if (m_state != nullptr)
+    {
+        m_state->release_source_ref();
+    }
+}
+
+cancellation_source& cancellation_source::operator=(const cancellation_source& other) noexcept
+{
+    if (m_state != other.m_state)
+    {
+        *this = cancellation_source{other};
+    }
+    return *this;
+}
+
+cancellation_source& cancellation_source::operator=(cancellation_source&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (m_state != nullptr)
+        {
+            m_state->release_source_ref();
+        }
+        m_state = other.m_state;
+        other.m_state = nullptr;
+    }
+    return *this;
+}
+
+cancellation_token cancellation_source::token() const noexcept
+{
+    return cancellation_token{m_state};
+}
+
+void cancellation_source::request_cancellation()
+{
+    if (m_state != nullptr)
+    {
+        m_state->request_cancellation();
+    }
+}
+
+bool cancellation_source::is_cancellation_requested() const noexcept
+{
+    return m_state != nullptr && m_state->is_cancellation_requested();
+}
+
+void cancellation_registration::register_callback()
+{
+    if (!m_token.can_be_cancelled())
+    {
+        return;
+    }
+
+    if (!m_token.m_state->try_register(this))
+    {
+        m_callback();
+    }
+}
+
+cancellation_registration::~cancellation_registration()
+{
+    if (m_token.m_state != nullptr)
+    {
+        m_token.m_state->deregister(this);
+    }
+}
+}  // namespace cppcoro
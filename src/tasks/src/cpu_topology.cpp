@@ -0,0 +1,206 @@
+#include "cpu_topology.hpp"
+
+#include <tasks/config.h>
+
+#include <algorithm>
+#include <tuple>
+
+#if CORO_LINUX
+#include <sched.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#endif
+
+namespace cppcoro
+{
+namespace detail
+{
+#if CORO_LINUX
+
+namespace
+{
+bool read_file(const std::filesystem::path& path, std::string& contents)
+{
+    std::ifstream file{path};
+    return static_cast<bool>(std::getline(file, contents));
+}
+
+bool read_number(const std::filesystem::path& path, std::uint32_t& value)
+{
+    std::string contents;
+    if (!read_file(path, contents))
+    {
+        return false;
+    }
+
+    try
+    {
+        value = static_cast<std::uint32_t>(std::stoul(contents));
+        return true;
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+/// Parse a cpu list like "0-3,8,10-11" and return the lowest CPU in it.
+bool read_lowest_cpu_in_list(const std::filesystem::path& path, std::uint32_t& lowest)
+{
+    std::string contents;
+    if (!read_file(path, contents) || contents.empty())
+    {
+        return false;
+    }
+
+    // The ranges are in ascending order, so the lowest CPU starts the list.
+    try
+    {
+        lowest = static_cast<std::uint32_t>(std::stoul(contents));
+        return true;
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+bool read_cpu_info(const std::filesystem::path& cpuDirectory, std::uint32_t cpu, cpu_info& info)
+{
+    info.cpu = cpu;
+
+    const auto topology = cpuDirectory / "topology";
+    if (!read_lowest_cpu_in_list(topology / "thread_siblings_list", info.core) ||
+        !read_number(topology / "physical_package_id", info.package))
+    {
+        return false;
+    }
+
+    // The last-level cache is the highest level data or unified cache.
+    // Fall back to the package if the caches aren't described.
+    info.lastLevelCache = info.package;
+    std::uint32_t highestLevel = 0;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator{cpuDirectory / "cache", ec})
+    {
+        std::string type;
+        std::uint32_t level = 0;
+        std::uint32_t shared = 0;
+        if (entry.path().filename().string().rfind("index", 0) == 0 && read_file(entry.path() / "type", type) &&
+            type != "Instruction" && read_number(entry.path() / "level", level) && level > highestLevel &&
+            read_lowest_cpu_in_list(entry.path() / "shared_cpu_list", shared))
+        {
+            highestLevel = level;
+            info.lastLevelCache = shared;
+        }
+    }
+
+    // The CPU's directory contains a nodeN link for the NUMA node it belongs to.
+    info.node = 0;
+    for (const auto& entry : std::filesystem::directory_iterator{cpuDirectory, ec})
+    {
+        const auto name = entry.path().filename().string();
+        if (name.size() > 4 && name.rfind("node", 0) == 0)
+        {
+            try
+            {
+                info.node = static_cast<std::uint32_t>(std::stoul(name.substr(4)));
+            }
+            catch (...)
+            {
+            }
+            break;
+        }
+    }
+
+    return true;
+}
+}  // namespace
+
+std::vector<cpu_info> read_cpu_topology()
+{
+    std::vector<cpu_info> cpus;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return cpus;
+    }
+
+    try
+    {
+        const std::filesystem::path root{"/sys/devices/system/cpu"};
+        for (std::uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (!CPU_ISSET(cpu, &allowed))
+            {
+                continue;
+            }
+
+            cpu_info info;
+            if (!read_cpu_info(root / ("cpu" + std::to_string(cpu)), cpu, info))
+            {
+                return {};
+            }
+            cpus.push_back(info);
+        }
+    }
+    catch (...)
+    {
+        return {};
+    }
+
+    std::sort(cpus.begin(), cpus.end(),
+              [](const cpu_info& a, const cpu_info& b)
+              {
+                  return std::tie(a.package, a.node, a.lastLevelCache, a.core, a.cpu) <
+                         std::tie(b.package, b.node, b.lastLevelCache, b.core, b.cpu);
+              });
+    return cpus;
+}
+
+bool pin_current_thread_to_cpu(std::uint32_t cpu) noexcept
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return ::sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+
+std::vector<cpu_info> read_cpu_topology() { return {}; }
+
+bool pin_current_thread_to_cpu(std::uint32_t) noexcept { return false; }
+
+#endif
+
+std::uint32_t cpu_distance(const cpu_info& a, const cpu_info& b) noexcept
+{
+    if (a.cpu == b.cpu)
+    {
+        return 0;
+    }
+    if (a.core == b.core)
+    {
+        return 1;
+    }
+    if (a.lastLevelCache == b.lastLevelCache)
+    {
+        return 2;
+    }
+    if (a.node == b.node)
+    {
+        return 3;
+    }
+    if (a.package == b.package)
+    {
+        return 4;
+    }
+    return 5;
+}
+}  // namespace detail
+}  // namespace cppcoro
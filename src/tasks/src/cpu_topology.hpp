@@ -0,0 +1,46 @@
+#ifndef CPPCORO_CPU_TOPOLOGY_HPP_INCLUDED
+#define CPPCORO_CPU_TOPOLOGY_HPP_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+namespace cppcoro
+{
+namespace detail
+{
+/// Where a logical CPU sits in the machine.
+///
+/// Each group is identified by the lowest numbered CPU in it, so two CPUs
+/// share a core, last-level cache, NUMA node or package if and only if the
+/// corresponding ids are equal.
+struct cpu_info
+{
+    std::uint32_t cpu;
+    std::uint32_t core;
+    std::uint32_t lastLevelCache;
+    std::uint32_t node;
+    std::uint32_t package;
+};
+
+/// Read the topology of the CPUs this process is allowed to run on.
+///
+/// The result is sorted so that CPUs that are close to each other are next
+/// to each other. Only implemented on Linux, where it reads
+/// /sys/devices/system/cpu. Returns an empty list elsewhere or if the
+/// topology couldn't be read.
+std::vector<cpu_info> read_cpu_topology();
+
+/// How far apart two CPUs are, from 0 for the same CPU through hyper-threads
+/// of the same core, the same last-level cache, the same NUMA node and the
+/// same package to 5 for CPUs in different packages.
+std::uint32_t cpu_distance(const cpu_info& a, const cpu_info& b) noexcept;
+
+/// Restrict the calling thread to running on the given CPU.
+///
+/// \return
+/// false if the thread could not be pinned.
+bool pin_current_thread_to_cpu(std::uint32_t cpu) noexcept;
+}  // namespace detail
+}  // namespace cppcoro
+
+#endif
@@ -0,0 +1,86 @@
+#include "event_count.hpp"
+
+#include <algorithm>
+
+#include "futex.hpp"
+
+namespace cppcoro
+{
+event_count::event_count() noexcept : m_epoch(0), m_waiterCount(0) {}
+
+event_count::key_type event_count::prepare_wait() noexcept
+{
+    // Use seq-cst so that registering as a waiter is ordered before the
+    // caller's re-check of its condition. Either the notifier sees us here
+    // or we see whatever it published before notifying.
+    m_waiterCount.fetch_add(1, std::memory_order_seq_cst);
+    return m_epoch.load(std::memory_order_seq_cst);
+}
+
+void event_count::cancel_wait() noexcept { m_waiterCount.fetch_sub(1, std::memory_order_relaxed); }
+
+void event_count::wait(key_type key) noexcept
+{
+    // The epoch could in theory wrap all the way around to 'key' between
+    // the two loads and we would miss a notification, but that would take
+    // 2^32 notifications while this thread wasn't running.
+    while (m_epoch.load(std::memory_order_acquire) == key)
+    {
+        detail::futex_wait(m_epoch, key);
+    }
+
+    m_waiterCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool event_count::wait_until(key_type key, std::chrono::steady_clock::time_point deadline) noexcept
+{
+    bool notified = true;
+    while (m_epoch.load(std::memory_order_acquire) == key)
+    {
+        const auto remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero())
+        {
+            notified = false;
+            break;
+        }
+        detail::futex_wait_for(m_epoch, key, remaining);
+    }
+
+    m_waiterCount.fetch_sub(1, std::memory_order_relaxed);
+    return notified;
+}
+
+void event_count::notify_one() noexcept
+{
+    // This load must be seq_cst to ensure that either we see the waiter
+    // registered in prepare_wait() or the waiter sees whatever the caller
+    // published before calling us.
+    if (m_waiterCount.load(std::memory_order_seq_cst) == 0)
+    {
+        return;
+    }
+
+    m_epoch.fetch_add(1, std::memory_order_seq_cst);
+    detail::futex_wake(m_epoch, 1);
+}
+
+void event_count::notify(std::uint32_t count) noexcept
+{
+    // As notify_one(), but a single bump of the epoch releases every thread
+    // that hasn't blocked yet and a single futex wake covers the rest.
+    const std::uint32_t waiterCount = m_waiterCount.load(std::memory_order_seq_cst);
+    if (waiterCount == 0 || count == 0)
+    {
+        return;
+    }
+
+    m_epoch.fetch_add(1, std::memory_order_seq_cst);
+    detail::futex_wake(m_epoch, std::min(count, waiterCount));
+}
+
+void event_count::notify_all() noexcept
+{
+    m_epoch.fetch_add(1, std::memory_order_seq_cst);
+    detail::futex_wake_all(m_epoch);
+}
+}  // namespace cppcoro
@@ -0,0 +1,88 @@
+#ifndef CPPCORO_EVENT_COUNT_HPP_INCLUDED
+#define CPPCORO_EVENT_COUNT_HPP_INCLUDED
+
+#include <tasks/config.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace cppcoro
+{
+/// A registry of sleeping threads that lets threads block until some
+/// condition they are polling becomes true, without a lock.
+///
+/// A thread that wants to sleep calls prepare_wait(), re-checks its condition
+/// and then either calls cancel_wait() if the condition is now true or wait()
+/// with the key returned from prepare_wait(). A thread that makes the
+/// condition true calls notify_one() or notify_all() afterwards.
+///
+/// As long as the condition is published and checked with seq_cst operations
+/// either the notifier sees the registered waiter or the waiter sees the
+/// condition, so wake-ups can't be lost. Notifying when nobody is waiting
+/// costs a single load. Otherwise it costs one atomic increment plus one
+/// futex wake syscall.
+///
+/// Every notification advances the epoch, which releases every thread that
+/// has prepared to wait but not yet blocked. Those threads see a spurious
+/// wake-up and are expected to re-check their condition.
+class event_count
+{
+   public:
+    using key_type = std::uint32_t;
+
+    event_count() noexcept;
+
+    event_count(const event_count&) = delete;
+    event_count& operator=(const event_count&) = delete;
+
+    /// Register the calling thread as a waiter.
+    ///
+    /// Must be followed by exactly one call to either cancel_wait() or wait().
+    key_type prepare_wait() noexcept;
+
+    /// Deregister a waiter without sleeping.
+    void cancel_wait() noexcept;
+
+    /// Block until a notification arrives after the call to prepare_wait()
+    /// that returned \p key, then deregister the waiter.
+    void wait(key_type key) noexcept;
+
+    /// As wait(), but give up once \p deadline has passed.
+    ///
+    /// \return
+    /// true if a notification arrived, false if the wait timed out.
+    bool wait_until(key_type key, std::chrono::steady_clock::time_point deadline) noexcept;
+
+    /// Whether any thread is between prepare_wait() and the end of wait() or
+    /// cancel_wait(). Can be out of date by the time it returns.
+    bool has_waiters() const noexcept { return m_waiterCount.load(std::memory_order_relaxed) != 0; }
+
+    /// Wake up one waiting thread, if there are any.
+    void notify_one() noexcept;
+
+    /// Wake up to \p count waiting threads with a single futex wake.
+    void notify(std::uint32_t count) noexcept;
+
+    /// Wake up all waiting threads.
+    void notify_all() noexcept;
+
+   private:
+#if CORO_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4324)  // structure was padded due to alignment specifier
+#endif
+
+    // Incremented on every notification. Waiters block on this word.
+    alignas(64) std::atomic<std::uint32_t> m_epoch;
+
+    // Number of threads between prepare_wait() and the end of wait() or cancel_wait().
+    std::atomic<std::uint32_t> m_waiterCount;
+
+#if CORO_COMPILER_MSVC
+#pragma warning(pop)
+#endif
+};
+}  // namespace cppcoro
+
+#endif
@@ -0,0 +1,558 @@
+#include <tasks/file_io.h>
+
+#include "io_uring_queue.hpp"
+#include "spin_mutex.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+
+#if CORO_WINDOWS
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+namespace local
+{
+// Both read() and ReadFile() take at most this much at once. Anything more is a short read.
+constexpr std::size_t max_read_size = 0x7ffff000;
+
+// The user data of the no-op that tells the completion thread to stop.
+constexpr std::uint64_t stop_user_data = 0;
+
+#if CORO_WINDOWS
+const HANDLE invalid_handle = INVALID_HANDLE_VALUE;
+#else
+constexpr int invalid_handle = -1;
+#endif
+
+// Open the file at path and size contents.data to fit it, or set contents.error.
+cppcoro::read_only_file open_to_read_whole(const std::filesystem::path& path, cb::file_contents& contents)
+{
+    auto file = cppcoro::read_only_file::open(path, contents.error);
+    if (contents.error)
+    {
+        return file;
+    }
+
+    const std::uint64_t size = file.size(contents.error);
+    if (contents.error)
+    {
+        return file;
+    }
+    if (size > std::numeric_limits<std::size_t>::max())
+    {
+        contents.error = std::make_error_code(std::errc::file_too_large);
+        return file;
+    }
+
+    contents.data.resize(static_cast<std::size_t>(size));
+    return file;
+}
+}  // namespace local
+}  // namespace
+
+namespace cppcoro
+{
+#if CORO_WINDOWS
+
+read_only_file::read_only_file() noexcept : m_handle(local::invalid_handle) {}
+
+read_only_file read_only_file::open(const std::filesystem::path& path, std::error_code& error) noexcept
+{
+    const HANDLE handle = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        error.assign(static_cast<int>(::GetLastError()), std::system_category());
+        return {};
+    }
+
+    error.clear();
+    return read_only_file{handle};
+}
+
+bool read_only_file::is_open() const noexcept
+{
+    return m_handle != local::invalid_handle;
+}
+
+std::uint64_t read_only_file::size(std::error_code& error) const noexcept
+{
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(m_handle, &size))
+    {
+        error.assign(static_cast<int>(::GetLastError()), std::system_category());
+        return 0;
+    }
+
+    error.clear();
+    return static_cast<std::uint64_t>(size.QuadPart);
+}
+
+std::size_t read_only_file::read_at(std::uint64_t offset, void* buffer, std::size_t size,
+                                    std::error_code& error) const noexcept
+{
+    // The handle isn't opened for overlapped I/O, so this is a blocking read at the given offset.
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD bytesRead = 0;
+    if (!::ReadFile(m_handle, buffer, static_cast<DWORD>(std::min(size, local::max_read_size)), &bytesRead,
+                    &overlapped))
+    {
+        const DWORD errorCode = ::GetLastError();
+        if (errorCode != ERROR_HANDLE_EOF)
+        {
+            error.assign(static_cast<int>(errorCode), std::system_category());
+            return 0;
+        }
+    }
+
+    error.clear();
+    return bytesRead;
+}
+
+void read_only_file::close() noexcept
+{
+    if (m_handle != local::invalid_handle)
+    {
+        ::CloseHandle(m_handle);
+        m_handle = local::invalid_handle;
+    }
+}
+
+#else
+
+read_only_file::read_only_file() noexcept : m_handle(local::invalid_handle) {}
+
+read_only_file read_only_file::open(const std::filesystem::path& path, std::error_code& error) noexcept
+{
+    int fd;
+    do
+    {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+
+    if (fd < 0)
+    {
+        error.assign(errno, std::system_category());
+        return {};
+    }
+
+    error.clear();
+    return read_only_file{fd};
+}
+
+bool read_only_file::is_open() const noexcept
+{
+    return m_handle >= 0;
+}
+
+std::uint64_t read_only_file::size(std::error_code& error) const noexcept
+{
+    struct ::stat status;
+    if (::fstat(m_handle, &status) != 0)
+    {
+        error.assign(errno, std::system_category());
+        return 0;
+    }
+
+    error.clear();
+    return static_cast<std::uint64_t>(status.st_size);
+}
+
+std::size_t read_only_file::read_at(std::uint64_t offset, void* buffer, std::size_t size,
+                                    std::error_code& error) const noexcept
+{
+    ::ssize_t bytesRead;
+    do
+    {
+        bytesRead = ::pread(m_handle, buffer, std::min(size, local::max_read_size), static_cast<::off_t>(offset));
+    } while (bytesRead < 0 && errno == EINTR);
+
+    if (bytesRead < 0)
+    {
+        error.assign(errno, std::system_category());
+        return 0;
+    }
+
+    error.clear();
+    return static_cast<std::size_t>(bytesRead);
+}
+
+void read_only_file::close() noexcept
+{
+    if (m_handle >= 0)
+    {
+        ::close(m_handle);
+        m_handle = local::invalid_handle;
+    }
+}
+
+#endif
+
+read_only_file::read_only_file(read_only_file&& other) noexcept : m_handle(other.m_handle)
+{
+    other.m_handle = local::invalid_handle;
+}
+
+read_only_file& read_only_file::operator=(read_only_file&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        m_handle = other.m_handle;
+        other.m_handle = local::invalid_handle;
+    }
+    return *this;
+}
+
+read_only_file::~read_only_file()
+{
+    close();
+}
+
+/// The reads waiting for a fallback thread, in the order they were submitted.
+class file_io_service::fallback_queue
+{
+   public:
+    void push(read_operation* operation) noexcept
+    {
+        {
+            std::lock_guard lock{m_mutex};
+            if (m_tail == nullptr)
+            {
+                m_head = operation;
+            }
+            else
+            {
+                m_tail->m_next = operation;
+            }
+            m_tail = operation;
+        }
+        m_wakeUp.notify_one();
+    }
+
+    /// Block until there is a read to do.
+    ///
+    /// \return
+    /// nullptr once stop() has been called and there are no reads left.
+    read_operation* pop() noexcept
+    {
+        std::unique_lock lock{m_mutex};
+        m_wakeUp.wait(lock, [this] { return m_head != nullptr || m_stopRequested; });
+
+        auto* operation = m_head;
+        if (operation != nullptr)
+        {
+            m_head = operation->m_next;
+            if (m_head == nullptr)
+            {
+                m_tail = nullptr;
+            }
+            operation->m_next = nullptr;
+        }
+        return operation;
+    }
+
+    void stop() noexcept
+    {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stopRequested = true;
+        }
+        m_wakeUp.notify_all();
+    }
+
+   private:
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    read_operation* m_head = nullptr;
+    read_operation* m_tail = nullptr;
+    bool m_stopRequested = false;
+};
+
+file_io_service::file_io_service(static_thread_pool& completionPool) : file_io_service(completionPool, options{}) {}
+
+file_io_service::file_io_service(static_thread_pool& completionPool, const options& opts)
+    : m_completionPool(completionPool),
+      m_ring(opts.forceFallback ? nullptr : detail::io_uring_queue::create(std::max(opts.queueDepth, 1u) + 1)),
+      m_submitMutex(std::make_unique<spin_mutex>()),
+      m_inFlight(0),
+      m_pendingHead(nullptr),
+      m_pendingTail(nullptr),
+      m_fallback(m_ring != nullptr ? nullptr : std::make_unique<fallback_queue>())
+{
+    if (m_ring != nullptr)
+    {
+        m_threads.emplace_back([this] { run_completion_thread(); });
+    }
+    else
+    {
+        const std::uint32_t threadCount = std::max(opts.fallbackThreadCount, 1u);
+        m_threads.reserve(threadCount);
+        for (std::uint32_t i = 0; i < threadCount; ++i)
+        {
+            m_threads.emplace_back([this] { run_fallback_thread(); });
+        }
+    }
+}
+
+file_io_service::~file_io_service()
+{
+    if (m_ring != nullptr)
+    {
+        {
+            std::lock_guard lock{*m_submitMutex};
+            assert(m_inFlight == 0 && m_pendingHead == nullptr);
+
+            // Nothing is in flight, so there is room for it.
+            m_ring->prepare_nop(local::stop_user_data);
+        }
+        m_ring->submit();
+    }
+    else
+    {
+        m_fallback->stop();
+    }
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void file_io_service::read_operation::await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept
+{
+    m_awaitingCoroutine = awaitingCoroutine;
+    m_service->submit(this);
+}
+
+void file_io_service::submit(read_operation* operation) noexcept
+{
+    if (m_ring == nullptr)
+    {
+        m_fallback->push(operation);
+        return;
+    }
+
+    bool prepared = false;
+    {
+        std::lock_guard lock{*m_submitMutex};
+        if (m_pendingTail == nullptr)
+        {
+            m_pendingHead = operation;
+        }
+        else
+        {
+            m_pendingTail->m_next = operation;
+        }
+        m_pendingTail = operation;
+
+        prepared = prepare_pending();
+    }
+
+    // The system call stays out of the lock, other threads only need it to queue their reads.
+    if (prepared)
+    {
+        m_ring->submit();
+    }
+}
+
+bool file_io_service::prepare_pending() noexcept
+{
+#if CORO_IO_URING
+    // The ring has one more entry than the queue depth, kept free for the stop
+    // no-op. Staying within it also means the completion queue can't overflow.
+    bool prepared = false;
+    while (m_pendingHead != nullptr && m_inFlight + 1 < m_ring->capacity())
+    {
+        auto* operation = m_pendingHead;
+        const auto size = static_cast<std::uint32_t>(std::min(operation->m_size, local::max_read_size));
+        if (!m_ring->prepare_read(operation->m_file->native_handle(), operation->m_offset, operation->m_buffer, size,
+                                  reinterpret_cast<std::uint64_t>(operation)))
+        {
+            break;
+        }
+
+        m_pendingHead = operation->m_next;
+        if (m_pendingHead == nullptr)
+        {
+            m_pendingTail = nullptr;
+        }
+        operation->m_next = nullptr;
+        ++m_inFlight;
+        prepared = true;
+    }
+    return prepared;
+#else
+    return false;
+#endif
+}
+
+void file_io_service::run_completion_thread() noexcept
+{
+#if CORO_IO_URING
+    for (;;)
+    {
+        m_ring->wait_for_completion();
+
+        read_operation* completedHead = nullptr;
+        read_operation* completedTail = nullptr;
+        bool stopRequested = false;
+        bool prepared = false;
+
+        {
+            // The kernel only posts a completion after the read was queued onto the ring,
+            // with this lock held, but taking the lock here too makes that ordering visible
+            // to tools like ThreadSanitizer. The room freed up goes to the pending reads
+            // right away.
+            std::lock_guard lock{*m_submitMutex};
+
+            std::uint64_t userData;
+            std::int32_t result;
+            while (m_ring->try_pop_completion(userData, result))
+            {
+                if (userData == local::stop_user_data)
+                {
+                    stopRequested = true;
+                    continue;
+                }
+
+                auto* operation = reinterpret_cast<read_operation*>(userData);
+                if (result < 0)
+                {
+                    operation->m_result.error.assign(-result, std::system_category());
+                }
+                else
+                {
+                    operation->m_result.bytesRead = static_cast<std::size_t>(result);
+                }
+
+                if (completedTail == nullptr)
+                {
+                    completedHead = operation;
+                }
+                else
+                {
+                    completedTail->m_next = operation;
+                }
+                completedTail = operation;
+                --m_inFlight;
+            }
+
+            prepared = prepare_pending();
+        }
+
+        if (prepared)
+        {
+            m_ring->submit();
+        }
+
+        // Resume the awaiting coroutines outside of the lock, scheduling them may wake a worker.
+        while (completedHead != nullptr)
+        {
+            auto* next = completedHead->m_next;
+            completedHead->complete();
+            completedHead = next;
+        }
+
+        if (stopRequested)
+        {
+            return;
+        }
+    }
+#endif
+}
+
+void file_io_service::run_fallback_thread() noexcept
+{
+    while (auto* operation = m_fallback->pop())
+    {
+        operation->m_result.bytesRead = operation->m_file->read_at(operation->m_offset, operation->m_buffer,
+                                                                   operation->m_size, operation->m_result.error);
+        operation->complete();
+    }
+}
+}  // namespace cppcoro
+
+namespace cb
+{
+task<file_contents> async_read_file(file_io_service& io, std::filesystem::path path, static_thread_pool::priority p)
+{
+    file_contents contents;
+
+    auto file = local::open_to_read_whole(path, contents);
+    if (contents.error)
+    {
+        co_return contents;
+    }
+
+    std::size_t offset = 0;
+    while (offset < contents.data.size())
+    {
+        const read_result result =
+            co_await io.read_at(file, offset, contents.data.data() + offset, contents.data.size() - offset, p);
+        if (result.error)
+        {
+            contents.data.clear();
+            contents.error = result.error;
+            co_return contents;
+        }
+        if (result.bytesRead == 0)
+        {
+            // The file got shorter since we looked up its size.
+            break;
+        }
+        offset += result.bytesRead;
+    }
+
+    contents.data.resize(offset);
+    co_return contents;
+}
+
+file_contents read_file(const std::filesystem::path& path)
+{
+    file_contents contents;
+
+    auto file = local::open_to_read_whole(path, contents);
+    if (contents.error)
+    {
+        return contents;
+    }
+
+    std::size_t offset = 0;
+    while (offset < contents.data.size())
+    {
+        const std::size_t bytesRead =
+            file.read_at(offset, contents.data.data() + offset, contents.data.size() - offset, contents.error);
+        if (contents.error)
+        {
+            contents.data.clear();
+            return contents;
+        }
+        if (bytesRead == 0)
+        {
+            // The file got shorter since we looked up its size.
+            break;
+        }
+        offset += bytesRead;
+    }
+
+    contents.data.resize(offset);
+    return contents;
+}
+}  // namespace cb
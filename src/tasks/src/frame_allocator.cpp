@@ -0,0 +1,340 @@
+#include <tasks/detail/frame_allocator.hpp>
+
+#include <tasks/config.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#include "spin_mutex.hpp"
+
+namespace
+{
+namespace local
+{
+// Frames are rounded up to a multiple of the granularity. Larger
+// frames than the biggest size class come from the global heap.
+constexpr std::size_t size_class_granularity = 64;
+constexpr std::size_t size_class_count = 32;
+
+// Frames above this many on a single free list go back to the global heap.
+constexpr std::uint32_t max_cached_frames_per_class = 256;
+
+// Number of frames freed on behalf of another thread that are collected
+// before they are handed back to that thread all at once.
+constexpr std::uint32_t remote_free_batch_size = 32;
+
+// See frame_allocator::heap_allocations(). Only touched on the way to the
+// global heap, which costs far more.
+std::atomic<std::uint64_t> heapAllocations{0};
+}  // namespace local
+}  // namespace
+
+namespace cppcoro
+{
+namespace detail
+{
+namespace
+{
+class frame_cache;
+
+// Every block starts with a header, the coroutine frame follows it.
+struct block_header
+{
+    // The cache the block belongs to, or nullptr for blocks that are
+    // too large for any size class.
+    frame_cache* owner;
+    std::uint32_t sizeClass;
+};
+
+// Keep the frame itself aligned like any other allocation from operator new.
+constexpr std::size_t header_size =
+    (sizeof(block_header) + __STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1) / __STDCPP_DEFAULT_NEW_ALIGNMENT__ *
+    __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+void* frame_of(block_header* block) noexcept { return reinterpret_cast<char*>(block) + header_size; }
+
+block_header* block_of(void* frame) noexcept
+{
+    return reinterpret_cast<block_header*>(static_cast<char*>(frame) - header_size);
+}
+
+// While a block is free, the start of its frame holds the next free block.
+block_header*& next_of(block_header* block) noexcept { return *static_cast<block_header**>(frame_of(block)); }
+
+std::size_t block_size(std::uint32_t sizeClass) noexcept
+{
+    return header_size + (sizeClass + 1) * local::size_class_granularity;
+}
+
+/// Free lists of a single thread.
+///
+/// Owned by exactly one thread at a time, other threads only ever push to
+/// m_remoteFrees.
+class frame_cache
+{
+   public:
+    void* allocate(std::uint32_t sizeClass)
+    {
+        auto& list = m_freeLists[sizeClass];
+        if (list.head == nullptr)
+        {
+            collect_remote_frees();
+        }
+
+        block_header* block = list.head;
+        if (block != nullptr)
+        {
+            list.head = next_of(block);
+            --list.size;
+        }
+        else
+        {
+            local::heapAllocations.fetch_add(1, std::memory_order_relaxed);
+            block = static_cast<block_header*>(::operator new(block_size(sizeClass)));
+            block->owner = this;
+            block->sizeClass = sizeClass;
+        }
+        return frame_of(block);
+    }
+
+    /// Free a block that belongs to this cache.
+    void deallocate_local(block_header* block) noexcept
+    {
+        auto& list = m_freeLists[block->sizeClass];
+        if (list.size < local::max_cached_frames_per_class)
+        {
+            next_of(block) = list.head;
+            list.head = block;
+            ++list.size;
+        }
+        else
+        {
+            ::operator delete(block);
+        }
+    }
+
+    /// Free a block that belongs to another cache. The block is held back
+    /// until a whole batch for the same cache has been collected.
+    void deallocate_remote(block_header* block) noexcept
+    {
+        if (block->owner != m_batchOwner)
+        {
+            flush_remote_batch();
+            m_batchOwner = block->owner;
+            m_batchTail = block;
+        }
+
+        next_of(block) = m_batchHead;
+        m_batchHead = block;
+        if (++m_batchSize == local::remote_free_batch_size)
+        {
+            flush_remote_batch();
+        }
+    }
+
+    /// Hand the collected batch of blocks back to the cache they belong to.
+    void flush_remote_batch() noexcept
+    {
+        if (m_batchHead != nullptr)
+        {
+            m_batchOwner->push_remote_frees(m_batchHead, m_batchTail);
+            m_batchOwner = nullptr;
+            m_batchHead = nullptr;
+            m_batchTail = nullptr;
+            m_batchSize = 0;
+        }
+    }
+
+    /// Return a chain of blocks, linked through next_of(), to this cache.
+    /// May be called from any thread.
+    void push_remote_frees(block_header* head, block_header* tail) noexcept
+    {
+        // Only the owning thread ever takes blocks off this list and always
+        // takes all of them at once, so there is no ABA problem here.
+        block_header* oldHead = m_remoteFrees.load(std::memory_order_relaxed);
+        do
+        {
+            next_of(tail) = oldHead;
+        } while (!m_remoteFrees.compare_exchange_weak(oldHead, head, std::memory_order_release,
+                                                      std::memory_order_relaxed));
+    }
+
+    frame_cache* m_nextOrphan = nullptr;
+
+   private:
+    void collect_remote_frees() noexcept
+    {
+        // Cheap check first to avoid dirtying the cache line when there is nothing to take.
+        if (m_remoteFrees.load(std::memory_order_relaxed) == nullptr)
+        {
+            return;
+        }
+
+        block_header* block = m_remoteFrees.exchange(nullptr, std::memory_order_acquire);
+        while (block != nullptr)
+        {
+            block_header* next = next_of(block);
+            deallocate_local(block);
+            block = next;
+        }
+    }
+
+    struct free_list
+    {
+        block_header* head = nullptr;
+        std::uint32_t size = 0;
+    };
+
+    free_list m_freeLists[local::size_class_count];
+
+    // Blocks of another cache freed by this thread, waiting to be handed back.
+    frame_cache* m_batchOwner = nullptr;
+    block_header* m_batchHead = nullptr;
+    block_header* m_batchTail = nullptr;
+    std::uint32_t m_batchSize = 0;
+
+#if CORO_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4324)  // structure was padded due to alignment specifier
+#endif
+
+    // Blocks of this cache freed by other threads.
+    alignas(64) std::atomic<block_header*> m_remoteFrees{nullptr};
+
+#if CORO_COMPILER_MSVC
+#pragma warning(pop)
+#endif
+};
+
+// Caches of threads that have exited, along with any frames still on their
+// free lists. Frames they handed out may still be in use and freed later, so
+// caches are never destroyed. Instead the next thread to start takes one over.
+struct orphaned_caches
+{
+    spin_mutex mutex;
+    frame_cache* head = nullptr;
+};
+
+orphaned_caches& orphans() noexcept
+{
+    static orphaned_caches caches;
+    return caches;
+}
+
+thread_local frame_cache* t_cache = nullptr;
+thread_local bool t_cacheReleased = false;
+
+struct thread_cache_releaser
+{
+    ~thread_cache_releaser()
+    {
+        t_cacheReleased = true;
+        if (t_cache == nullptr)
+        {
+            return;
+        }
+
+        t_cache->flush_remote_batch();
+
+        auto& caches = orphans();
+        std::lock_guard lock{caches.mutex};
+        t_cache->m_nextOrphan = caches.head;
+        caches.head = t_cache;
+        t_cache = nullptr;
+    }
+};
+
+thread_local thread_cache_releaser t_releaser;
+
+/// Get the calling thread's cache, creating it on first use.
+///
+/// \return
+/// nullptr if the thread is exiting and has already released its cache,
+/// or if a new cache could not be allocated.
+frame_cache* current_cache() noexcept
+{
+    frame_cache* cache = t_cache;
+    if (cache != nullptr || t_cacheReleased)
+    {
+        return cache;
+    }
+
+    {
+        auto& caches = orphans();
+        std::lock_guard lock{caches.mutex};
+        cache = caches.head;
+        if (cache != nullptr)
+        {
+            caches.head = cache->m_nextOrphan;
+            cache->m_nextOrphan = nullptr;
+        }
+    }
+
+    if (cache == nullptr)
+    {
+        cache = new (std::nothrow) frame_cache;
+        if (cache == nullptr)
+        {
+            return nullptr;
+        }
+    }
+
+    // Odr-using the releaser registers its destructor for this thread.
+    static_cast<void>(&t_releaser);
+    t_cache = cache;
+    return cache;
+}
+}  // namespace
+
+void* frame_allocator::allocate(std::size_t size)
+{
+    const std::size_t sizeClass = size == 0 ? 0 : (size - 1) / local::size_class_granularity;
+    if (sizeClass < local::size_class_count)
+    {
+        frame_cache* cache = current_cache();
+        if (cache != nullptr)
+        {
+            return cache->allocate(static_cast<std::uint32_t>(sizeClass));
+        }
+    }
+
+    local::heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    auto* block = static_cast<block_header*>(::operator new(header_size + size));
+    block->owner = nullptr;
+    block->sizeClass = 0;
+    return frame_of(block);
+}
+
+void frame_allocator::deallocate(void* frame) noexcept
+{
+    block_header* block = block_of(frame);
+    frame_cache* owner = block->owner;
+    if (owner == nullptr)
+    {
+        ::operator delete(block);
+        return;
+    }
+
+    frame_cache* cache = current_cache();
+    if (cache == owner)
+    {
+        cache->deallocate_local(block);
+    }
+    else if (cache != nullptr)
+    {
+        cache->deallocate_remote(block);
+    }
+    else
+    {
+        owner->push_remote_frees(block, block);
+    }
+}
+
+std::uint64_t frame_allocator::heap_allocations() noexcept
+{
+    return local::heapAllocations.load(std::memory_order_relaxed);
+}
+}  // namespace detail
+}  // namespace cppcoro
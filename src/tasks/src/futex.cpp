@@ -0,0 +1,111 @@
+#include "futex.hpp"
+
+#include <tasks/config.h>
+
+#include <climits>
+
+#if CORO_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#elif CORO_WINDOWS
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <algorithm>
+#include <thread>
+#endif
+
+namespace cppcoro
+{
+namespace detail
+{
+#if CORO_LINUX
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t) &&
+                  std::atomic<std::uint32_t>::is_always_lock_free,
+              "futex requires std::atomic<std::uint32_t> to have the layout of a plain 32-bit word");
+
+namespace
+{
+long futex(std::atomic<std::uint32_t>& word, int op, std::uint32_t value,
+           const ::timespec* timeout = nullptr) noexcept
+{
+    // All waiters are in this process, so the cheaper private futex ops can be used.
+    return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), op | FUTEX_PRIVATE_FLAG, value, timeout,
+                     nullptr, 0);
+}
+}  // namespace
+
+void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) noexcept
+{
+    // EAGAIN (value already changed) and EINTR are both just early returns.
+    futex(word, FUTEX_WAIT, expected);
+}
+
+void futex_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+                    std::chrono::nanoseconds timeout) noexcept
+{
+    if (timeout <= std::chrono::nanoseconds::zero())
+    {
+        return;
+    }
+
+    // FUTEX_WAIT takes a relative timeout. ETIMEDOUT is just another early return.
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    ::timespec ts;
+    ts.tv_sec = static_cast<::time_t>(seconds.count());
+    ts.tv_nsec = static_cast<long>((timeout - seconds).count());
+    futex(word, FUTEX_WAIT, expected, &ts);
+}
+
+void futex_wake(std::atomic<std::uint32_t>& word, std::uint32_t count) noexcept
+{
+    futex(word, FUTEX_WAKE, count < INT_MAX ? count : INT_MAX);
+}
+
+void futex_wake_all(std::atomic<std::uint32_t>& word) noexcept { futex(word, FUTEX_WAKE, INT_MAX); }
+
+#else
+
+void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) noexcept { word.wait(expected); }
+
+void futex_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+                    std::chrono::nanoseconds timeout) noexcept
+{
+    if (timeout <= std::chrono::nanoseconds::zero())
+    {
+        return;
+    }
+
+#if CORO_WINDOWS
+    // Round up so that we don't wake up just before the deadline and have to wait again.
+    const auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+    ::WaitOnAddress(&word, &expected, sizeof(expected),
+                    ms < INFINITE ? static_cast<::DWORD>(ms) : INFINITE - 1);
+#else
+    // std::atomic::wait can't time out, so poll in slices short enough
+    // that a wake-up is only noticed a little late.
+    if (word.load(std::memory_order_acquire) == expected)
+    {
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::milliseconds(1)));
+    }
+#endif
+}
+
+void futex_wake(std::atomic<std::uint32_t>& word, std::uint32_t count) noexcept
+{
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        word.notify_one();
+    }
+}
+
+void futex_wake_all(std::atomic<std::uint32_t>& word) noexcept { word.notify_all(); }
+
+#endif
+}  // namespace detail
+}  // namespace cppcoro
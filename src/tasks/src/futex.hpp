@@ -0,0 +1,36 @@
+#ifndef CPPCORO_FUTEX_HPP_INCLUDED
+#define CPPCORO_FUTEX_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace cppcoro
+{
+namespace detail
+{
+/// Block the calling thread while \p word still holds \p expected.
+///
+/// The check and the block are atomic with respect to futex_wake() so a
+/// wake that follows a change to \p word can't be missed. May return
+/// spuriously, callers must re-check their condition.
+///
+/// Uses the futex syscall directly on Linux and std::atomic::wait elsewhere.
+void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) noexcept;
+
+/// As futex_wait(), but give up after \p timeout.
+///
+/// Returns early on spurious wake-ups as well, callers must re-check both
+/// their condition and the time.
+void futex_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+                    std::chrono::nanoseconds timeout) noexcept;
+
+/// Wake up to \p count threads blocked in futex_wait() on \p word.
+void futex_wake(std::atomic<std::uint32_t>& word, std::uint32_t count) noexcept;
+
+/// Wake all threads blocked in futex_wait() on \p word.
+void futex_wake_all(std::atomic<std::uint32_t>& word) noexcept;
+}  // namespace detail
+}  // namespace cppcoro
+
+#endif
@@ -0,0 +1,264 @@
+#include "io_uring_queue.hpp"
+
+#if CORO_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#endif
+
+namespace cppcoro
+{
+namespace detail
+{
+#if CORO_IO_URING
+
+namespace
+{
+int io_uring_setup(std::uint32_t entries, ::io_uring_params* params) noexcept
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, std::uint32_t toSubmit, std::uint32_t minComplete, std::uint32_t flags) noexcept
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+bool supports_read(int fd) noexcept
+{
+    // Kernels from before IORING_REGISTER_PROBE (5.6) don't have IORING_OP_READ either.
+    constexpr std::size_t opCount = 256;
+    alignas(::io_uring_probe) unsigned char storage[sizeof(::io_uring_probe) + opCount * sizeof(::io_uring_probe_op)];
+    std::memset(storage, 0, sizeof(storage));
+    auto* probe = reinterpret_cast<::io_uring_probe*>(storage);
+
+    if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, opCount) < 0)
+    {
+        return false;
+    }
+    return probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+}
+
+void* map_ring(int fd, std::size_t size, std::uint64_t offset) noexcept
+{
+    void* address =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, static_cast<::off_t>(offset));
+    return address == MAP_FAILED ? nullptr : address;
+}
+
+template <typename T>
+T* at_offset(void* base, std::uint32_t offset) noexcept
+{
+    return reinterpret_cast<T*>(static_cast<unsigned char*>(base) + offset);
+}
+
+// The ring indices are shared with the kernel, which reads and writes them concurrently.
+std::uint32_t load_acquire(std::uint32_t* index) noexcept
+{
+    return std::atomic_ref<std::uint32_t>{*index}.load(std::memory_order_acquire);
+}
+
+void store_release(std::uint32_t* index, std::uint32_t value) noexcept
+{
+    std::atomic_ref<std::uint32_t>{*index}.store(value, std::memory_order_release);
+}
+}  // namespace
+
+std::unique_ptr<io_uring_queue> io_uring_queue::create(std::uint32_t entries) noexcept
+{
+    ::io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    std::unique_ptr<io_uring_queue> queue{new (std::nothrow) io_uring_queue()};
+    if (queue == nullptr)
+    {
+        return nullptr;
+    }
+
+    queue->m_fd = io_uring_setup(entries, &params);
+    if (queue->m_fd < 0 || !supports_read(queue->m_fd))
+    {
+        return nullptr;
+    }
+
+    const std::size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(std::uint32_t);
+    const std::size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe);
+
+    // Since 5.4 both rings live in a single mapping.
+    void* cqBase = nullptr;
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+    {
+        const std::size_t size = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+        queue->m_sqRing = {map_ring(queue->m_fd, size, IORING_OFF_SQ_RING), size};
+        cqBase = queue->m_sqRing.address;
+    }
+    else
+    {
+        queue->m_sqRing = {map_ring(queue->m_fd, sqRingSize, IORING_OFF_SQ_RING), sqRingSize};
+        queue->m_cqRing = {map_ring(queue->m_fd, cqRingSize, IORING_OFF_CQ_RING), cqRingSize};
+        cqBase = queue->m_cqRing.address;
+    }
+
+    const std::size_t sqeArraySize = params.sq_entries * sizeof(::io_uring_sqe);
+    queue->m_sqeArray = {map_ring(queue->m_fd, sqeArraySize, IORING_OFF_SQES), sqeArraySize};
+
+    if (queue->m_sqRing.address == nullptr || cqBase == nullptr || queue->m_sqeArray.address == nullptr)
+    {
+        return nullptr;
+    }
+
+    void* sqBase = queue->m_sqRing.address;
+    queue->m_sqEntries = params.sq_entries;
+    queue->m_sqMask = *at_offset<std::uint32_t>(sqBase, params.sq_off.ring_mask);
+    queue->m_sqHead = at_offset<std::uint32_t>(sqBase, params.sq_off.head);
+    queue->m_sqTail = at_offset<std::uint32_t>(sqBase, params.sq_off.tail);
+    queue->m_sqIndices = at_offset<std::uint32_t>(sqBase, params.sq_off.array);
+    queue->m_sqes = static_cast<::io_uring_sqe*>(queue->m_sqeArray.address);
+
+    queue->m_cqMask = *at_offset<std::uint32_t>(cqBase, params.cq_off.ring_mask);
+    queue->m_cqHead = at_offset<std::uint32_t>(cqBase, params.cq_off.head);
+    queue->m_cqTail = at_offset<std::uint32_t>(cqBase, params.cq_off.tail);
+    queue->m_cqes = at_offset<::io_uring_cqe>(cqBase, params.cq_off.cqes);
+
+    return queue;
+}
+
+io_uring_queue::~io_uring_queue()
+{
+    for (auto* mapping : {&m_sqeArray, &m_cqRing, &m_sqRing})
+    {
+        if (mapping->address != nullptr)
+        {
+            ::munmap(mapping->address, mapping->size);
+        }
+    }
+
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+}
+
+bool io_uring_queue::prepare_read(int fd, std::uint64_t offset, void* buffer, std::uint32_t size,
+                                  std::uint64_t userData) noexcept
+{
+    auto* sqe = next_sqe();
+    if (sqe == nullptr)
+    {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+    sqe->len = size;
+    sqe->user_data = userData;
+
+    // Only now can the kernel see the entry.
+    store_release(m_sqTail, *m_sqTail + 1);
+    return true;
+}
+
+bool io_uring_queue::prepare_nop(std::uint64_t userData) noexcept
+{
+    auto* sqe = next_sqe();
+    if (sqe == nullptr)
+    {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = userData;
+
+    store_release(m_sqTail, *m_sqTail + 1);
+    return true;
+}
+
+io_uring_sqe* io_uring_queue::next_sqe() noexcept
+{
+    // Only this side writes the tail, so it can be read without synchronisation.
+    const std::uint32_t tail = *m_sqTail;
+    if (tail - load_acquire(m_sqHead) == m_sqEntries)
+    {
+        return nullptr;
+    }
+
+    const std::uint32_t index = tail & m_sqMask;
+    m_sqIndices[index] = index;
+
+    auto* sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+std::uint32_t io_uring_queue::unsubmitted() const noexcept
+{
+    // The kernel moves the head as it takes entries, and another thread may
+    // be moving the tail. Read the head first so that it can't pass the tail.
+    // Missing entries queued since is fine, whoever queued them submits them.
+    const std::uint32_t head = load_acquire(m_sqHead);
+    return load_acquire(m_sqTail) - head;
+}
+
+void io_uring_queue::submit() noexcept
+{
+    // The kernel takes no more than are queued, so racing submit() calls are harmless.
+    for (std::uint32_t count = unsubmitted(); count > 0; count = unsubmitted())
+    {
+        const int submitted = io_uring_enter(m_fd, count, 0, 0);
+        if (submitted < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (submitted <= 0)
+        {
+            // EAGAIN or EBUSY: the kernel is short of memory or has completions it couldn't post.
+            // The entries stay queued and the next call hands them over.
+            return;
+        }
+    }
+}
+
+void io_uring_queue::wait_for_completion() noexcept
+{
+    // EINTR is just an early return, and so is failing to hand over the
+    // queued entries, which the caller retries by calling this again.
+    io_uring_enter(m_fd, unsubmitted(), 1, IORING_ENTER_GETEVENTS);
+}
+
+bool io_uring_queue::try_pop_completion(std::uint64_t& userData, std::int32_t& result) noexcept
+{
+    const std::uint32_t head = *m_cqHead;
+    if (head == load_acquire(m_cqTail))
+    {
+        return false;
+    }
+
+    const auto& cqe = m_cqes[head & m_cqMask];
+    userData = cqe.user_data;
+    result = cqe.res;
+
+    // Hands the entry back to the kernel.
+    store_release(m_cqHead, head + 1);
+    return true;
+}
+
+#else
+
+std::unique_ptr<io_uring_queue> io_uring_queue::create(std::uint32_t) noexcept
+{
+    return nullptr;
+}
+
+io_uring_queue::~io_uring_queue() = default;
+
+#endif
+}  // namespace detail
+}  // namespace cppcoro
@@ -0,0 +1,107 @@
+#ifndef CPPCORO_IO_URING_QUEUE_HPP_INCLUDED
+#define CPPCORO_IO_URING_QUEUE_HPP_INCLUDED
+
+#include <tasks/config.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#if CORO_LINUX && __has_include(<linux/io_uring.h>)
+#define CORO_IO_URING 1
+#else
+#define CORO_IO_URING 0
+#endif
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace cppcoro
+{
+namespace detail
+{
+/// A Linux io_uring instance, set up and driven through the raw system
+/// calls so that there is no dependency on liburing.
+///
+/// The prepare_*() calls must be serialised by the caller. submit() may be
+/// called from any thread, at the same time as them, and the completion
+/// side may be used from one other thread at once.
+class io_uring_queue
+{
+   public:
+    /// Set up a ring with room for \p entries submissions.
+    ///
+    /// \return
+    /// nullptr if io_uring isn't available, because the kernel is too old
+    /// to support IORING_OP_READ or because the system call is blocked.
+    static std::unique_ptr<io_uring_queue> create(std::uint32_t entries) noexcept;
+
+    ~io_uring_queue();
+
+    io_uring_queue(const io_uring_queue&) = delete;
+    io_uring_queue& operator=(const io_uring_queue&) = delete;
+
+    /// The number of operations that may be in flight at once. Any more
+    /// than this could overflow the completion queue.
+    std::uint32_t capacity() const noexcept { return m_sqEntries; }
+
+    /// Queue a read of up to \p size bytes at \p offset for the next submit().
+    ///
+    /// \return
+    /// false if the submission queue is full.
+    bool prepare_read(int fd, std::uint64_t offset, void* buffer, std::uint32_t size, std::uint64_t userData) noexcept;
+
+    /// Queue an operation that does nothing but complete with \p userData.
+    bool prepare_nop(std::uint64_t userData) noexcept;
+
+    /// Hand the queued operations to the kernel. Any it doesn't take right
+    /// now, because it is short of memory, are handed over by the next call
+    /// to this or to wait_for_completion().
+    void submit() noexcept;
+
+    /// Block until there is at least one completion to pop. May return early.
+    ///
+    /// Hands over the operations submit() left queued first, so they can't
+    /// be stranded with nothing in flight to wake this up again.
+    void wait_for_completion() noexcept;
+
+    /// \param result
+    /// What the operation returned: the number of bytes read, or a negated errno value.
+    bool try_pop_completion(std::uint64_t& userData, std::int32_t& result) noexcept;
+
+   private:
+    io_uring_queue() noexcept = default;
+
+    struct ring_mapping
+    {
+        void* address = nullptr;
+        std::size_t size = 0;
+    };
+
+    io_uring_sqe* next_sqe() noexcept;
+
+    /// Queued by prepare_*() but not taken by the kernel yet.
+    std::uint32_t unsubmitted() const noexcept;
+
+    int m_fd = -1;
+
+    ring_mapping m_sqRing;
+    ring_mapping m_cqRing;
+    ring_mapping m_sqeArray;
+
+    std::uint32_t m_sqEntries = 0;
+    std::uint32_t m_sqMask = 0;
+    std::uint32_t* m_sqHead = nullptr;
+    std::uint32_t* m_sqTail = nullptr;
+    std::uint32_t* m_sqIndices = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+
+    std::uint32_t m_cqMask = 0;
+    std::uint32_t* m_cqHead = nullptr;
+    std::uint32_t* m_cqTail = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+};
+}  // namespace detail
+}  // namespace cppcoro
+
+#endif
@@ -0,0 +1,393 @@
+#ifndef CPPCORO_MPMC_QUEUE_HPP_INCLUDED
+#define CPPCORO_MPMC_QUEUE_HPP_INCLUDED
+
+#include <tasks/config.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "spin_wait.hpp"
+
+namespace cppcoro
+{
+/// An unbounded, lock-free, multi-producer/multi-consumer FIFO queue of pointers.
+///
+/// Items are stored in a linked list of fixed-size blocks. Producers claim a
+/// slot by advancing the tail index with a CAS and consumers claim a slot by
+/// advancing the head index with a CAS. A block pointer is only dereferenced
+/// after the CAS for one of its slots has succeeded, and a block is only freed
+/// once every slot in it has been read, so no hazard pointers or epochs are
+/// needed. The indices only ever increase which rules out ABA.
+///
+/// This follows the design of the segmented injector queue used by
+/// crossbeam-deque.
+template <typename T>
+class mpmc_queue
+{
+    static_assert(std::is_pointer_v<T>, "mpmc_queue can only hold pointers");
+
+   public:
+    mpmc_queue()
+        : m_headIndex(0), m_headBlock(new block), m_tailIndex(0), m_spareBlock(nullptr)
+    {
+        m_tailBlock.store(m_headBlock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    mpmc_queue(const mpmc_queue&) = delete;
+    mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+    ~mpmc_queue()
+    {
+        // The queue doesn't own the items, we only need to free the blocks.
+        std::size_t head = m_headIndex.load(std::memory_order_relaxed) & ~has_next;
+        const std::size_t tail = m_tailIndex.load(std::memory_order_relaxed) & ~has_next;
+        block* b = m_headBlock.load(std::memory_order_relaxed);
+        while (head != tail)
+        {
+            if (((head >> shift) % lap) == block_capacity)
+            {
+                block* next = b->next.load(std::memory_order_relaxed);
+                delete b;
+                b = next;
+            }
+            head += std::size_t{1} << shift;
+        }
+        delete b;
+        delete m_spareBlock.load(std::memory_order_relaxed);
+    }
+
+    /// Append an item to the tail of the queue.
+    ///
+    /// May be called concurrently from any number of threads.
+    void push(T item) noexcept
+    {
+        spin_wait wait;
+        std::size_t tail = m_tailIndex.load(std::memory_order_acquire);
+        block* b = m_tailBlock.load(std::memory_order_acquire);
+        block* nextBlock = nullptr;
+
+        while (true)
+        {
+            const std::size_t offset = (tail >> shift) % lap;
+            if (offset == block_capacity)
+            {
+                // Another producer filled the last slot of the block and is
+                // installing the next one. Wait for it to finish.
+                wait.spin_one();
+                tail = m_tailIndex.load(std::memory_order_acquire);
+                b = m_tailBlock.load(std::memory_order_acquire);
+                continue;
+            }
+
+            // If we're about to fill the block, allocate the next one up-front
+            // so we don't hold up other producers while allocating.
+            if (offset + 1 == block_capacity && nextBlock == nullptr)
+            {
+                nextBlock = allocate_block();
+            }
+
+            // Use seq-cst memory order so that the enqueue is ordered before any
+            // subsequent check of whether there are sleeping threads to wake up.
+            const std::size_t newTail = tail + (std::size_t{1} << shift);
+            if (m_tailIndex.compare_exchange_weak(tail, newTail, std::memory_order_seq_cst, std::memory_order_acquire))
+            {
+                if (offset + 1 == block_capacity)
+                {
+                    // We claimed the last slot, move the tail on to the next block.
+                    m_tailBlock.store(nextBlock, std::memory_order_release);
+                    m_tailIndex.store(newTail + (std::size_t{1} << shift), std::memory_order_release);
+                    b->next.store(nextBlock, std::memory_order_release);
+                    nextBlock = nullptr;
+                }
+
+                slot& s = b->slots[offset];
+                s.item = item;
+                s.state.fetch_or(slot_written, std::memory_order_release);
+
+                if (nextBlock != nullptr)
+                {
+                    // Someone else installed the next block while we were allocating.
+                    free_block(nextBlock);
+                }
+                return;
+            }
+
+            b = m_tailBlock.load(std::memory_order_acquire);
+        }
+    }
+
+    /// Append \p count items to the tail of the queue, claiming as many slots
+    /// as will fit in the tail block with each CAS.
+    ///
+    /// The items come from calling \p next once per item, in order. It is
+    /// called just before each item is published to consumers, so it may read
+    /// the item's link to the following item.
+    ///
+    /// May be called concurrently from any number of threads.
+    template <typename Generator>
+    void push_bulk(std::size_t count, Generator&& next) noexcept
+    {
+        spin_wait wait;
+        std::size_t tail = m_tailIndex.load(std::memory_order_acquire);
+        block* b = m_tailBlock.load(std::memory_order_acquire);
+        block* nextBlock = nullptr;
+
+        while (count > 0)
+        {
+            const std::size_t offset = (tail >> shift) % lap;
+            if (offset == block_capacity)
+            {
+                // Another producer filled the last slot of the block and is
+                // installing the next one. Wait for it to finish.
+                wait.spin_one();
+                tail = m_tailIndex.load(std::memory_order_acquire);
+                b = m_tailBlock.load(std::memory_order_acquire);
+                continue;
+            }
+
+            const std::size_t claimCount = std::min(count, block_capacity - offset);
+            const bool fillsBlock = offset + claimCount == block_capacity;
+            if (fillsBlock && nextBlock == nullptr)
+            {
+                nextBlock = allocate_block();
+            }
+
+            // Use seq-cst memory order so that the enqueue is ordered before any
+            // subsequent check of whether there are sleeping threads to wake up.
+            const std::size_t newTail = tail + (claimCount << shift);
+            if (!m_tailIndex.compare_exchange_weak(tail, newTail, std::memory_order_seq_cst, std::memory_order_acquire))
+            {
+                b = m_tailBlock.load(std::memory_order_acquire);
+                continue;
+            }
+
+            if (fillsBlock)
+            {
+                // We claimed the last slot, move the tail on to the next block.
+                m_tailBlock.store(nextBlock, std::memory_order_release);
+                m_tailIndex.store(newTail + (std::size_t{1} << shift), std::memory_order_release);
+                b->next.store(nextBlock, std::memory_order_release);
+                nextBlock = nullptr;
+            }
+
+            for (std::size_t i = 0; i < claimCount; ++i)
+            {
+                slot& s = b->slots[offset + i];
+                s.item = next();
+                s.state.fetch_or(slot_written, std::memory_order_release);
+            }
+
+            count -= claimCount;
+            tail = m_tailIndex.load(std::memory_order_acquire);
+            b = m_tailBlock.load(std::memory_order_acquire);
+        }
+
+        if (nextBlock != nullptr)
+        {
+            // Someone else installed the next block while we were allocating.
+            free_block(nextBlock);
+        }
+    }
+
+    /// Remove the item at the head of the queue.
+    ///
+    /// May be called concurrently from any number of threads.
+    ///
+    /// \return
+    /// The item, or nullptr if the queue was empty.
+    T try_pop() noexcept
+    {
+        spin_wait wait;
+        while (true)
+        {
+            std::size_t head = m_headIndex.load(std::memory_order_acquire);
+            block* b = m_headBlock.load(std::memory_order_acquire);
+            const std::size_t offset = (head >> shift) % lap;
+            if (offset == block_capacity)
+            {
+                // Another consumer is moving the head on to the next block.
+                wait.spin_one();
+                continue;
+            }
+
+            std::size_t newHead = head + (std::size_t{1} << shift);
+            if ((newHead & has_next) == 0)
+            {
+                // We don't know yet whether there is a block after this one,
+                // check the tail to see if the queue is empty.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                const std::size_t tail = m_tailIndex.load(std::memory_order_relaxed);
+                if ((head >> shift) == (tail >> shift))
+                {
+                    return nullptr;
+                }
+
+                if ((head >> shift) / lap != (tail >> shift) / lap)
+                {
+                    newHead |= has_next;
+                }
+            }
+
+            if (!m_headIndex.compare_exchange_weak(head, newHead, std::memory_order_seq_cst,
+                                                   std::memory_order_acquire))
+            {
+                // Another consumer claimed the slot first.
+                continue;
+            }
+
+            if (offset + 1 == block_capacity)
+            {
+                // We claimed the last slot, move the head on to the next block.
+                block* next = b->wait_next();
+                std::size_t nextIndex = (newHead & ~has_next) + (std::size_t{1} << shift);
+                if (next->next.load(std::memory_order_relaxed) != nullptr)
+                {
+                    nextIndex |= has_next;
+                }
+                m_headBlock.store(next, std::memory_order_release);
+                m_headIndex.store(nextIndex, std::memory_order_release);
+            }
+
+            slot& s = b->slots[offset];
+            s.wait_written();
+            T item = s.item;
+
+            // Free the block if this was its last slot, or if whoever read the
+            // last slot wanted to free it but couldn't because we were still
+            // reading from this one.
+            if (offset + 1 == block_capacity ||
+                (s.state.fetch_or(slot_read, std::memory_order_acq_rel) & slot_destroy) != 0)
+            {
+                destroy_block(b, offset);
+            }
+
+            return item;
+        }
+    }
+
+    /// Query whether the queue is empty.
+    ///
+    /// This is only a snapshot and may be out of date by the time it returns.
+    bool empty(std::memory_order order = std::memory_order_relaxed) const noexcept
+    {
+        const std::size_t head = m_headIndex.load(order);
+        const std::size_t tail = m_tailIndex.load(order);
+        return (head >> shift) == (tail >> shift);
+    }
+
+   private:
+    // Each lap of the index space covers one block. The last index of a lap
+    // does not map to a slot and marks that the next block is being installed.
+    static constexpr std::size_t lap = 64;
+    static constexpr std::size_t block_capacity = lap - 1;
+
+    // The lowest bit of the head index is used to flag that the head block
+    // is known to have a successor, which saves consumers reading the tail.
+    static constexpr std::size_t shift = 1;
+    static constexpr std::size_t has_next = 1;
+
+    static constexpr std::uint32_t slot_written = 1;
+    static constexpr std::uint32_t slot_read = 2;
+    static constexpr std::uint32_t slot_destroy = 4;
+
+    struct slot
+    {
+        T item = nullptr;
+        std::atomic<std::uint32_t> state = 0;
+
+        void wait_written() const noexcept
+        {
+            // The producer has claimed the slot but might not have written to it yet.
+            spin_wait wait;
+            while ((state.load(std::memory_order_acquire) & slot_written) == 0)
+            {
+                wait.spin_one();
+            }
+        }
+    };
+
+    struct block
+    {
+        std::atomic<block*> next = nullptr;
+        slot slots[block_capacity];
+
+        block* wait_next() const noexcept
+        {
+            spin_wait wait;
+            while (true)
+            {
+                block* result = next.load(std::memory_order_acquire);
+                if (result != nullptr)
+                {
+                    return result;
+                }
+                wait.spin_one();
+            }
+        }
+    };
+
+    block* allocate_block() noexcept
+    {
+        // Reuse the last freed block if there is one to avoid hitting the
+        // allocator once per block under a steady stream of work.
+        block* spare = m_spareBlock.exchange(nullptr, std::memory_order_acquire);
+        return spare != nullptr ? spare : new block;
+    }
+
+    void free_block(block* b) noexcept
+    {
+        b->next.store(nullptr, std::memory_order_relaxed);
+        for (auto& s : b->slots)
+        {
+            s.state.store(0, std::memory_order_relaxed);
+        }
+
+        block* expected = nullptr;
+        if (!m_spareBlock.compare_exchange_strong(expected, b, std::memory_order_release, std::memory_order_relaxed))
+        {
+            delete b;
+        }
+    }
+
+    /// Free the block once the first \p count slots have been read.
+    void destroy_block(block* b, std::size_t count) noexcept
+    {
+        // The slot at 'count' has been read by the caller. Walk the earlier
+        // slots and hand responsibility for freeing the block to the first
+        // reader we find that has not finished yet.
+        for (std::size_t i = count; i-- > 0;)
+        {
+            slot& s = b->slots[i];
+            if ((s.state.load(std::memory_order_acquire) & slot_read) == 0 &&
+                (s.state.fetch_or(slot_destroy, std::memory_order_acq_rel) & slot_read) == 0)
+            {
+                return;
+            }
+        }
+
+        free_block(b);
+    }
+
+#if CORO_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4324)  // structure was padded due to alignment specifier
+#endif
+
+    alignas(64) std::atomic<std::size_t> m_headIndex;
+    std::atomic<block*> m_headBlock;
+
+    alignas(64) std::atomic<std::size_t> m_tailIndex;
+    std::atomic<block*> m_tailBlock;
+
+    alignas(64) std::atomic<block*> m_spareBlock;
+
+#if CORO_COMPILER_MSVC
+#pragma warning(pop)
+#endif
+};
+}  // namespace cppcoro
+
+#endif
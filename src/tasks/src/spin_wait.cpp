@@ -24,14 +24,16 @@ constexpr std::uint32_t yield_threshold = 10;
 
 namespace cppcoro
 {
-spin_wait::spin_wait() noexcept { reset(); }
+spin_wait::spin_wait() noexcept : spin_wait(local::yield_threshold) {}
 
-bool spin_wait::next_spin_will_yield() const noexcept { return m_count >= local::yield_threshold; }
+spin_wait::spin_wait(std::uint32_t yieldThreshold) noexcept : m_yieldThreshold(yieldThreshold) { reset(); }
+
+bool spin_wait::next_spin_will_yield() const noexcept { return m_count >= m_yieldThreshold; }
 
 void spin_wait::reset() noexcept
 {
-    static const std::uint32_t initialCount = std::thread::hardware_concurrency() > 1 ? 0 : local::yield_threshold;
-    m_count = initialCount;
+    static const bool isSingleCore = std::thread::hardware_concurrency() <= 1;
+    m_count = isSingleCore ? m_yieldThreshold : 0;
 }
 
 void spin_wait::spin_one() noexcept
@@ -56,7 +58,7 @@ void spin_wait::spin_one() noexcept
     {
         // We've already spun a number of iterations.
         //
-        const auto yieldCount = m_count - local::yield_threshold;
+        const auto yieldCount = m_count - m_yieldThreshold;
         if (yieldCount % 20 == 19)
         {
             // Yield remainder of time slice to another thread and
@@ -88,7 +90,7 @@ void spin_wait::spin_one() noexcept
     {
         // Don't wrap around to zero as this would go back to
         // busy-waiting.
-        m_count = local::yield_threshold;
+        m_count = m_yieldThreshold;
     }
 }
 }  // namespace cppcoro
@@ -14,6 +14,10 @@ class spin_wait
    public:
     spin_wait() noexcept;
 
+    /// Busy-wait for \p yieldThreshold spins before yielding the thread
+    /// instead, rather than the default of 10.
+    explicit spin_wait(std::uint32_t yieldThreshold) noexcept;
+
     bool next_spin_will_yield() const noexcept;
 
     void spin_one() noexcept;
@@ -21,6 +25,7 @@ class spin_wait
     void reset() noexcept;
 
    private:
+    std::uint32_t m_yieldThreshold;
     std::uint32_t m_count;
 };
 }  // namespace cppcoro
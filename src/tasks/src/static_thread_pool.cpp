@@ -5,22 +5,154 @@
 
 #include <tasks/static_thread_pool.h>
 
+#include <tasks/detail/pool_join.hpp>
+#include <tasks/strand.h>
+#include <tasks/trace.h>
+
+#include <algorithm>
 #include <cassert>
-#include <chrono>
+#include <limits>
 #include <mutex>
-
-#include "auto_reset_event.hpp"
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "cpu_topology.hpp"
+#include "event_count.hpp"
+#include "futex.hpp"
+#include "mpmc_queue.hpp"
 #include "spin_mutex.hpp"
 #include "spin_wait.hpp"
+#include "timer_wheel.hpp"
+#include "work_stealing_deque.hpp"
 
 namespace
 {
 namespace local
 {
 // Keep each thread's local queue under 1MB
+// Both sizes need to be a power of two.
 constexpr std::size_t max_local_queue_size = 1024 * 1024 / sizeof(void*);
 constexpr std::size_t initial_local_queue_size = 256;
+
+// Max number of operations moved from the overflow queue back into
+// the local queue at once, where they can be stolen without a lock.
+constexpr std::size_t overflow_refill_batch_size = initial_local_queue_size / 2;
+
+// Max number of operations a thief takes from a single victim at once. It
+// takes up to half of the victim's queue, so that a single busy producer's
+// work spreads out over the idle workers in a few steals rather than one
+// steal per operation.
+constexpr std::size_t max_steal_batch_size = initial_local_queue_size / 4;
+
+// How often, in polls for work, each worker lets a lower priority go first.
+constexpr std::uint32_t starvation_interval = 16;
+
+constexpr std::uint32_t no_cpu = ~std::uint32_t{0};
+
+// How often, in operations run, a busy worker checks for expired timers.
+constexpr std::uint32_t timer_poll_interval = 16;
+
+constexpr std::chrono::steady_clock::rep no_timer = std::numeric_limits<std::chrono::steady_clock::rep>::max();
 }  // namespace local
+
+using spin_policy = cppcoro::static_thread_pool::spin_policy;
+using clock = cppcoro::static_thread_pool::clock;
+
+/// Tunes how many times an idle worker polls for new work before going to
+/// sleep, see spin_policy::adaptive. Only used by the owning worker.
+///
+/// Going to sleep is worth it when the next work is further off than it
+/// takes to wake a sleeping worker up, like a block-or-spin decision for a
+/// lock: spinning for about as long as blocking would cost is never more
+/// than twice as expensive as knowing when the work will arrive.
+class spin_tuner
+{
+   public:
+    void configure(const spin_policy& policy) noexcept
+    {
+        m_policy = policy;
+        m_spinCount = policy.spinCount;
+    }
+
+    std::uint32_t spin_count() const noexcept { return m_spinCount; }
+
+    std::chrono::nanoseconds wake_latency() const noexcept { return std::chrono::nanoseconds{m_wakeLatencyNs}; }
+
+    /// A round of \p polls that found no work took \p elapsed.
+    void on_spun(std::uint32_t polls, clock::duration elapsed) noexcept
+    {
+        if (polls == 0)
+        {
+            return;
+        }
+        const std::int64_t sample = std::max<std::int64_t>(1, to_ns(elapsed) / polls);
+        m_nsPerPoll = m_nsPerPoll == 0 ? sample : m_nsPerPoll + (sample - m_nsPerPoll) / 8;
+    }
+
+    /// Work turned up after \p polls, without going to sleep.
+    void on_work_while_spinning(std::uint32_t polls) noexcept
+    {
+        // Leave some slack so that a gap a little longer is caught as well.
+        move_towards(2 * static_cast<std::int64_t>(polls));
+    }
+
+    /// Work turned up \p idle after the worker ran out of it, after it had
+    /// gone to sleep. \p wakeToWork is how long it took from it being woken
+    /// up to getting to the work, if it was woken up for it.
+    void on_work_after_sleeping(clock::duration idle, std::optional<clock::duration> wakeToWork) noexcept
+    {
+        if (wakeToWork)
+        {
+            const std::int64_t sample = std::max<std::int64_t>(1, to_ns(*wakeToWork));
+            m_wakeLatencyNs = m_wakeLatencyNs == 0 ? sample : m_wakeLatencyNs + (sample - m_wakeLatencyNs) / 8;
+        }
+
+        if (m_wakeLatencyNs == 0 || m_nsPerPoll == 0)
+        {
+            return;
+        }
+
+        const std::int64_t idleNs = to_ns(idle);
+        if (idleNs <= 2 * m_wakeLatencyNs)
+        {
+            // Would have been cheaper to keep polling until the work came.
+            move_towards(idleNs / m_nsPerPoll + 1);
+        }
+        else
+        {
+            // Any polling was wasted.
+            move_towards(m_policy.minSpinCount);
+        }
+    }
+
+   private:
+    static std::int64_t to_ns(clock::duration d) noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    void move_towards(std::int64_t target) noexcept
+    {
+        target = std::clamp<std::int64_t>(target, m_policy.minSpinCount, m_policy.maxSpinCount);
+
+        // A quarter of the way at a time, so that a single odd gap doesn't throw it off.
+        const std::int64_t current = m_spinCount;
+        std::int64_t step = (target - current) / 4;
+        if (step == 0 && target != current)
+        {
+            step = target > current ? 1 : -1;
+        }
+        m_spinCount = static_cast<std::uint32_t>(current + step);
+    }
+
+    spin_policy m_policy;
+    std::uint32_t m_spinCount = 0;
+
+    // Running averages, zero until the first sample.
+    std::int64_t m_nsPerPoll = 0;
+    std::int64_t m_wakeLatencyNs = 0;
+};
 }  // namespace
 
 namespace cppcoro
@@ -31,294 +163,544 @@ thread_local static_thread_pool* static_thread_pool::s_currentThreadPool = nullp
 class static_thread_pool::thread_state
 {
    public:
+    enum class counter
+    {
+        tasks_executed,
+        local_pops,
+        global_dequeues,
+        steals,
+        failed_steals,
+        spin_iterations,
+        sleeps,
+        wake_ups,
+        local_queue_high_water,
+        spin_count,
+        wake_latency_ns,
+        count
+    };
+
     explicit thread_state()
-        : m_localQueue(std::make_unique<std::atomic<schedule_operation*>[]>(local::initial_local_queue_size)),
-          m_mask(local::initial_local_queue_size - 1),
-          m_head(0),
-          m_tail(0),
-          m_isSleeping(false)
+        : m_pollCount(0),
+          m_cpu(local::no_cpu),
+          // Any non-zero seed will do, as long as each thread gets its own.
+          m_randomState(static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(this) >> 6) | 1)
+    {
+        for (auto& c : m_counters)
+        {
+            c.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /// Must only be called by the owning thread.
+    void increment(counter c) noexcept
+    {
+        // We're the only writer, so avoid the cost of an atomic increment.
+        auto& value = m_counters[static_cast<std::size_t>(c)];
+        value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /// Must only be called by the owning thread.
+    void set(counter c, std::uint64_t value) noexcept
+    {
+        m_counters[static_cast<std::size_t>(c)].store(value, std::memory_order_relaxed);
+    }
+
+    std::uint64_t read(counter c) const noexcept
+    {
+        return m_counters[static_cast<std::size_t>(c)].load(std::memory_order_relaxed);
+    }
+
+    /// Set the CPU this thread should run on, if any, and the order in
+    /// which it should try to steal from the other threads. The steal order
+    /// is split into groups of threads that are equally close, each group
+    /// ending at the matching index in \p stealGroupEnds.
+    void set_placement(std::uint32_t cpu, std::vector<std::uint32_t> stealOrder,
+                       std::vector<std::uint32_t> stealGroupEnds)
+    {
+        m_cpu = cpu;
+        m_stealOrder = std::move(stealOrder);
+        m_stealGroupEnds = std::move(stealGroupEnds);
+    }
+
+    /// Called by the owning thread when it starts.
+    void pin_to_cpu() noexcept
     {
+        if (m_cpu != local::no_cpu)
+        {
+            // Carry on unpinned if this fails, only locality suffers.
+            detail::pin_current_thread_to_cpu(m_cpu);
+        }
     }
 
-    bool try_wake_up()
+    const std::vector<std::uint32_t>& steal_order() const noexcept { return m_stealOrder; }
+    const std::vector<std::uint32_t>& steal_group_ends() const noexcept { return m_stealGroupEnds; }
+
+    /// Set before the thread starts, only used by the owning thread after.
+    spin_tuner& tuner() noexcept { return m_spinTuner; }
+
+    bool approx_has_any_queued_work() const noexcept
     {
-        if (m_isSleeping.load(std::memory_order_seq_cst))
+        for (auto& queue : m_localQueues)
         {
-            if (m_isSleeping.exchange(false, std::memory_order_seq_cst))
+            if (queue.approx_has_any_queued_work())
             {
-                try
-                {
-                    m_wakeUpEvent.set();
-                }
-                catch (...)
-                {
-                    // TODO: What do we do here?
-                }
                 return true;
             }
         }
-
         return false;
     }
 
-    void notify_intent_to_sleep() noexcept { m_isSleeping.store(true, std::memory_order_relaxed); }
+    bool approx_has_queued_work(std::size_t lane) const noexcept
+    {
+        return m_localQueues[lane].approx_has_any_queued_work();
+    }
 
-    void sleep_until_woken() noexcept
+    bool has_any_queued_work() const noexcept
     {
-        try
+        for (auto& queue : m_localQueues)
         {
-            m_wakeUpEvent.wait();
+            if (queue.has_any_queued_work())
+            {
+                return true;
+            }
         }
-        catch (...)
+        return false;
+    }
+
+    void local_enqueue(schedule_operation* operation) noexcept
+    {
+        auto& queue = m_localQueues[static_cast<std::size_t>(operation->m_priority)];
+        queue.enqueue(operation);
+
+        auto& highWater = m_counters[static_cast<std::size_t>(counter::local_queue_high_water)];
+        const std::uint64_t size = queue.approx_size();
+        if (size > highWater.load(std::memory_order_relaxed))
         {
-            using namespace std::chrono_literals;
-            std::this_thread::sleep_for(1ms);
+            highWater.store(size, std::memory_order_relaxed);
         }
     }
 
-    bool approx_has_any_queued_work() const noexcept
+    schedule_operation* try_local_pop(std::size_t lane) noexcept { return m_localQueues[lane].try_pop(); }
+
+    /// Steal the oldest operation of priority \p lane and, along with it,
+    /// up to half of the rest, which are moved to \p thief's local queue.
+    /// Must only be called by the thread owning \p thief.
+    ///
+    /// \param moved
+    /// Set to the number of operations moved to \p thief's local queue.
+    ///
+    /// \param lostRace
+    /// Set to true when the queue was not empty but another thread claimed
+    /// the operation first. The caller may want to retry.
+    schedule_operation* steal_half_into(std::size_t lane, thread_state& thief, std::size_t& moved,
+                                        bool* lostRace) noexcept
     {
-        return difference(m_head.load(std::memory_order_relaxed), m_tail.load(std::memory_order_relaxed)) > 0;
+        return m_localQueues[lane].steal_half_into(thief.m_localQueues[lane], moved, lostRace);
     }
 
-    bool has_any_queued_work() noexcept
+    /// A cheap pseudo-random number, for picking which thread to steal from
+    /// first. Only called by the owning thread.
+    std::uint32_t next_random() noexcept
     {
-        std::scoped_lock lock{m_remoteMutex};
-        auto tail = m_tail.load(std::memory_order_relaxed);
-        auto head = m_head.load(std::memory_order_seq_cst);
-        return difference(head, tail) > 0;
+        // xorshift32
+        std::uint32_t x = m_randomState;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        m_randomState = x;
+        return x;
     }
 
-    bool try_local_enqueue(schedule_operation*& operation) noexcept
+    /// Called by the owning thread each time it looks for work.
+    ///
+    /// \return
+    /// The lower priority lane that should be given a turn to go first,
+    /// or zero if the lanes should be visited in priority order this time.
+    std::size_t next_starved_lane() noexcept
     {
-        // Head is only ever written-to by the current thread so we
-        // are safe to use relaxed memory order when reading it.
-        auto head = m_head.load(std::memory_order_relaxed);
-
-        // It is possible this method may be running concurrently with
-        // try_remote_steal() which may have just speculatively incremented m_tail
-        // trying to steal the last item in the queue but has not yet read the
-        // queue item. So we need to make sure we don't write to the last available
-        // space (at slot m_tail - 1) as this may still contain a pointer to an
-        // operation that has not yet been executed.
-        //
-        // Note that it's ok to read stale values from m_tail since new values
-        // won't ever decrease the number of available slots by more than 1.
-        // Reading a stale value can just mean that sometimes the queue appears
-        // empty when it may actually have slots free.
-        //
-        // Here m_mask is equal to buffersize - 1 so we can only write to a slot
-        // if the number of items consumed in the queue (head - tail) is less than
-        // the mask.
-        auto tail = m_tail.load(std::memory_order_relaxed);
-        if (difference(head, tail) < static_cast<offset_t>(m_mask))
-        {
-            // There is space left in the local buffer.
-            m_localQueue[head & m_mask].store(operation, std::memory_order_relaxed);
-            m_head.store(head + 1, std::memory_order_seq_cst);
-            return true;
+        if (++m_pollCount % local::starvation_interval != 0)
+        {
+            return 0;
         }
 
-        if (m_mask == local::max_local_queue_size)
+        // Alternate between the lower priorities so that neither of them
+        // can be starved by the other.
+        return 1 + (m_pollCount / local::starvation_interval) % (priority_count - 1);
+    }
+
+   private:
+    class local_queue
+    {
+       public:
+        local_queue()
+            : m_queue(local::initial_local_queue_size, local::max_local_queue_size),
+              m_overflowHead(nullptr),
+              m_overflowTail(nullptr),
+              m_overflowSize(0)
         {
-            // No space in the buffer and we don't want to grow
-            // it any further.
-            return false;
         }
 
-        // Allocate the new buffer before taking out the lock so that
-        // we ensure we hold the lock for as short a time as possible.
-        const size_t newSize = (m_mask + 1) * 2;
-
-        std::unique_ptr<std::atomic<schedule_operation*>[]> newLocalQueue
-        { new (std::nothrow) std::atomic<schedule_operation*>[ newSize ] };
-        if (!newLocalQueue)
+        bool approx_has_any_queued_work() const noexcept
         {
-            // Unable to allocate more memory.
-            return false;
+            return m_queue.size(std::memory_order_relaxed) > 0 || m_overflowSize.load(std::memory_order_relaxed) > 0;
         }
 
-        if (!m_remoteMutex.try_lock())
+        std::size_t approx_size() const noexcept
         {
-            // Don't wait to acquire the lock if we can't get it immediately.
-            // Fail and let it be enqueued to the global queue.
-            // TODO: Should we have a per-thread overflow queue instead?
-            return false;
+            return m_queue.size(std::memory_order_relaxed) + m_overflowSize.load(std::memory_order_relaxed);
         }
 
-        std::scoped_lock lock{std::adopt_lock, m_remoteMutex};
+        bool has_any_queued_work() const noexcept
+        {
+            // Use seq-cst memory order so that when we check for an item in the
+            // local queues after signalling an intent to sleep that either we
+            // will see their push or they will see our signal to sleep.
+            return m_queue.size(std::memory_order_seq_cst) > 0 || m_overflowSize.load(std::memory_order_seq_cst) > 0;
+        }
 
-        // We can now re-read tail, guaranteed that we are not seeing a stale version.
-        tail = m_tail.load(std::memory_order_relaxed);
+        void enqueue(schedule_operation* operation) noexcept
+        {
+            // The deque grows without a lock, so this only fails if we hit
+            // max_local_queue_size or are unable to allocate a bigger buffer.
+            // In that case keep the work on this thread in the overflow queue
+            // rather than sending it to the global queue.
+            if (!m_queue.push(operation))
+            {
+                overflow_enqueue(operation);
+            }
+        }
 
-        // Copy the existing operations.
-        const size_t newMask = newSize - 1;
-        for (size_t i = tail; i != head; ++i)
+        schedule_operation* try_pop() noexcept
         {
-            newLocalQueue[i & newMask].store(m_localQueue[i & m_mask].load(std::memory_order_relaxed),
-                                             std::memory_order_relaxed);
+            auto* op = m_queue.pop();
+            if (op == nullptr && m_overflowSize.load(std::memory_order_relaxed) > 0)
+            {
+                op = refill_from_overflow();
+            }
+            return op;
         }
 
-        // Finally, write the new operation to the queue.
-        newLocalQueue[head & newMask].store(operation, std::memory_order_relaxed);
+        schedule_operation* steal_half_into(local_queue& thief, std::size_t& moved, bool* lostRace) noexcept
+        {
+            moved = 0;
 
-        m_head.store(head + 1, std::memory_order_relaxed);
-        m_localQueue = std::move(newLocalQueue);
-        m_mask = newMask;
-        return true;
-    }
+            const std::size_t available = m_queue.size(std::memory_order_relaxed);
+            auto* op = m_queue.steal(lostRace);
+            if (op != nullptr)
+            {
+                // Each steal from the deque is a single CAS, there is no lock
+                // to hold on to, but taking the rest now saves coming back.
+                const std::size_t batchSize = std::min(available / 2, local::max_steal_batch_size);
+                while (moved + 1 < batchSize)
+                {
+                    auto* next = m_queue.steal();
+                    if (next == nullptr)
+                    {
+                        break;
+                    }
+                    thief.enqueue(next);
+                    ++moved;
+                }
+                return op;
+            }
 
-    schedule_operation* try_local_pop() noexcept
-    {
-        // Cheap, approximate, no memory-barrier check for emptiness
-        auto head = m_head.load(std::memory_order_relaxed);
-        auto tail = m_tail.load(std::memory_order_relaxed);
-        if (difference(head, tail) <= 0)
+            if (m_overflowSize.load(std::memory_order_relaxed) > 0)
+            {
+                op = steal_half_from_overflow(thief, moved, lostRace);
+            }
+            return op;
+        }
+
+       private:
+        void overflow_enqueue(schedule_operation* operation) noexcept
         {
-            // Empty
-            return nullptr;
+            operation->m_next = nullptr;
+
+            std::scoped_lock lock{m_overflowMutex};
+            if (m_overflowTail == nullptr)
+            {
+                m_overflowHead = operation;
+            }
+            else
+            {
+                m_overflowTail->m_next = operation;
+            }
+            m_overflowTail = operation;
+
+            // Use seq-cst so the enqueue is ordered before the check for sleeping threads.
+            m_overflowSize.fetch_add(1, std::memory_order_seq_cst);
         }
 
-        // 3 classes of interleaving of try_local_pop() and try_remote_steal()
-        // - local pop completes before remote steal (easy)
-        // - remote steal completes before local pop (easy)
-        // - both are executed concurrently, both see each other's writes (harder)
+        schedule_operation* refill_from_overflow() noexcept
+        {
+            std::scoped_lock lock{m_overflowMutex};
+
+            auto* op = m_overflowHead;
+            if (op == nullptr)
+            {
+                return nullptr;
+            }
 
-        // Speculatively try to acquire the head item of the work queue by
-        // decrementing the head cursor. This may race with a concurrent call
-        // to try_remote_steal() that is also trying to speculatively increment
-        // the tail cursor to steal from the other end of the queue. In the case
-        // that they both try to dequeue the last/only item in the queue then we
-        // need to fall back to locking to decide who wins
+            // Take the first operation for ourselves and move a batch of the
+            // following ones into the local queue where other threads can
+            // steal them without taking the lock.
+            auto* next = op->m_next;
+            std::size_t taken = 1;
+            while (next != nullptr && taken < local::overflow_refill_batch_size)
+            {
+                // Read the link before pushing. Once pushed, the operation may be
+                // stolen and resumed, and might be re-enqueued, at any time.
+                auto* following = next->m_next;
+                if (!m_queue.push(next))
+                {
+                    break;
+                }
+                next = following;
+                ++taken;
+            }
 
-        auto newHead = head - 1;
-        m_head.store(newHead, std::memory_order_seq_cst);
+            m_overflowHead = next;
+            if (next == nullptr)
+            {
+                m_overflowTail = nullptr;
+            }
+            m_overflowSize.fetch_sub(taken, std::memory_order_relaxed);
 
-        tail = m_tail.load(std::memory_order_seq_cst);
+            return op;
+        }
 
-        if (difference(newHead, tail) < 0)
+        schedule_operation* steal_half_from_overflow(local_queue& thief, std::size_t& moved, bool* lostRace) noexcept
         {
-            // There was a race to get the last item.
-            // We don't know whether the remote steal saw our write
-            // and decided to back off or not, so we acquire the mutex
-            // so that we wait until the remote steal has completed so
-            // we can see what decision it made.
-            std::lock_guard lock{m_remoteMutex};
+            if (lostRace == nullptr)
+            {
+                m_overflowMutex.lock();
+            }
+            else if (!m_overflowMutex.try_lock())
+            {
+                *lostRace = true;
+                return nullptr;
+            }
+
+            schedule_operation* op;
+            {
+                std::scoped_lock lock{std::adopt_lock, m_overflowMutex};
+
+                op = m_overflowHead;
+                if (op == nullptr)
+                {
+                    return nullptr;
+                }
+
+                // Unlink up to half of the list in one go.
+                const std::size_t size = m_overflowSize.load(std::memory_order_relaxed);
+                const std::size_t batchSize = std::max<std::size_t>(1, std::min(size / 2, local::max_steal_batch_size));
+                auto* last = op;
+                std::size_t taken = 1;
+                while (taken < batchSize && last->m_next != nullptr)
+                {
+                    last = last->m_next;
+                    ++taken;
+                }
 
-            // Use relaxed since the lock guarantees visibility of the writes
-            // that the remote steal thread performed.
-            tail = m_tail.load(std::memory_order_relaxed);
+                m_overflowHead = last->m_next;
+                if (m_overflowHead == nullptr)
+                {
+                    m_overflowTail = nullptr;
+                }
+                last->m_next = nullptr;
+                m_overflowSize.fetch_sub(taken, std::memory_order_relaxed);
+            }
 
-            if (difference(newHead, tail) < 0)
+            // Only enqueue on the thief once the lock is released, the thief's
+            // own overflow lock may be held by a thread waiting for ours.
+            auto* next = op->m_next;
+            while (next != nullptr)
             {
-                // The other thread didn't see our write and stole the last item.
-                // We need to restore the head back to it's old value.
-                // We hold the mutex so can just use relaxed memory order for this.
-                m_head.store(head, std::memory_order_relaxed);
-                return nullptr;
+                // Read the link before enqueueing, see refill_from_overflow().
+                auto* following = next->m_next;
+                thief.enqueue(next);
+                ++moved;
+                next = following;
             }
+            return op;
         }
 
-        // We successfully acquired an item from the queue.
-        return m_localQueue[newHead & m_mask].load(std::memory_order_relaxed);
-    }
+        work_stealing_deque<schedule_operation*> m_queue;
+
+        // Operations that didn't fit in the local queue. This is an intrusive
+        // list through schedule_operation::m_next so it never needs to allocate
+        // and is bounded only by the number of suspended operations. It is only
+        // touched once the local queue is full, so a spin lock is sufficient.
+        spin_mutex m_overflowMutex;
+        schedule_operation* m_overflowHead;
+        schedule_operation* m_overflowTail;
+        std::atomic<std::size_t> m_overflowSize;
+    };
+
+    local_queue m_localQueues[priority_count];
+
+    // Only accessed by the owning thread.
+    std::uint32_t m_pollCount;
+
+    // Set before the thread starts and not modified after.
+    std::uint32_t m_cpu;
+    std::vector<std::uint32_t> m_stealOrder;
+    std::vector<std::uint32_t> m_stealGroupEnds;
 
-    schedule_operation* try_steal(bool* lockUnavailable = nullptr) noexcept
+    // Only accessed by the owning thread once it has started.
+    spin_tuner m_spinTuner;
+    std::uint32_t m_randomState;
+
+    // Only written by the owning thread. On their own cache line so that
+    // reading them from stats() doesn't disturb the queues.
+    alignas(64) std::atomic<std::uint64_t> m_counters[static_cast<std::size_t>(counter::count)];
+};
+
+/// The queue wait and run time histograms of one task_category. Every worker
+/// records into them at once, so each bucket is a relaxed atomic counter.
+class static_thread_pool::category_histograms
+{
+   public:
+    category_histograms() noexcept : m_used(false)
     {
-        if (lockUnavailable == nullptr)
-        {
-            m_remoteMutex.lock();
-        }
-        else if (!m_remoteMutex.try_lock())
+        for (std::size_t i = 0; i < latency_histogram::bucket_count; ++i)
         {
-            *lockUnavailable = true;
-            return nullptr;
+            m_queueWait[i].store(0, std::memory_order_relaxed);
+            m_runTime[i].store(0, std::memory_order_relaxed);
         }
+    }
 
-        std::scoped_lock lock{std::adopt_lock, m_remoteMutex};
-
-        auto tail = m_tail.load(std::memory_order_relaxed);
-        auto head = m_head.load(std::memory_order_seq_cst);
-        if (difference(head, tail) <= 0)
+    void record(clock::duration queueWait, clock::duration runTime) noexcept
+    {
+        if (!m_used.load(std::memory_order_relaxed))
         {
-            return nullptr;
+            m_used.store(true, std::memory_order_relaxed);
         }
+        m_queueWait[bucket_index(queueWait)].fetch_add(1, std::memory_order_relaxed);
+        m_runTime[bucket_index(runTime)].fetch_add(1, std::memory_order_relaxed);
+    }
 
-        // It looks like there are items in the queue.
-        // We'll speculatively try to steal one by incrementing
-        // the tail cursor. As this may be running concurrently
-        // with try_local_pop() which is also speculatively trying
-        // to remove an item from the other end of the queue we
-        // need to re-read  the 'head' cursor afterwards to see
-        // if there was a potential race to dequeue the last item.
-        // Use seq_cst memory order both here and in try_local_pop()
-        // to ensure that either we will see their write to head or
-        // they will see our write to tail or we will both see each
-        // other's writes.
-        m_tail.store(tail + 1, std::memory_order_seq_cst);
-        head = m_head.load(std::memory_order_seq_cst);
+    bool used() const noexcept { return m_used.load(std::memory_order_relaxed); }
 
-        if (difference(head, tail) > 0)
-        {
-            // There was still an item in the queue after incrementing tail.
-            // We managed to steal an item from the bottom of the stack.
-            return m_localQueue[tail & m_mask].load(std::memory_order_relaxed);
-        }
-        else
+    void read_into(latency_histogram& queueWait, latency_histogram& runTime) const noexcept
+    {
+        for (std::size_t i = 0; i < latency_histogram::bucket_count; ++i)
         {
-            // Otherwise we failed to steal the last item.
-            // Restore the old tail position.
-            m_tail.store(tail, std::memory_order_seq_cst);
-            return nullptr;
+            const latency_histogram::duration lowest{latency_histogram::bucket_lowest_ns(i)};
+            if (auto count = m_queueWait[i].load(std::memory_order_relaxed); count > 0)
+            {
+                queueWait.record(lowest, count);
+            }
+            if (auto count = m_runTime[i].load(std::memory_order_relaxed); count > 0)
+            {
+                runTime.record(lowest, count);
+            }
         }
     }
 
    private:
-    using offset_t = std::make_signed_t<std::size_t>;
-
-    static constexpr offset_t difference(size_t a, size_t b) { return static_cast<offset_t>(a - b); }
+    static std::size_t bucket_index(clock::duration d) noexcept
+    {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        return latency_histogram::bucket_index(ns > 0 ? static_cast<std::uint64_t>(ns) : 0);
+    }
 
-    std::unique_ptr<std::atomic<schedule_operation*>[]> m_localQueue;
-    std::size_t m_mask;
+    std::atomic<bool> m_used;
+    std::atomic<std::uint64_t> m_queueWait[latency_histogram::bucket_count];
+    std::atomic<std::uint64_t> m_runTime[latency_histogram::bucket_count];
+};
 
-#if CORO_COMPILER_MSVC
-#pragma warning(push)
-#pragma warning(disable : 4324)
-#endif
+/// The workers asleep in help_until(), waiting for the task they join. New
+/// work only needs them if no idle worker is asleep to take it, which is rare,
+/// so they are kept in a plain list under a mutex, held across the futex wake.
+class static_thread_pool::sleeping_joins
+{
+   public:
+    sleeping_joins() noexcept : m_head(nullptr), m_count(0) {}
 
-    // alignas(std::hardware_destructive_interference_size)
-    std::atomic<std::size_t> m_head;
+    void add(detail::pool_join& join) noexcept
+    {
+        std::scoped_lock lock{m_mutex};
+        join.m_nextAsleep = m_head;
+        m_head = &join;
+        // Use seq-cst so that either the join sees the work queued before
+        // it goes to sleep or the thread queuing it sees the join here.
+        m_count.fetch_add(1, std::memory_order_seq_cst);
+    }
 
-    // alignas(std::hardware_destructive_interference_size)
-    std::atomic<std::size_t> m_tail;
+    void remove(detail::pool_join& join) noexcept
+    {
+        std::scoped_lock lock{m_mutex};
+        auto** link = &m_head;
+        while (*link != &join)
+        {
+            link = &(*link)->m_nextAsleep;
+        }
+        *link = join.m_nextAsleep;
+        m_count.fetch_sub(1, std::memory_order_relaxed);
+    }
 
-    // alignas(std::hardware_destructive_interference_size)
-    std::atomic<bool> m_isSleeping;
-    spin_mutex m_remoteMutex;
+    /// Wake one join that is asleep, if any, for new work.
+    void wake_one() noexcept
+    {
+        if (m_count.load(std::memory_order_seq_cst) == 0)
+        {
+            return;
+        }
 
-#if CORO_COMPILER_MSVC
-#pragma warning(pop)
-#endif
+        std::scoped_lock lock{m_mutex};
+        for (auto* join = m_head; join != nullptr; join = join->m_nextAsleep)
+        {
+            if (join->try_wake())
+            {
+                return;
+            }
+        }
+    }
 
-    auto_reset_event m_wakeUpEvent;
+   private:
+    std::mutex m_mutex;
+    detail::pool_join* m_head;
+    std::atomic<std::uint32_t> m_count;
 };
 
 void static_thread_pool::schedule_operation::await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept
 {
     m_awaitingCoroutine = awaitingCoroutine;
+    if (m_category != nullptr)
+    {
+        m_enqueuedAt = clock::now();
+    }
+    CORO_TRACE_FLOW_START("schedule", reinterpret_cast<std::uintptr_t>(this));
     m_threadPool->schedule_impl(this);
 }
 
 static_thread_pool::static_thread_pool() : static_thread_pool(std::thread::hardware_concurrency()) {}
 
-static_thread_pool::static_thread_pool(std::uint32_t threadCount)
+static_thread_pool::static_thread_pool(std::uint32_t threadCount) : static_thread_pool(threadCount, options{}) {}
+
+static_thread_pool::static_thread_pool(std::uint32_t threadCount, const options& opts)
     : m_threadCount(threadCount > 0 ? threadCount : 1),
       m_threadStates(std::make_unique<thread_state[]>(m_threadCount)),
+      m_spinPolicy(opts.spin),
       m_stopRequested(false),
-      m_globalQueueHead(nullptr),
-      m_globalQueueTail(nullptr),
-      m_sleepingThreadCount(0)
+      m_globalQueues(std::make_unique<mpmc_queue<schedule_operation*>[]>(priority_count)),
+      m_sleepingThreads(std::make_unique<event_count>()),
+      m_sleepingJoins(std::make_unique<sleeping_joins>()),
+      m_timerMutex(std::make_unique<spin_mutex>()),
+      m_timers(std::make_unique<timer_wheel>(clock::now())),
+      m_nextTimerDeadline(local::no_timer),
+      m_timerKeeperDeadline(local::no_timer),
+      m_lastWakeRequest(0),
+      m_categoryHistograms(std::make_unique<category_histograms[]>(task_category::max_count))
 {
+    place_worker_threads(opts);
+    for (std::uint32_t i = 0; i < m_threadCount; ++i)
+    {
+        m_threadStates[i].tuner().configure(m_spinPolicy);
+        m_threadStates[i].set(thread_state::counter::spin_count, m_spinPolicy.spinCount);
+    }
+
     m_threads.reserve(threadCount);
     try
     {
@@ -350,42 +732,45 @@ void static_thread_pool::run_worker_thread(std::uint32_t threadIndex) noexcept
     s_currentState = &localState;
     s_currentThreadPool = this;
 
-    auto tryGetRemote = [&]()
-    {
-        // Try to get some new work first from the global queue
-        // then if that queue is empty then try to steal from
-        // the local queues of other worker threads.
-        // We try to get new work from the global queue first
-        // before stealing as stealing from other threads has
-        // the side-effect of those threads running out of work
-        // sooner and then having to steal work which increases
-        // contention.
-        auto* op = try_global_dequeue();
-        if (op == nullptr)
-        {
-            op = try_steal_from_other_thread(threadIndex);
-        }
-        return op;
-    };
+    localState.pin_to_cpu();
+    CORO_TRACE_THREAD_NAME("pool worker " + std::to_string(threadIndex));
+
+    using counter = thread_state::counter;
+
+    // Also once the local queue has run dry: nobody else pushes to it, so
+    // the pops miss cheaply, and the starved lanes still get their turn.
+    auto tryGetWork = [&]() { return try_get_work(threadIndex); };
+
+    auto tryTimers = [&]() -> schedule_operation* { return poll_timers() ? tryGetWork() : nullptr; };
+
+    std::uint32_t timerPollCount = 0;
 
     while (true)
     {
-        // Process operations from the local queue.
+        // Process operations from the local and remote queues.
         schedule_operation* op;
 
         while (true)
         {
-            op = localState.try_local_pop();
+            if (++timerPollCount % local::timer_poll_interval == 0)
+            {
+                poll_timers();
+            }
+
+            op = tryGetWork();
             if (op == nullptr)
             {
-                op = tryGetRemote();
-                if (op == nullptr)
-                {
-                    break;
-                }
+                break;
             }
 
-            op->m_awaitingCoroutine.resume();
+            localState.increment(counter::tasks_executed);
+            resume(op);
+        }
+
+        // Expired timers are moved onto the global queues.
+        if (poll_timers())
+        {
+            continue;
         }
 
         // No more operations in the local queue or remote queue.
@@ -395,10 +780,20 @@ void static_thread_pool::run_worker_thread(std::uint32_t threadIndex) noexcept
         // of putting the thread to sleep and waking it up again
         // in the case that an external thread is queueing new work
 
-        cppcoro::spin_wait spinWait;
+        // With an adaptive spin policy, how this idle period went is fed
+        // back to the tuner once work turns up, at normal_processing.
+        const bool adaptive = m_spinPolicy.adaptive;
+        const clock::time_point idleStart = adaptive ? clock::now() : clock::time_point{};
+        clock::time_point sleepStart{};
+        std::uint32_t polls = 0;
+        bool slept = false;
+
+        cppcoro::spin_wait spinWait{m_spinPolicy.yieldThreshold};
         while (true)
         {
-            for (int i = 0; i < 30; ++i)
+            const std::uint32_t spinCount = localState.tuner().spin_count();
+            const clock::time_point spinStart = adaptive ? clock::now() : clock::time_point{};
+            for (std::uint32_t i = 0; i < spinCount; ++i)
             {
                 if (is_shutdown_requested())
                 {
@@ -406,10 +801,12 @@ void static_thread_pool::run_worker_thread(std::uint32_t threadIndex) noexcept
                 }
 
                 spinWait.spin_one();
+                localState.increment(counter::spin_iterations);
+                ++polls;
 
                 if (approx_has_any_queued_work_for(threadIndex))
                 {
-                    op = tryGetRemote();
+                    op = tryGetWork();
                     if (op != nullptr)
                     {
                         // Now that we've executed some work we can
@@ -421,11 +818,16 @@ void static_thread_pool::run_worker_thread(std::uint32_t threadIndex) noexcept
                 }
             }
 
+            if (adaptive)
+            {
+                localState.tuner().on_spun(spinCount, clock::now() - spinStart);
+            }
+
             // We didn't find any work after spinning for a while, let's
             // put ourselves to sleep and wait to be woken up.
 
             // First, let other threads know we're going to sleep.
-            notify_intent_to_sleep(threadIndex);
+            const auto sleepKey = m_sleepingThreads->prepare_wait();
 
             // As notifying the other threads that we're sleeping may have
             // raced with other threads enqueueing more work, we need to
@@ -435,21 +837,13 @@ void static_thread_pool::run_worker_thread(std::uint32_t threadIndex) noexcept
 
             if (has_any_queued_work_for(threadIndex))
             {
-                op = tryGetRemote();
+                op = tryGetWork();
                 if (op != nullptr)
                 {
-                    // Try to clear the intent to sleep so that some other thread
-                    // that subsequently enqueues some work won't mistakenly try
-                    // to wake this threadup when we are already running as there
-                    // might have been some other thread that it could have woken
-                    // up instead which could have resulted in increased parallelism.
-                    //
-                    // However, it's possible that some other thread may have already
-                    // tried to wake us up, in which case the auto_reset_event used to
-                    // wake up this thread may already be in the 'set' state. Leaving
-                    // it in this state won't really hurt. It'll just mean we might get
-                    // a spurious wake-up next time we try to go to sleep.
-                    try_clear_intent_to_sleep(threadIndex);
+                    // Deregister so that some other thread that subsequently
+                    // enqueues some work doesn't pay for a wake-up syscall
+                    // that finds nobody to wake.
+                    m_sleepingThreads->cancel_wait();
 
                     goto normal_processing;
                 }
@@ -457,33 +851,454 @@ void static_thread_pool::run_worker_thread(std::uint32_t threadIndex) noexcept
 
             if (is_shutdown_requested())
             {
+                m_sleepingThreads->cancel_wait();
                 return;
             }
 
-            localState.sleep_until_woken();
-        }
-
-    normal_processing:
-        assert(op != nullptr);
-        op->m_awaitingCoroutine.resume();
-    }
-}
+            // If there are timers, the first thread to go to sleep sleeps
+            // only until the next one is due, the others until notified.
+            const auto timerDeadline = try_become_timer_keeper();
+            if (timerDeadline == clock::time_point::min())
+            {
+                m_sleepingThreads->cancel_wait();
+
+                op = tryTimers();
+                if (op != nullptr)
+                {
+                    goto normal_processing;
+                }
+                continue;
+            }
+
+            // Before counting the sleep, so that work posted by whoever saw
+            // the count wakes us up after it.
+            if (adaptive)
+            {
+                slept = true;
+                sleepStart = clock::now();
+            }
+            localState.increment(counter::sleeps);
+            CORO_TRACE_BEGIN("sleep");
+            if (timerDeadline == clock::time_point::max())
+            {
+                m_sleepingThreads->wait(sleepKey);
+            }
+            else
+            {
+                const bool notified = m_sleepingThreads->wait_until(sleepKey, timerDeadline);
+                m_timerKeeperDeadline.store(local::no_timer, std::memory_order_seq_cst);
+
+                // Woken up for other work, so hand the timers to another sleeping thread.
+                if (notified && m_nextTimerDeadline.load(std::memory_order_relaxed) != local::no_timer)
+                {
+                    wake_one_thread();
+                }
+            }
+            CORO_TRACE_END();
+            localState.increment(counter::wake_ups);
+
+            op = tryTimers();
+            if (op != nullptr)
+            {
+                goto normal_processing;
+            }
+        }
+
+    normal_processing:
+        assert(op != nullptr);
+        if (adaptive)
+        {
+            auto& tuner = localState.tuner();
+            if (!slept)
+            {
+                tuner.on_work_while_spinning(polls);
+            }
+            else
+            {
+                // Only if we were woken up after going to sleep, and not by a timer.
+                const auto now = clock::now();
+                const clock::time_point wakeRequest{
+                    clock::duration{m_lastWakeRequest.load(std::memory_order_relaxed)}};
+                std::optional<clock::duration> wakeToWork;
+                if (wakeRequest >= sleepStart)
+                {
+                    wakeToWork = now - wakeRequest;
+                }
+                tuner.on_work_after_sleeping(now - idleStart, wakeToWork);
+            }
+            localState.set(counter::spin_count, tuner.spin_count());
+            localState.set(counter::wake_latency_ns, static_cast<std::uint64_t>(tuner.wake_latency().count()));
+        }
+        localState.increment(counter::tasks_executed);
+        resume(op);
+    }
+}
+
+static_thread_pool::schedule_operation* static_thread_pool::try_get_work(std::uint32_t threadIndex) noexcept
+{
+    auto& localState = m_threadStates[threadIndex];
+
+    using counter = thread_state::counter;
+
+    auto tryLocalPop = [&](std::size_t lane)
+    {
+        auto* op = localState.try_local_pop(lane);
+        if (op != nullptr)
+        {
+            localState.increment(counter::local_pops);
+        }
+        return op;
+    };
+
+    auto tryGlobalDequeue = [&](std::size_t lane)
+    {
+        auto* op = try_global_dequeue(lane);
+        if (op != nullptr)
+        {
+            localState.increment(counter::global_dequeues);
+        }
+        return op;
+    };
+
+    auto trySteal = [&](std::size_t lane)
+    {
+        auto* op = try_steal_from_other_thread(threadIndex, lane);
+        localState.increment(op != nullptr ? counter::steals : counter::failed_steals);
+        return op;
+    };
+
+    // Every so often give a lower priority the first go so that a
+    // steady stream of more urgent work can't starve it.
+    const std::size_t starvedLane = localState.next_starved_lane();
+    if (starvedLane != 0)
+    {
+        auto* op = tryLocalPop(starvedLane);
+        if (op == nullptr)
+        {
+            op = tryGlobalDequeue(starvedLane);
+        }
+        if (op == nullptr)
+        {
+            op = trySteal(starvedLane);
+        }
+        if (op != nullptr)
+        {
+            return op;
+        }
+    }
+
+    // Otherwise more urgent work always goes first, even if that means
+    // leaving less urgent work in our local queue for a while. Within a
+    // priority we prefer our local queue over the global queue.
+    for (std::size_t lane = 0; lane < priority_count; ++lane)
+    {
+        auto* op = tryLocalPop(lane);
+        if (op == nullptr)
+        {
+            op = tryGlobalDequeue(lane);
+        }
+        if (op != nullptr)
+        {
+            return op;
+        }
+    }
+
+    for (std::size_t lane = 0; lane < priority_count; ++lane)
+    {
+        auto* op = trySteal(lane);
+        if (op != nullptr)
+        {
+            return op;
+        }
+    }
+
+    return nullptr;
+}
+
+void static_thread_pool::resume(schedule_operation* operation) noexcept
+{
+    const task_category* category = operation->m_category;
+    CORO_TRACE_SCOPE(category != nullptr ? category->name() : "resume");
+    CORO_TRACE_FLOW_END("schedule", reinterpret_cast<std::uintptr_t>(operation));
+    if (category == nullptr)
+    {
+        operation->m_awaitingCoroutine.resume();
+        return;
+    }
+
+    // The coroutine may complete and destroy the operation, don't touch it after resuming.
+    const auto enqueuedAt = operation->m_enqueuedAt;
+    const auto resumedAt = clock::now();
+    operation->m_awaitingCoroutine.resume();
+    record_category(*category, resumedAt - enqueuedAt, clock::now() - resumedAt);
+}
+
+void static_thread_pool::help_until(detail::pool_join& join) noexcept
+{
+    const auto threadIndex = static_cast<std::uint32_t>(s_currentState - m_threadStates.get());
+    auto& localState = *s_currentState;
+    auto& state = join.m_state;
+
+    using counter = thread_state::counter;
+
+    cppcoro::spin_wait spinWait;
+    while (state.load(std::memory_order_acquire) != detail::pool_join::complete)
+    {
+        auto* op = try_get_work(threadIndex);
+        if (op == nullptr && poll_timers())
+        {
+            op = try_get_work(threadIndex);
+        }
+
+        if (op != nullptr)
+        {
+            // May be resumed nested in here for as long as the work runs.
+            localState.increment(counter::tasks_executed);
+            resume(op);
+            spinWait.reset();
+            continue;
+        }
+
+        if (!spinWait.next_spin_will_yield())
+        {
+            spinWait.spin_one();
+            localState.increment(counter::spin_iterations);
+            continue;
+        }
+
+        // Sleep on the join, apart from the idle workers. The task completing
+        // wakes just us, new work wakes us if no idle worker is asleep. Don't
+        // become the timer keeper, that thread may have to wake up for a timer
+        // long after we've returned, but don't sleep past the next timer either.
+        m_sleepingJoins->add(join);
+        std::uint32_t expected = detail::pool_join::awake;
+        if (!state.compare_exchange_strong(expected, detail::pool_join::asleep, std::memory_order_seq_cst))
+        {
+            m_sleepingJoins->remove(join);
+            continue;
+        }
+        if (has_any_queued_work_for(threadIndex) || is_shutdown_requested())
+        {
+            expected = detail::pool_join::asleep;
+            state.compare_exchange_strong(expected, detail::pool_join::awake, std::memory_order_relaxed);
+            m_sleepingJoins->remove(join);
+            continue;
+        }
+
+        localState.increment(counter::sleeps);
+        const clock::rep nextTimerDeadline = m_nextTimerDeadline.load(std::memory_order_relaxed);
+        const clock::time_point deadline{clock::duration{nextTimerDeadline}};
+        CORO_TRACE_BEGIN("sleep");
+        while (state.load(std::memory_order_acquire) == detail::pool_join::asleep)
+        {
+            if (nextTimerDeadline == local::no_timer)
+            {
+                detail::futex_wait(state, detail::pool_join::asleep);
+                continue;
+            }
+
+            const auto now = clock::now();
+            if (now >= deadline)
+            {
+                expected = detail::pool_join::asleep;
+                state.compare_exchange_strong(expected, detail::pool_join::awake, std::memory_order_relaxed);
+                break;
+            }
+            detail::futex_wait_for(state, detail::pool_join::asleep, deadline - now);
+        }
+        CORO_TRACE_END();
+        m_sleepingJoins->remove(join);
+        localState.increment(counter::wake_ups);
+        spinWait.reset();
+    }
+}
+
+static_thread_pool::thread_stats& static_thread_pool::thread_stats::operator+=(const thread_stats& other) noexcept
+{
+    tasksExecuted += other.tasksExecuted;
+    localPops += other.localPops;
+    globalDequeues += other.globalDequeues;
+    steals += other.steals;
+    failedSteals += other.failedSteals;
+    spinIterations += other.spinIterations;
+    sleeps += other.sleeps;
+    wakeUps += other.wakeUps;
+    localQueueHighWater = std::max(localQueueHighWater, other.localQueueHighWater);
+    spinCount = std::max(spinCount, other.spinCount);
+    wakeLatency = std::max(wakeLatency, other.wakeLatency);
+    return *this;
+}
+
+static_thread_pool::stats_snapshot static_thread_pool::stats() const
+{
+    using counter = thread_state::counter;
+
+    stats_snapshot snapshot;
+    snapshot.threads.reserve(m_threadCount);
+    for (std::uint32_t i = 0; i < m_threadCount; ++i)
+    {
+        const auto& state = m_threadStates[i];
+
+        thread_stats threadStats;
+        threadStats.tasksExecuted = state.read(counter::tasks_executed);
+        threadStats.localPops = state.read(counter::local_pops);
+        threadStats.globalDequeues = state.read(counter::global_dequeues);
+        threadStats.steals = state.read(counter::steals);
+        threadStats.failedSteals = state.read(counter::failed_steals);
+        threadStats.spinIterations = state.read(counter::spin_iterations);
+        threadStats.sleeps = state.read(counter::sleeps);
+        threadStats.wakeUps = state.read(counter::wake_ups);
+        threadStats.localQueueHighWater = state.read(counter::local_queue_high_water);
+        threadStats.spinCount = state.read(counter::spin_count);
+        threadStats.wakeLatency = std::chrono::nanoseconds{state.read(counter::wake_latency_ns)};
+
+        snapshot.total += threadStats;
+        snapshot.threads.push_back(threadStats);
+    }
+    return snapshot;
+}
+
+std::vector<static_thread_pool::category_snapshot> static_thread_pool::category_stats() const
+{
+    std::vector<category_snapshot> snapshots;
+    for (std::uint32_t id = 0; id < task_category::max_count; ++id)
+    {
+        const auto& histograms = m_categoryHistograms[id];
+        if (!histograms.used())
+        {
+            continue;
+        }
+
+        category_snapshot& snapshot = snapshots.emplace_back();
+        snapshot.category = task_category::find(id);
+        histograms.read_into(snapshot.queueWait, snapshot.runTime);
+    }
+    return snapshots;
+}
+
+void static_thread_pool::write_category_stats(std::FILE* out) const
+{
+    auto us = [](latency_histogram::duration d) { return std::chrono::duration<double, std::micro>(d).count(); };
+
+    auto writeSummary = [&](const char* what, const latency_histogram& h)
+    {
+        std::fprintf(out, "  %-10s %10llu  p50 %10.1f  p90 %10.1f  p99 %10.1f  p99.9 %10.1f  max %10.1f us\n", what,
+                     static_cast<unsigned long long>(h.count()), us(h.value_at_percentile(50.0)),
+                     us(h.value_at_percentile(90.0)), us(h.value_at_percentile(99.0)),
+                     us(h.value_at_percentile(99.9)), us(h.max()));
+    };
+
+    auto writeBuckets = [&](const char* what, const latency_histogram& h)
+    {
+        std::fprintf(out, "  %s buckets (highest ns, count):\n", what);
+        for (std::size_t i = 0; i < latency_histogram::bucket_count; ++i)
+        {
+            if (h.bucket(i) > 0)
+            {
+                std::fprintf(out, "    %14llu %10llu\n",
+                             static_cast<unsigned long long>(latency_histogram::bucket_highest_ns(i)),
+                             static_cast<unsigned long long>(h.bucket(i)));
+            }
+        }
+    };
+
+    const auto snapshots = category_stats();
+    for (const auto& snapshot : snapshots)
+    {
+        std::fprintf(out, "%s\n", snapshot.category != nullptr ? snapshot.category->name() : "?");
+        writeSummary("queued", snapshot.queueWait);
+        writeSummary("running", snapshot.runTime);
+    }
+    for (const auto& snapshot : snapshots)
+    {
+        std::fprintf(out, "\n%s\n", snapshot.category != nullptr ? snapshot.category->name() : "?");
+        writeBuckets("queued", snapshot.queueWait);
+        writeBuckets("running", snapshot.runTime);
+    }
+}
+
+void static_thread_pool::record_category(const task_category& category, clock::duration queueWait,
+                                         clock::duration runTime) noexcept
+{
+    if (category.id() != task_category::no_id)
+    {
+        m_categoryHistograms[category.id()].record(queueWait, runTime);
+    }
+}
+
+bool static_thread_pool::is_local_queue_empty(priority p) const noexcept
+{
+    return s_currentThreadPool == this && !s_currentState->approx_has_queued_work(static_cast<std::size_t>(p));
+}
+
+void static_thread_pool::place_worker_threads(const options& opts)
+{
+    std::vector<detail::cpu_info> cpus;
+    if (opts.topologyAware)
+    {
+        cpus = detail::read_cpu_topology();
+    }
+
+    // The topology is sorted so that neighbouring CPUs are close to each
+    // other. Hand them out in order so that neighbouring workers are too.
+    auto cpuFor = [&](std::uint32_t threadIndex) -> const detail::cpu_info&
+    { return cpus[threadIndex % cpus.size()]; };
+
+    for (std::uint32_t i = 0; i < m_threadCount; ++i)
+    {
+        std::vector<std::uint32_t> stealOrder;
+        stealOrder.reserve(m_threadCount - 1);
+        for (std::uint32_t j = 0; j < m_threadCount; ++j)
+        {
+            if (j != i)
+            {
+                stealOrder.push_back(j);
+            }
+        }
+
+        std::vector<std::uint32_t> stealGroupEnds;
+        if (cpus.empty())
+        {
+            // Without the topology every other thread is as good a victim as the next.
+            if (!stealOrder.empty())
+            {
+                stealGroupEnds.push_back(static_cast<std::uint32_t>(stealOrder.size()));
+            }
+            m_threadStates[i].set_placement(local::no_cpu, std::move(stealOrder), std::move(stealGroupEnds));
+            continue;
+        }
+
+        const auto& cpu = cpuFor(i);
+        auto distanceTo = [&](std::uint32_t j) { return detail::cpu_distance(cpu, cpuFor(j)); };
+        std::stable_sort(stealOrder.begin(), stealOrder.end(),
+                         [&](std::uint32_t a, std::uint32_t b) { return distanceTo(a) < distanceTo(b); });
+        for (std::uint32_t j = 1; j <= stealOrder.size(); ++j)
+        {
+            if (j == stealOrder.size() || distanceTo(stealOrder[j]) != distanceTo(stealOrder[j - 1]))
+            {
+                stealGroupEnds.push_back(j);
+            }
+        }
+        m_threadStates[i].set_placement(cpu.cpu, std::move(stealOrder), std::move(stealGroupEnds));
+    }
+}
 
 void static_thread_pool::shutdown()
 {
-    m_stopRequested.store(true, std::memory_order_relaxed);
+    // Use seq-cst so that a thread that is about to go to sleep either sees
+    // the request or is released by the notification below.
+    m_stopRequested.store(true, std::memory_order_seq_cst);
 
     for (std::uint32_t i = 0; i < m_threads.size(); ++i)
     {
-        auto& threadState = m_threadStates[i];
-
         // We should not be shutting down the thread pool if there is any
         // outstanding work in the queue. It is up to the application to
         // ensure all enqueued work has completed first.
-        assert(!threadState.has_any_queued_work());
-
-        threadState.try_wake_up();
+        assert(!m_threadStates[i].has_any_queued_work());
     }
+    assert(m_timers->empty());
+
+    m_sleepingThreads->notify_all();
 
     for (auto& t : m_threads)
     {
@@ -491,9 +1306,15 @@ void static_thread_pool::shutdown()
     }
 }
 
+static_thread_pool* static_thread_pool::current() noexcept { return s_currentThreadPool; }
+
 void static_thread_pool::schedule_impl(schedule_operation* operation) noexcept
 {
-    if (s_currentThreadPool != this || !s_currentState->try_local_enqueue(operation))
+    if (s_currentThreadPool == this)
+    {
+        s_currentState->local_enqueue(operation);
+    }
+    else
     {
         remote_enqueue(operation);
     }
@@ -503,24 +1324,52 @@ void static_thread_pool::schedule_impl(schedule_operation* operation) noexcept
 
 void static_thread_pool::remote_enqueue(schedule_operation* operation) noexcept
 {
-    auto* tail = m_globalQueueTail.load(std::memory_order_relaxed);
-    do
-    {
-        operation->m_next = tail;
-    } while (!m_globalQueueTail.compare_exchange_weak(tail, operation, std::memory_order_seq_cst,
-                                                      std::memory_order_relaxed));
+    m_globalQueues[static_cast<std::size_t>(operation->m_priority)].push(operation);
 }
 
-bool static_thread_pool::has_any_queued_work_for(std::uint32_t threadIndex) noexcept
+void static_thread_pool::enqueue_bulk(schedule_operation* head, std::size_t count) noexcept
 {
-    if (m_globalQueueTail.load(std::memory_order_seq_cst) != nullptr)
+    // Read each link before enqueueing the operation. Once enqueued it may
+    // be resumed, and might be re-enqueued, at any time.
+    if (s_currentThreadPool == this)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto* next = head->m_next;
+            s_currentState->local_enqueue(head);
+            head = next;
+        }
+    }
+    else
     {
-        return true;
+        remote_enqueue_bulk(head, count);
     }
+}
 
-    if (m_globalQueueHead.load(std::memory_order_seq_cst) != nullptr)
+void static_thread_pool::remote_enqueue_bulk(schedule_operation* head, std::size_t count) noexcept
+{
+    auto& queue = m_globalQueues[static_cast<std::size_t>(head->m_priority)];
+    auto nextOperation = [&head]
+    {
+        auto* operation = head;
+        head = head->m_next;
+        return operation;
+    };
+    queue.push_bulk(count, nextOperation);
+}
+
+bool static_thread_pool::has_any_queued_work_for(std::uint32_t threadIndex) noexcept
+{
+    // Use seq-cst memory order so that when we check for an item in the
+    // global queue after signalling an intent to sleep that either we
+    // will see their enqueue or they will see our signal to sleep and
+    // wake us up.
+    for (std::size_t lane = 0; lane < priority_count; ++lane)
     {
-        return true;
+        if (!m_globalQueues[lane].empty(std::memory_order_seq_cst))
+        {
+            return true;
+        }
     }
 
     for (std::uint32_t i = 0; i < m_threadCount; ++i)
@@ -543,14 +1392,12 @@ bool static_thread_pool::approx_has_any_queued_work_for(std::uint32_t threadInde
     // don't bounce cache-lines around between threads/cores unnecessarily when
     // multiple threads are all spinning waiting for work.
 
-    if (m_globalQueueTail.load(std::memory_order_relaxed) != nullptr)
+    for (std::size_t lane = 0; lane < priority_count; ++lane)
     {
-        return true;
-    }
-
-    if (m_globalQueueHead.load(std::memory_order_relaxed) != nullptr)
-    {
-        return true;
+        if (!m_globalQueues[lane].empty(std::memory_order_relaxed))
+        {
+            return true;
+        }
     }
 
     for (std::uint32_t i = 0; i < m_threadCount; ++i)
@@ -571,155 +1418,369 @@ bool static_thread_pool::is_shutdown_requested() const noexcept
     return m_stopRequested.load(std::memory_order_relaxed);
 }
 
-void static_thread_pool::notify_intent_to_sleep(std::uint32_t threadIndex) noexcept
+static_thread_pool::schedule_operation* static_thread_pool::try_global_dequeue(std::size_t lane) noexcept
 {
-    // First mark the thread as asleep
-    m_threadStates[threadIndex].notify_intent_to_sleep();
-
-    // Then publish the fact that a thread is asleep by incrementing the count
-    // of threads that are asleep.
-    m_sleepingThreadCount.fetch_add(1, std::memory_order_seq_cst);
+    // Most of the time most of the lanes are empty. Check that cheaply
+    // before paying for the fence in try_pop().
+    auto& queue = m_globalQueues[lane];
+    if (queue.empty(std::memory_order_relaxed))
+    {
+        return nullptr;
+    }
+    return queue.try_pop();
 }
 
-void static_thread_pool::try_clear_intent_to_sleep(std::uint32_t threadIndex) noexcept
+static_thread_pool::schedule_operation* static_thread_pool::try_steal_from_other_thread(
+    std::uint32_t thisThreadIndex, std::size_t lane) noexcept
 {
-    // First try to claim that we are waking up one of the threads.
-    std::uint32_t oldSleepingCount = m_sleepingThreadCount.load(std::memory_order_relaxed);
-    do
+    auto& thisThreadState = m_threadStates[thisThreadIndex];
+
+    // Visit the other threads closest first, if the pool knows the topology.
+    // Within a group of equally close threads start at a random one, so that
+    // idle threads spread out over the busy ones rather than all contending
+    // for the same victim.
+    const auto& stealOrder = thisThreadState.steal_order();
+    auto forEachVictim = [&](auto&& trySteal) -> schedule_operation*
     {
-        if (oldSleepingCount == 0)
+        std::uint32_t groupBegin = 0;
+        for (std::uint32_t groupEnd : thisThreadState.steal_group_ends())
         {
-            // No more sleeping threads.
-            // Someone must have woken us up.
-            return;
+            const std::uint32_t groupSize = groupEnd - groupBegin;
+            const std::uint32_t first = thisThreadState.next_random() % groupSize;
+            for (std::uint32_t i = 0; i < groupSize; ++i)
+            {
+                const std::uint32_t otherThreadIndex = stealOrder[groupBegin + (first + i) % groupSize];
+                auto* op = trySteal(m_threadStates[otherThreadIndex]);
+                if (op != nullptr)
+                {
+                    return op;
+                }
+            }
+            groupBegin = groupEnd;
         }
-    } while (!m_sleepingThreadCount.compare_exchange_weak(oldSleepingCount, oldSleepingCount - 1,
-                                                          std::memory_order_acquire, std::memory_order_relaxed));
+        return nullptr;
+    };
 
-    // Then preferentially try to wake up our thread.
-    // If some other thread has already requested that this thread wake up
-    // then we will wake up another thread - the one that should have been woken
-    // up by the thread that woke this thread up.
-    if (!m_threadStates[threadIndex].try_wake_up())
+    // Take half of the victim's queue rather than a single operation, the
+    // rest goes in our own queue where the other idle threads can steal it
+    // from us in turn.
+    auto stealHalf = [&](thread_state& otherThreadState, bool* lostRace) -> schedule_operation*
     {
-        for (std::uint32_t i = 0; i < m_threadCount; ++i)
+        std::size_t moved = 0;
+        auto* op = otherThreadState.steal_half_into(lane, thisThreadState, moved, lostRace);
+        if (moved > 0)
         {
-            if (i == threadIndex)
-                continue;
-            if (m_threadStates[i].try_wake_up())
-            {
-                return;
-            }
+            wake_one_thread();
         }
+        return op;
+    };
+
+    // Try first with a single steal attempt per thread.
+    bool anyRacesLost = false;
+    auto* op = forEachVictim([&](thread_state& otherThreadState)
+                             { return stealHalf(otherThreadState, &anyRacesLost); });
+    if (op != nullptr || !anyRacesLost)
+    {
+        return op;
     }
+
+    // Some other thread claimed the item we were going for so we didn't
+    // get a clear answer from every queue yet. Try again, this time only
+    // moving on from a thread once its queue is observed to be empty.
+    return forEachVictim(
+        [&](thread_state& otherThreadState) -> schedule_operation*
+        {
+            while (true)
+            {
+                bool lostRace = false;
+                auto* op = stealHalf(otherThreadState, &lostRace);
+                if (op != nullptr || !lostRace)
+                {
+                    return op;
+                }
+            }
+        });
 }
 
-static_thread_pool::schedule_operation* static_thread_pool::try_global_dequeue() noexcept
+void static_thread_pool::wake_one_thread() noexcept
 {
-    std::scoped_lock lock{m_globalQueueMutex};
+    note_wake_request();
 
-    auto* head = m_globalQueueHead.load(std::memory_order_relaxed);
-    if (head == nullptr)
+    // This is a single load when no thread is sleeping. Otherwise it bumps
+    // the sleepers' epoch and wakes at most one of them with a futex wake.
+    m_sleepingThreads->notify_one();
+    wake_join_if_no_idle_thread();
+}
+void static_thread_pool::wake_threads(std::size_t count) noexcept
+{
+    note_wake_request();
+    m_sleepingThreads->notify(count < m_threadCount ? static_cast<std::uint32_t>(count) : m_threadCount);
+    wake_join_if_no_idle_thread();
+}
+
+void static_thread_pool::wake_join_if_no_idle_thread() noexcept
+{
+    // A worker joining a task would otherwise sleep through work that only
+    // it is there to run, when every other worker is busy or joining too.
+    if (!m_sleepingThreads->has_waiters())
     {
-        // Use seq-cst memory order so that when we check for an item in the
-        // global queue after signalling an intent to sleep that either we
-        // will see their enqueue or they will see our signal to sleep and
-        // wake us up.
-        if (m_globalQueueTail.load(std::memory_order_seq_cst) == nullptr)
-        {
-            return nullptr;
-        }
+        m_sleepingJoins->wake_one();
+    }
+}
 
-        // Acquire the entire set of queued operations in a single operation.
-        auto* tail = m_globalQueueTail.exchange(nullptr, std::memory_order_acquire);
-        if (tail == nullptr)
+void static_thread_pool::note_wake_request() noexcept
+{
+    // Reading the clock only pays off when there is someone to wake.
+    if (m_spinPolicy.adaptive && m_sleepingThreads->has_waiters())
+    {
+        m_lastWakeRequest.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+}
+
+void static_thread_pool::timed_schedule_operation::await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept
+{
+    m_awaitingCoroutine = awaitingCoroutine;
+    m_threadPool->add_timer(this);
+}
+
+void static_thread_pool::add_timer(timed_schedule_operation* operation) noexcept
+{
+    bool isDue = false;
+    bool isNewEarliest = false;
+    clock::rep nextDeadline = local::no_timer;
+    {
+        std::scoped_lock lock{*m_timerMutex};
+        isDue = !m_timers->add(operation);
+        if (!isDue)
         {
-            return nullptr;
+            nextDeadline = m_timers->next_deadline().time_since_epoch().count();
+            isNewEarliest = nextDeadline < m_nextTimerDeadline.load(std::memory_order_relaxed);
+            if (isNewEarliest)
+            {
+                // Use seq-cst so that either a thread about to become the
+                // timer keeper sees this deadline or we see it as the keeper.
+                m_nextTimerDeadline.store(nextDeadline, std::memory_order_seq_cst);
+            }
         }
+    }
 
-        // Reverse the list
-        do
-        {
-            auto* next = std::exchange(tail->m_next, head);
-            head = std::exchange(tail, next);
-        } while (tail != nullptr);
+    if (isDue)
+    {
+        schedule_impl(operation);
+        return;
     }
 
-    m_globalQueueHead = head->m_next;
+    if (!isNewEarliest)
+    {
+        return;
+    }
 
-    return head;
+    // Make sure somebody wakes up in time: a sleeping thread, which will
+    // become the keeper, if there is no keeper, or the keeper itself if it
+    // is sleeping until later. The keeper can't be woken up on its own, but
+    // a timer becoming the earliest one while every thread sleeps is rare.
+    const auto keeperDeadline = m_timerKeeperDeadline.load(std::memory_order_seq_cst);
+    if (keeperDeadline == local::no_timer)
+    {
+        wake_one_thread();
+    }
+    else if (nextDeadline < keeperDeadline)
+    {
+        m_sleepingThreads->notify_all();
+    }
 }
 
-static_thread_pool::schedule_operation* static_thread_pool::try_steal_from_other_thread(
-    std::uint32_t thisThreadIndex) noexcept
+bool static_thread_pool::poll_timers() noexcept
 {
-    // Try first with non-blocking steal attempts.
+    const auto nextDeadline = m_nextTimerDeadline.load(std::memory_order_relaxed);
+    if (nextDeadline == local::no_timer)
+    {
+        return false;
+    }
 
-    bool anyLocksUnavailable = false;
-    for (std::uint32_t otherThreadIndex = 0; otherThreadIndex < m_threadCount; ++otherThreadIndex)
+    const auto now = clock::now();
+    if (now.time_since_epoch().count() < nextDeadline)
     {
-        if (otherThreadIndex == thisThreadIndex)
-            continue;
-        auto& otherThreadState = m_threadStates[otherThreadIndex];
-        auto* op = otherThreadState.try_steal(&anyLocksUnavailable);
-        if (op != nullptr)
+        return false;
+    }
+
+    // Somebody else is already on it.
+    if (!m_timerMutex->try_lock())
+    {
+        return false;
+    }
+
+    timed_schedule_operation* expired;
+    {
+        std::scoped_lock lock{std::adopt_lock, *m_timerMutex};
+        expired = m_timers->advance(now);
+        m_nextTimerDeadline.store(m_timers->next_deadline().time_since_epoch().count(), std::memory_order_seq_cst);
+    }
+
+    if (expired == nullptr)
+    {
+        return false;
+    }
+
+    // Hand them over in a batch per priority, as schedule_batch does. Through
+    // the global queue even from a worker, whose own queue would run the
+    // timers that expired together latest deadline first.
+    schedule_operation* heads[priority_count] = {};
+    schedule_operation* tails[priority_count] = {};
+    std::size_t counts[priority_count] = {};
+    std::size_t total = 0;
+    while (expired != nullptr)
+    {
+        auto* next = expired->m_timerNext;
+        expired->m_next = nullptr;
+
+        const auto lane = static_cast<std::size_t>(expired->m_priority);
+        if (tails[lane] == nullptr)
         {
-            return op;
+            heads[lane] = expired;
+        }
+        else
+        {
+            tails[lane]->m_next = expired;
         }
+        tails[lane] = expired;
+        ++counts[lane];
+        ++total;
+
+        expired = next;
     }
 
-    if (anyLocksUnavailable)
+    for (std::size_t lane = 0; lane < priority_count; ++lane)
     {
-        // We didn't check all of the other threads for work to steal yet.
-        // Try again, this time waiting to acquire the locks.
-        for (std::uint32_t otherThreadIndex = 0; otherThreadIndex < m_threadCount; ++otherThreadIndex)
+        if (counts[lane] > 0)
         {
-            if (otherThreadIndex == thisThreadIndex)
-                continue;
-            auto& otherThreadState = m_threadStates[otherThreadIndex];
-            auto* op = otherThreadState.try_steal();
-            if (op != nullptr)
-            {
-                return op;
-            }
+            remote_enqueue_bulk(heads[lane], counts[lane]);
         }
     }
+    wake_threads(total);
+    return true;
+}
 
-    return nullptr;
+static_thread_pool::clock::time_point static_thread_pool::try_become_timer_keeper() noexcept
+{
+    const auto nextDeadline = m_nextTimerDeadline.load(std::memory_order_seq_cst);
+    if (nextDeadline == local::no_timer)
+    {
+        return clock::time_point::max();
+    }
+
+    auto expected = local::no_timer;
+    if (!m_timerKeeperDeadline.compare_exchange_strong(expected, nextDeadline, std::memory_order_seq_cst))
+    {
+        return clock::time_point::max();
+    }
+
+    // A timer added before we became the keeper may have been missed by
+    // both of us: it saw no keeper and woke up a thread, maybe not us.
+    // Check again now that anybody adding one later is bound to see us.
+    if (m_nextTimerDeadline.load(std::memory_order_seq_cst) != nextDeadline ||
+        clock::now().time_since_epoch().count() >= nextDeadline)
+    {
+        m_timerKeeperDeadline.store(local::no_timer, std::memory_order_seq_cst);
+        return clock::time_point::min();
+    }
+
+    return clock::time_point{clock::duration{nextDeadline}};
 }
 
-void static_thread_pool::wake_one_thread() noexcept
+static_thread_pool::schedule_batch::schedule_batch(static_thread_pool& tp) noexcept
+    : m_threadPool(&tp), m_heads{}, m_tails{}, m_counts{}, m_size(0)
+{
+}
+
+static_thread_pool::schedule_batch::~schedule_batch() { submit(); }
+
+void static_thread_pool::schedule_batch::schedule_operation::await_suspend(
+    std::coroutine_handle<> awaitingCoroutine) noexcept
+{
+    m_batch->add(this, awaitingCoroutine);
+}
+
+void static_thread_pool::schedule_batch::add(static_thread_pool::schedule_operation* operation,
+                                             std::coroutine_handle<> awaitingCoroutine) noexcept
 {
-    // First try to claim responsibility for waking up one thread.
-    // This first read must be seq_cst to ensure that either we have
-    // visibility of another thread going to sleep or they have
-    // visibility of our prior enqueue of an item.
-    std::uint32_t oldSleepingCount = m_sleepingThreadCount.load(std::memory_order_seq_cst);
-    do
+    operation->m_awaitingCoroutine = awaitingCoroutine;
+    operation->m_next = nullptr;
+    CORO_TRACE_FLOW_START("schedule", reinterpret_cast<std::uintptr_t>(operation));
+
+    const auto lane = static_cast<std::size_t>(operation->m_priority);
+    if (m_tails[lane] == nullptr)
     {
-        if (oldSleepingCount == 0)
-        {
-            // No sleeping threads.
-            // Someone must have woken us up.
-            return;
-        }
-    } while (!m_sleepingThreadCount.compare_exchange_weak(oldSleepingCount, oldSleepingCount - 1,
-                                                          std::memory_order_acquire, std::memory_order_relaxed));
+        m_heads[lane] = operation;
+    }
+    else
+    {
+        m_tails[lane]->m_next = operation;
+    }
+    m_tails[lane] = operation;
+    ++m_counts[lane];
+    ++m_size;
+}
 
-    // Now that we have claimed responsibility for waking a thread up
-    // we need to find a sleeping thread and wake it up. We should be
-    // guaranteed of finding a thread to wake-up here, but not necessarily
-    // in a single pass due to threads potentially waking themselves up
-    // in try_clear_intent_to_sleep().
-    while (true)
+void static_thread_pool::schedule_batch::submit() noexcept
+{
+    if (m_size == 0)
     {
-        for (std::uint32_t i = 0; i < m_threadCount; ++i)
+        return;
+    }
+
+    for (std::size_t lane = 0; lane < priority_count; ++lane)
+    {
+        if (m_counts[lane] > 0)
         {
-            if (m_threadStates[i].try_wake_up())
-            {
-                return;
-            }
+            m_threadPool->enqueue_bulk(m_heads[lane], m_counts[lane]);
+            m_heads[lane] = nullptr;
+            m_tails[lane] = nullptr;
+            m_counts[lane] = 0;
         }
     }
+
+    // All the work is visible to the workers before this, so one pass
+    // waking up to one thread per operation is enough.
+    m_threadPool->wake_threads(m_size);
+    m_size = 0;
+}
+
+namespace detail
+{
+pool_join::pool_join() noexcept
+    : m_threadPool(*static_thread_pool::s_currentThreadPool), m_state(awake), m_nextAsleep(nullptr)
+{
+}
+
+bool pool_join::can_help() noexcept
+{
+    return static_thread_pool::s_currentThreadPool != nullptr && strand::current() == nullptr;
 }
-}  // namespace cppcoro
\ No newline at end of file
+
+std::coroutine_handle<> pool_join::on_complete() noexcept
+{
+    // The joining thread may return and destroy this as soon as it sees the
+    // state change. Waking it after that is harmless: the word is on the stack
+    // of a worker that is still running, and futex_wake() only needs its address.
+    if (m_state.exchange(complete, std::memory_order_seq_cst) == asleep)
+    {
+        futex_wake(m_state, 1);
+    }
+    return std::noop_coroutine();
+}
+
+bool pool_join::try_wake() noexcept
+{
+    std::uint32_t expected = asleep;
+    if (!m_state.compare_exchange_strong(expected, awake, std::memory_order_relaxed))
+    {
+        return false;
+    }
+    futex_wake(m_state, 1);
+    return true;
+}
+
+void pool_join::help_until_complete() noexcept { m_threadPool.help_until(*this); }
+}  // namespace detail
+}  // namespace cppcoro
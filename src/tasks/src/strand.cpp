@@ -0,0 +1,305 @@
+#include <tasks/strand.h>
+#include <tasks/trace.h>
+
+#include "spin_wait.hpp"
+
+#include <cassert>
+#include <exception>
+
+namespace
+{
+namespace local
+{
+// How many coroutines a thread runs while holding the strand before it hands
+// the strand back to the pool, to give other work on that thread a turn.
+constexpr std::uint32_t max_resumes_per_turn = 32;
+
+// The strand whose coroutine the current thread is running, if any.
+thread_local cppcoro::strand* currentStrand = nullptr;
+
+class current_strand_scope
+{
+   public:
+    explicit current_strand_scope(cppcoro::strand* s) noexcept : m_previous(currentStrand) { currentStrand = s; }
+    ~current_strand_scope() { currentStrand = m_previous; }
+
+   private:
+    cppcoro::strand* m_previous;
+};
+}  // namespace local
+}  // namespace
+
+namespace cppcoro
+{
+/// A coroutine that never completes, each resume runs the strand's queued
+/// coroutines. It is suspended before doing so, which lets the strand be
+/// destroyed as soon as it goes idle.
+class strand::runner
+{
+   public:
+    class promise_type
+    {
+       public:
+        runner get_return_object() noexcept
+        {
+            return runner{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    class run_operation
+    {
+       public:
+        explicit run_operation(strand& s) noexcept : m_strand(s) {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<>) noexcept { m_strand.run_queued(); }
+        void await_resume() const noexcept {}
+
+       private:
+        strand& m_strand;
+    };
+
+    explicit runner(std::coroutine_handle<> handle) noexcept : m_handle(handle) {}
+
+    std::coroutine_handle<> m_handle;
+};
+
+strand::runner strand::run_loop()
+{
+    for (;;)
+    {
+        co_await runner::run_operation{*this};
+    }
+}
+
+strand::strand(static_thread_pool& threadPool)
+    : m_threadPool(threadPool),
+      m_state(idle),
+      m_heads{},
+      m_tails{},
+      m_turn(0),
+      m_runner(run_loop().m_handle),
+      m_runnerOperation(&threadPool)
+{
+}
+
+strand::~strand()
+{
+    spin_wait wait;
+    while (m_state.load(std::memory_order_acquire) != idle)
+    {
+        wait.spin_one();
+    }
+
+    for (auto* head : m_heads)
+    {
+        assert(head == nullptr);
+    }
+    m_runner.destroy();
+}
+
+bool strand::running_in_this_thread() const noexcept
+{
+    return local::currentStrand == this;
+}
+
+strand* strand::current() noexcept
+{
+    return local::currentStrand;
+}
+
+void strand::schedule_operation::await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept
+{
+    m_awaitingCoroutine = awaitingCoroutine;
+    if (m_category != nullptr)
+    {
+        m_enqueuedAt = static_thread_pool::clock::now();
+    }
+    CORO_TRACE_FLOW_START("strand", reinterpret_cast<std::uintptr_t>(this));
+
+    // Only run inline if this thread isn't holding a strand already, the
+    // coroutine suspended on it would otherwise keep that one held too.
+    const bool canRunInline = local::currentStrand == nullptr;
+
+    strand& s = m_strand;
+    std::uintptr_t oldState = s.m_state.load(std::memory_order_relaxed);
+    while (true)
+    {
+        if (oldState == idle)
+        {
+            if (s.m_state.compare_exchange_weak(oldState, running_no_waiters, std::memory_order_acquire,
+                                                std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else
+        {
+            m_next = reinterpret_cast<schedule_operation*>(oldState);
+            if (s.m_state.compare_exchange_weak(oldState, reinterpret_cast<std::uintptr_t>(this),
+                                                std::memory_order_release, std::memory_order_relaxed))
+            {
+                // Whoever holds the strand runs us.
+                return;
+            }
+        }
+    }
+
+    // We hold the strand.
+    if (!canRunInline)
+    {
+        m_next = nullptr;
+        s.m_heads[static_cast<std::size_t>(m_priority)] = this;
+        s.m_tails[static_cast<std::size_t>(m_priority)] = this;
+        s.post_runner();
+        return;
+    }
+
+    {
+        local::current_strand_scope scope{&s};
+        // The coroutine may complete and destroy this operation, don't touch it after this.
+        s.resume(this);
+    }
+    s.release();
+}
+
+void strand::run_queued() noexcept
+{
+    local::current_strand_scope scope{this};
+    for (std::uint32_t resumed = 0;; ++resumed)
+    {
+        if (m_state.load(std::memory_order_relaxed) != running_no_waiters)
+        {
+            take_queued(m_state.exchange(running_no_waiters, std::memory_order_acquire));
+        }
+
+        if (resumed >= local::max_resumes_per_turn)
+        {
+            if (next_lane() < static_thread_pool::priority_count)
+            {
+                post_runner();
+                return;
+            }
+        }
+
+        auto* operation = pop_next();
+        if (operation == nullptr)
+        {
+            std::uintptr_t oldState = running_no_waiters;
+            if (m_state.compare_exchange_strong(oldState, idle, std::memory_order_release,
+                                                std::memory_order_relaxed))
+            {
+                // The strand may be destroyed as soon as it is idle.
+                return;
+            }
+            continue;
+        }
+
+        resume(operation);
+    }
+}
+
+void strand::release() noexcept
+{
+    std::uintptr_t oldState = running_no_waiters;
+    if (m_state.compare_exchange_strong(oldState, idle, std::memory_order_release, std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    // Others queued while the coroutine ran inline. Rather than run them here
+    // too, and keep the caller waiting, hand them to the pool.
+    take_queued(m_state.exchange(running_no_waiters, std::memory_order_acquire));
+    post_runner();
+}
+
+void strand::take_queued(std::uintptr_t state) noexcept
+{
+    // The operations were pushed on to the front, reverse them to get them in the order they arrived.
+    schedule_operation* arrived = nullptr;
+    auto* operation = reinterpret_cast<schedule_operation*>(state);
+    while (operation != nullptr)
+    {
+        auto* next = operation->m_next;
+        operation->m_next = arrived;
+        arrived = operation;
+        operation = next;
+    }
+
+    while (arrived != nullptr)
+    {
+        auto* next = arrived->m_next;
+        const auto lane = static_cast<std::size_t>(arrived->m_priority);
+        arrived->m_next = nullptr;
+        if (m_tails[lane] == nullptr)
+        {
+            m_heads[lane] = arrived;
+        }
+        else
+        {
+            m_tails[lane]->m_next = arrived;
+        }
+        m_tails[lane] = arrived;
+        arrived = next;
+    }
+}
+
+std::size_t strand::next_lane() const noexcept
+{
+    std::size_t lane = 0;
+    while (lane < static_thread_pool::priority_count && m_heads[lane] == nullptr)
+    {
+        ++lane;
+    }
+    return lane;
+}
+
+strand::schedule_operation* strand::pop_next() noexcept
+{
+    const std::size_t lane = next_lane();
+    if (lane == static_thread_pool::priority_count)
+    {
+        return nullptr;
+    }
+
+    auto* operation = m_heads[lane];
+    m_heads[lane] = operation->m_next;
+    if (m_heads[lane] == nullptr)
+    {
+        m_tails[lane] = nullptr;
+    }
+    return operation;
+}
+
+void strand::resume(schedule_operation* operation) noexcept
+{
+    ++m_turn;
+    const task_category* category = operation->m_category;
+    CORO_TRACE_SCOPE(category != nullptr ? category->name() : "strand");
+    CORO_TRACE_FLOW_END("strand", reinterpret_cast<std::uintptr_t>(operation));
+    if (category == nullptr)
+    {
+        operation->m_awaitingCoroutine.resume();
+        return;
+    }
+
+    const auto enqueuedAt = operation->m_enqueuedAt;
+    const auto resumedAt = static_thread_pool::clock::now();
+    operation->m_awaitingCoroutine.resume();
+    m_threadPool.record_category(*category, resumedAt - enqueuedAt, static_thread_pool::clock::now() - resumedAt);
+}
+
+void strand::post_runner() noexcept
+{
+    const std::size_t lane = next_lane();
+    assert(lane < static_thread_pool::priority_count);
+
+    m_runnerOperation = static_thread_pool::schedule_operation{&m_threadPool, static_cast<priority>(lane)};
+    m_runnerOperation.await_suspend(m_runner);
+}
+}  // namespace cppcoro
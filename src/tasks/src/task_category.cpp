@@ -0,0 +1,36 @@
+#include <tasks/task_category.h>
+
+#include <atomic>
+
+namespace
+{
+namespace local
+{
+std::atomic<std::uint32_t> nextId{0};
+
+// Written once by the constructor of the category with that id.
+std::atomic<const cppcoro::task_category*> categories[cppcoro::task_category::max_count];
+}  // namespace local
+}  // namespace
+
+namespace cppcoro
+{
+task_category::task_category(const char* name) noexcept : m_name(name), m_id(no_id)
+{
+    const std::uint32_t id = local::nextId.fetch_add(1, std::memory_order_relaxed);
+    if (id < max_count)
+    {
+        m_id = id;
+        local::categories[id].store(this, std::memory_order_release);
+    }
+}
+
+const task_category* task_category::find(std::uint32_t id) noexcept
+{
+    if (id >= max_count)
+    {
+        return nullptr;
+    }
+    return local::categories[id].load(std::memory_order_acquire);
+}
+}  // namespace cppcoro
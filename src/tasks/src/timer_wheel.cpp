@@ -0,0 +1,172 @@
+#include "timer_wheel.hpp"
+
+#include <bit>
+#include <cassert>
+
+namespace cppcoro
+{
+timer_wheel::timer_wheel(clock::time_point now) noexcept
+    : m_origin(now), m_currentTick(0), m_size(0), m_slots{}, m_occupied{}, m_overflow(nullptr)
+{
+}
+
+bool timer_wheel::add(operation* op) noexcept
+{
+    const std::uint64_t tick = tick_of(op->m_deadline);
+    if (tick <= m_currentTick)
+    {
+        return false;
+    }
+
+    place(op, tick);
+    ++m_size;
+    return true;
+}
+
+timer_wheel::operation* timer_wheel::advance(clock::time_point now) noexcept
+{
+    if (now < m_origin)
+    {
+        return nullptr;
+    }
+
+    const auto nowTick = static_cast<std::uint64_t>((now - m_origin) / resolution);
+
+    operation* expiredHead = nullptr;
+    operation* expiredTail = nullptr;
+
+    while (m_currentTick < nowTick)
+    {
+        // Skip straight to the next tick that has anything to do. The ticks
+        // in between have nothing placed in them, so that is safe.
+        const std::uint64_t tick = m_size > 0 ? next_event_tick() : nowTick + 1;
+        if (tick > nowTick)
+        {
+            m_currentTick = nowTick;
+            break;
+        }
+        m_currentTick = tick;
+
+        // Entering a new block of the top level brings the overflow list in range.
+        constexpr std::uint64_t topLevelSpan = std::uint64_t{1} << (slot_bits * level_count);
+        if (tick % topLevelSpan == 0)
+        {
+            auto* overflow = m_overflow;
+            m_overflow = nullptr;
+            redistribute(overflow);
+        }
+
+        // Redistribute from the top down, as the timers of a higher level
+        // may land in the slot of a lower level that we have just entered.
+        for (std::uint32_t level = level_count - 1; level > 0; --level)
+        {
+            const std::uint64_t span = std::uint64_t{1} << (slot_bits * level);
+            if (tick % span == 0)
+            {
+                redistribute(take_slot(level, static_cast<std::uint32_t>((tick / span) % slot_count)));
+            }
+        }
+
+        auto* expired = take_slot(0, static_cast<std::uint32_t>(tick % slot_count));
+        while (expired != nullptr)
+        {
+            auto* next = expired->m_timerNext;
+            expired->m_timerNext = nullptr;
+            if (expiredTail == nullptr)
+            {
+                expiredHead = expired;
+            }
+            else
+            {
+                expiredTail->m_timerNext = expired;
+            }
+            expiredTail = expired;
+            --m_size;
+            expired = next;
+        }
+    }
+
+    return expiredHead;
+}
+
+timer_wheel::clock::time_point timer_wheel::next_deadline() const noexcept
+{
+    if (m_size == 0)
+    {
+        return clock::time_point::max();
+    }
+    return m_origin + static_cast<clock::rep>(next_event_tick()) * resolution;
+}
+
+std::uint64_t timer_wheel::tick_of(clock::time_point deadline) const noexcept
+{
+    if (deadline <= m_origin)
+    {
+        return 0;
+    }
+
+    // Round up so that a timer never expires before its deadline.
+    const auto sinceOrigin = deadline - m_origin;
+    return static_cast<std::uint64_t>((sinceOrigin + resolution - clock::duration{1}) / resolution);
+}
+
+std::uint64_t timer_wheel::next_event_tick() const noexcept
+{
+    // Every timer at a level is later than every timer at the levels below
+    // it, so the lowest occupied level has the next event. Only its slots
+    // after the current one can be occupied, so the lowest bit set is it.
+    for (std::uint32_t level = 0; level < level_count; ++level)
+    {
+        if (m_occupied[level] != 0)
+        {
+            const std::uint32_t shift = slot_bits * level;
+            const auto slot = static_cast<std::uint64_t>(std::countr_zero(m_occupied[level]));
+            const std::uint64_t blockStart = (m_currentTick >> (shift + slot_bits)) << (shift + slot_bits);
+            return blockStart | (slot << shift);
+        }
+    }
+
+    assert(m_overflow != nullptr);
+    constexpr std::uint32_t topShift = slot_bits * level_count;
+    return ((m_currentTick >> topShift) + 1) << topShift;
+}
+
+void timer_wheel::place(operation* op, std::uint64_t tick) noexcept
+{
+    // The level is the highest group of slot_bits in which the tick differs
+    // from the current tick, so the slot is always ahead of the current one.
+    const std::uint64_t difference = tick ^ m_currentTick;
+    const std::uint32_t level =
+        difference < slot_count ? 0 : static_cast<std::uint32_t>((std::bit_width(difference) - 1) / slot_bits);
+
+    if (level >= level_count)
+    {
+        op->m_timerNext = m_overflow;
+        m_overflow = op;
+        return;
+    }
+
+    const auto slot = static_cast<std::uint32_t>((tick >> (slot_bits * level)) % slot_count);
+    op->m_timerNext = m_slots[level][slot];
+    m_slots[level][slot] = op;
+    m_occupied[level] |= std::uint64_t{1} << slot;
+}
+
+void timer_wheel::redistribute(operation* list) noexcept
+{
+    while (list != nullptr)
+    {
+        auto* next = list->m_timerNext;
+        place(list, tick_of(list->m_deadline));
+        list = next;
+    }
+}
+
+timer_wheel::operation* timer_wheel::take_slot(std::uint32_t level, std::uint32_t slot) noexcept
+{
+    auto* list = m_slots[level][slot];
+    m_slots[level][slot] = nullptr;
+    m_occupied[level] &= ~(std::uint64_t{1} << slot);
+    return list;
+}
+}  // namespace cppcoro
@@ -0,0 +1,88 @@
+#ifndef CPPCORO_TIMER_WHEEL_HPP_INCLUDED
+#define CPPCORO_TIMER_WHEEL_HPP_INCLUDED
+
+#include <tasks/static_thread_pool.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace cppcoro
+{
+/// The timers of a static_thread_pool, sorted into a hierarchical timer
+/// wheel so that adding a timer, and expiring one, take constant time no
+/// matter how many are pending.
+///
+/// Time is divided into ticks of \c resolution. Level 0 has a slot for each
+/// of the next 64 ticks, level 1 a slot for each of the next 64 blocks of
+/// 64 ticks and so on. Timers further away than the top level reaches wait
+/// in an overflow list. Whenever the current tick enters a slot of a higher
+/// level, the timers in that slot are redistributed over the lower levels.
+///
+/// Deadlines are rounded up to the next tick, so timers never expire early.
+/// Not thread-safe, the pool serialises access to it.
+class timer_wheel
+{
+   public:
+    using clock = std::chrono::steady_clock;
+    using operation = static_thread_pool::timed_schedule_operation;
+
+    static constexpr clock::duration resolution = std::chrono::milliseconds(1);
+
+    explicit timer_wheel(clock::time_point now) noexcept;
+
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+    /// \return
+    /// false, without adding it, if the operation's deadline falls in a tick
+    /// that has been expired already.
+    bool add(operation* op) noexcept;
+
+    /// Remove every operation whose tick has started by \p now.
+    ///
+    /// \return
+    /// The expired operations, ordered by tick, linked through
+    /// m_timerNext, or nullptr if there are none.
+    operation* advance(clock::time_point now) noexcept;
+
+    /// The earliest time at which advance() will have something to do, either
+    /// to expire an operation or to redistribute a slot of a higher level.
+    /// clock::time_point::max() if there are no timers.
+    clock::time_point next_deadline() const noexcept;
+
+    bool empty() const noexcept { return m_size == 0; }
+
+   private:
+    static constexpr std::uint32_t slot_bits = 6;
+    static constexpr std::uint32_t slot_count = 1u << slot_bits;
+    static constexpr std::uint32_t level_count = 4;
+
+    std::uint64_t tick_of(clock::time_point deadline) const noexcept;
+
+    std::uint64_t next_event_tick() const noexcept;
+
+    void place(operation* op, std::uint64_t tick) noexcept;
+
+    /// Take all the operations out of a slot and place them again relative to the current tick.
+    void redistribute(operation* list) noexcept;
+
+    operation* take_slot(std::uint32_t level, std::uint32_t slot) noexcept;
+
+    const clock::time_point m_origin;
+
+    // The last tick that has been expired. Timers are placed relative to it.
+    std::uint64_t m_currentTick;
+
+    std::size_t m_size;
+
+    operation* m_slots[level_count][slot_count];
+
+    // A bit for each non-empty slot, so the next one can be found without scanning.
+    std::uint64_t m_occupied[level_count];
+
+    operation* m_overflow;
+};
+}  // namespace cppcoro
+
+#endif
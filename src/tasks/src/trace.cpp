@@ -0,0 +1,229 @@
+#include <tasks/trace.h>
+
+#if CORO_TRACE
+
+#include "spin_mutex.hpp"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+namespace local
+{
+// Events each thread keeps, the oldest are overwritten once its buffer is full.
+constexpr std::size_t buffer_capacity = std::size_t{1} << 16;
+
+struct event
+{
+    const char* name;
+    std::int64_t timestampNs;
+    std::uint64_t id;
+    char phase;
+};
+
+class thread_buffer
+{
+   public:
+    explicit thread_buffer(std::uint32_t threadId)
+        : m_threadId(threadId), m_events(std::make_unique<event[]>(buffer_capacity)), m_count(0)
+    {
+    }
+
+    void record(char phase, const char* name, std::uint64_t id, std::int64_t timestampNs) noexcept
+    {
+        std::scoped_lock lock{m_mutex};
+        m_events[m_count % buffer_capacity] = event{name, timestampNs, id, phase};
+        ++m_count;
+    }
+
+    void set_name(std::string name)
+    {
+        std::scoped_lock lock{m_mutex};
+        m_name = std::move(name);
+    }
+
+    /// The events still in the buffer, oldest first.
+    std::vector<event> copy_events(std::string& name)
+    {
+        std::scoped_lock lock{m_mutex};
+        name = m_name;
+
+        std::vector<event> events;
+        const std::uint64_t first = m_count > buffer_capacity ? m_count - buffer_capacity : 0;
+        events.reserve(static_cast<std::size_t>(m_count - first));
+        for (std::uint64_t i = first; i < m_count; ++i)
+        {
+            events.push_back(m_events[i % buffer_capacity]);
+        }
+        return events;
+    }
+
+    std::uint32_t thread_id() const noexcept { return m_threadId; }
+
+   private:
+    const std::uint32_t m_threadId;
+
+    // Only contended while the trace is being written.
+    cppcoro::spin_mutex m_mutex;
+    std::string m_name;
+    const std::unique_ptr<event[]> m_events;
+    std::uint64_t m_count;
+};
+
+struct registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<thread_buffer>> buffers;
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+registry& get_registry()
+{
+    // Never destroyed, threads may still be recording while the program exits.
+    static registry* instance = new registry;
+    return *instance;
+}
+
+thread_local thread_buffer* currentBuffer = nullptr;
+
+thread_buffer& current_buffer()
+{
+    if (currentBuffer == nullptr)
+    {
+        auto& r = get_registry();
+        std::scoped_lock lock{r.mutex};
+        const auto threadId = static_cast<std::uint32_t>(r.buffers.size() + 1);
+        currentBuffer = r.buffers.emplace_back(std::make_unique<thread_buffer>(threadId)).get();
+    }
+    return *currentBuffer;
+}
+
+void record(char phase, const char* name, std::uint64_t id = 0) noexcept
+{
+    const auto timestamp = std::chrono::steady_clock::now() - get_registry().epoch;
+    current_buffer().record(phase, name, id,
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp).count());
+}
+
+void write_string(std::FILE* out, const char* s)
+{
+    std::fputc('"', out);
+    for (; *s != '\0'; ++s)
+    {
+        const auto c = static_cast<unsigned char>(*s);
+        if (c == '"' || c == '\\')
+        {
+            std::fputc('\\', out);
+            std::fputc(c, out);
+        }
+        else if (c < 0x20)
+        {
+            std::fprintf(out, "\\u%04x", c);
+        }
+        else
+        {
+            std::fputc(c, out);
+        }
+    }
+    std::fputc('"', out);
+}
+}  // namespace local
+}  // namespace
+
+namespace cppcoro::trace
+{
+void begin(const char* name) noexcept { local::record('B', name); }
+
+void end() noexcept { local::record('E', ""); }
+
+void instant(const char* name) noexcept { local::record('i', name); }
+
+void flow_start(const char* name, std::uint64_t id) noexcept { local::record('s', name, id); }
+
+void flow_end(const char* name, std::uint64_t id) noexcept { local::record('f', name, id); }
+
+void set_thread_name(std::string name) { local::current_buffer().set_name(std::move(name)); }
+
+void write_json(std::FILE* out)
+{
+    std::vector<local::thread_buffer*> buffers;
+    {
+        auto& r = local::get_registry();
+        std::scoped_lock lock{r.mutex};
+        for (auto& buffer : r.buffers)
+        {
+            buffers.push_back(buffer.get());
+        }
+    }
+
+    std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", out);
+    bool first = true;
+    auto separate = [&]
+    {
+        if (!first)
+        {
+            std::fputs(",\n", out);
+        }
+        first = false;
+    };
+
+    for (auto* buffer : buffers)
+    {
+        std::string name;
+        const auto events = buffer->copy_events(name);
+        const auto threadId = buffer->thread_id();
+
+        if (!name.empty())
+        {
+            separate();
+            std::fprintf(out, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                         threadId);
+            local::write_string(out, name.c_str());
+            std::fputs("}}", out);
+        }
+
+        for (const auto& e : events)
+        {
+            separate();
+            std::fprintf(out, "{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%lld.%03lld,\"name\":", e.phase, threadId,
+                         static_cast<long long>(e.timestampNs / 1000), static_cast<long long>(e.timestampNs % 1000));
+            local::write_string(out, e.name);
+            switch (e.phase)
+            {
+                case 's':
+                    std::fprintf(out, ",\"cat\":\"flow\",\"id\":%llu", static_cast<unsigned long long>(e.id));
+                    break;
+                case 'f':
+                    // Bind to the span enclosing the end of the flow, not the next one to begin.
+                    std::fprintf(out, ",\"cat\":\"flow\",\"id\":%llu,\"bp\":\"e\"",
+                                 static_cast<unsigned long long>(e.id));
+                    break;
+                case 'i':
+                    std::fputs(",\"s\":\"t\"", out);
+                    break;
+                default:
+                    break;
+            }
+            std::fputc('}', out);
+        }
+    }
+    std::fputs("\n]}\n", out);
+}
+
+bool write_json(const char* path)
+{
+    std::FILE* out = std::fopen(path, "w");
+    if (out == nullptr)
+    {
+        return false;
+    }
+    write_json(out);
+    std::fclose(out);
+    return true;
+}
+}  // namespace cppcoro::trace
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef CPPCORO_WORK_STEALING_DEQUE_HPP_INCLUDED
+#define CPPCORO_WORK_STEALING_DEQUE_HPP_INCLUDED
+
+#include <tasks/config.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+namespace cppcoro
+{
+/// A lock-free, growable, single-owner work-stealing deque.
+///
+/// This is the Chase-Lev deque using the memory orderings from
+/// "Correct and Efficient Work-Stealing for Weak Memory Models"
+/// (Le, Pop, Cohen, Zappa Nardelli - PPoPP 2013).
+///
+/// The owning thread pushes and pops items at the bottom of the deque
+/// while any other thread may concurrently steal items from the top.
+/// When the buffer is full the owner replaces it with one twice the size
+/// without taking any lock. A thief may still be reading from the old
+/// buffer at that point so replaced buffers are kept alive (chained from
+/// the current buffer) until the deque is destroyed. As the buffers double
+/// in size this never costs more than the current buffer again.
+template <typename T>
+class work_stealing_deque
+{
+    static_assert(std::is_pointer_v<T>, "work_stealing_deque can only hold pointers");
+
+   public:
+    /// \param initialCapacity
+    /// Number of items the deque can hold before it has to grow. Must be a power of two.
+    ///
+    /// \param maxCapacity
+    /// The deque will not grow beyond this number of items.
+    work_stealing_deque(std::size_t initialCapacity, std::size_t maxCapacity)
+        : m_top(0), m_bottom(0), m_buffer(buffer::create(initialCapacity).release()), m_maxCapacity(maxCapacity)
+    {
+        if (m_buffer.load(std::memory_order_relaxed) == nullptr)
+        {
+            throw std::bad_alloc{};
+        }
+    }
+
+    work_stealing_deque(const work_stealing_deque&) = delete;
+    work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+    ~work_stealing_deque() { delete m_buffer.load(std::memory_order_relaxed); }
+
+    /// Push an item onto the bottom of the deque.
+    ///
+    /// Must only be called by the owning thread.
+    ///
+    /// \return
+    /// false if the deque is full and could not be grown, either because
+    /// it reached its maximum capacity or because allocation failed.
+    bool push(T item) noexcept
+    {
+        const index_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const index_t top = m_top.load(std::memory_order_acquire);
+        buffer* buf = m_buffer.load(std::memory_order_relaxed);
+
+        if (bottom - top > buf->mask())
+        {
+            buf = grow(buf, top, bottom);
+            if (buf == nullptr)
+            {
+                return false;
+            }
+        }
+
+        buf->store(bottom, item);
+
+        // Publishing the item needs 'release' so that thieves see the write to
+        // the slot. We use seq_cst so that the push is also ordered before any
+        // subsequent check of whether there are sleeping threads to wake up.
+        m_bottom.store(bottom + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    /// Pop the most recently pushed item from the bottom of the deque.
+    ///
+    /// Must only be called by the owning thread.
+    ///
+    /// \return
+    /// The item, or nullptr if the deque was empty or a thief won the
+    /// race for the last remaining item.
+    T pop() noexcept
+    {
+        // Cheap, approximate, no memory-barrier check for emptiness.
+        // m_top only ever increases so a stale read can only make the
+        // deque look fuller than it is, never empty when it is not.
+        index_t bottom = m_bottom.load(std::memory_order_relaxed);
+        index_t top = m_top.load(std::memory_order_relaxed);
+        if (bottom - top <= 0)
+        {
+            return nullptr;
+        }
+
+        // Speculatively claim the bottom item by decrementing m_bottom. The
+        // fence makes sure that either a concurrent thief sees the new bottom
+        // or we see the thief's increment of m_top (or both).
+        bottom = bottom - 1;
+        buffer* buf = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            // A thief took the remaining items, restore the bottom cursor.
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T item = buf->load(bottom);
+        if (top == bottom)
+        {
+            // This was the last item, so we might be racing a thief for it.
+            // Whoever advances m_top first wins.
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                item = nullptr;
+            }
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        return item;
+    }
+
+    /// Try to steal the oldest item from the top of the deque.
+    ///
+    /// May be called from any thread.
+    ///
+    /// \param lostRace
+    /// If non-null, set to true when the deque was not empty but another
+    /// thread claimed the item first. The caller may want to retry.
+    ///
+    /// \return
+    /// The stolen item or nullptr if nothing was stolen.
+    T steal(bool* lostRace = nullptr) noexcept
+    {
+        index_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const index_t bottom = m_bottom.load(std::memory_order_acquire);
+        if (bottom - top <= 0)
+        {
+            return nullptr;
+        }
+
+        // Read the item before claiming it. Once m_top has moved past this
+        // slot the owner is free to overwrite it.
+        T item = m_buffer.load(std::memory_order_acquire)->load(top);
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            if (lostRace != nullptr)
+            {
+                *lostRace = true;
+            }
+            return nullptr;
+        }
+
+        return item;
+    }
+
+    /// Number of items in the deque.
+    ///
+    /// This is only a snapshot and may be out of date by the time it returns
+    /// when other threads are pushing, popping or stealing concurrently.
+    std::size_t size(std::memory_order order = std::memory_order_relaxed) const noexcept
+    {
+        const index_t bottom = m_bottom.load(order);
+        const index_t top = m_top.load(order);
+        return bottom > top ? static_cast<std::size_t>(bottom - top) : 0;
+    }
+
+   private:
+    using index_t = std::int64_t;
+
+    class buffer
+    {
+       public:
+        static std::unique_ptr<buffer> create(std::size_t capacity) noexcept
+        {
+            std::unique_ptr<buffer> result{new (std::nothrow) buffer(capacity)};
+            if (result && !result->m_slots)
+            {
+                result.reset();
+            }
+            return result;
+        }
+
+        index_t mask() const noexcept { return m_mask; }
+
+        std::size_t capacity() const noexcept { return static_cast<std::size_t>(m_mask) + 1; }
+
+        T load(index_t index) const noexcept { return m_slots[index & m_mask].load(std::memory_order_relaxed); }
+
+        void store(index_t index, T item) noexcept { m_slots[index & m_mask].store(item, std::memory_order_relaxed); }
+
+        std::unique_ptr<buffer> m_previous;
+
+       private:
+        explicit buffer(std::size_t capacity) noexcept
+            : m_mask(static_cast<index_t>(capacity) - 1), m_slots(new (std::nothrow) std::atomic<T>[capacity])
+        {
+        }
+
+        index_t m_mask;
+        std::unique_ptr<std::atomic<T>[]> m_slots;
+    };
+
+    buffer* grow(buffer* old, index_t top, index_t bottom) noexcept
+    {
+        if (old->capacity() >= m_maxCapacity)
+        {
+            // Don't grow the buffer any further.
+            return nullptr;
+        }
+
+        auto newBuffer = buffer::create(old->capacity() * 2);
+        if (!newBuffer)
+        {
+            // Unable to allocate more memory.
+            return nullptr;
+        }
+
+        for (index_t i = top; i != bottom; ++i)
+        {
+            newBuffer->store(i, old->load(i));
+        }
+
+        // Thieves may still be reading from the old buffer, keep it alive.
+        newBuffer->m_previous.reset(old);
+
+        buffer* result = newBuffer.release();
+        m_buffer.store(result, std::memory_order_release);
+        return result;
+    }
+
+#if CORO_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4324)  // structure was padded due to alignment specifier
+#endif
+
+    // Written by thieves and by the owner when racing for the last item.
+    alignas(64) std::atomic<index_t> m_top;
+
+    // Written by the owner only.
+    alignas(64) std::atomic<index_t> m_bottom;
+    std::atomic<buffer*> m_buffer;
+    const std::size_t m_maxCapacity;
+
+#if CORO_COMPILER_MSVC
+#pragma warning(pop)
+#endif
+};
+}  // namespace cppcoro
+
+#endif
@@ -0,0 +1,533 @@
+#include <catch.hpp>
+
+#include <tasks/detail/frame_allocator.hpp>
+#include <tasks/mpsc_channel.h>
+#include <tasks/parallel.h>
+#include <tasks/shared_task.h>
+#include <tasks/spsc_channel.h>
+#include <tasks/static_thread_pool.h>
+#include <tasks/strand.h>
+#include <tasks/task.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Benchmarks are tagged [.] so they don't run as part of the normal test pass.
+// Run them explicitly, e.g.: tests "[benchmark]" --benchmark-samples 10
+
+namespace
+{
+// A coroutine that is destroyed as soon as it completes so that benchmarks
+// which start millions of coroutines don't accumulate their frames.
+struct fire_and_forget
+{
+	struct promise_type
+	{
+		fire_and_forget get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+
+void wait_for( const std::atomic< int >& counter, int value )
+{
+	while ( counter.load( std::memory_order_acquire ) != value ) {
+		std::this_thread::yield();
+	}
+}
+}  // namespace
+
+TEST_CASE( "global queue scaling", "[.][benchmark]" )
+{
+	// N threads outside the pool schedule onto a pool of N workers, so every
+	// operation goes through the global queue.
+	constexpr int operationsPerThread = 20'000;
+
+	for ( std::uint32_t threadCount : { 1u, 2u, 4u, 8u, 16u, 32u, 64u } ) {
+		cb::static_thread_pool tp{ threadCount };
+
+		BENCHMARK( "schedule from " + std::to_string( threadCount ) + " external threads" )
+		{
+			std::atomic< int > completed = 0;
+			auto run = [ & ]() -> fire_and_forget {
+				co_await tp.schedule();
+				completed.fetch_add( 1, std::memory_order_release );
+			};
+
+			std::vector< std::thread > producers;
+			for ( std::uint32_t i = 0; i < threadCount; ++i ) {
+				producers.emplace_back( [ & ] {
+					for ( int j = 0; j < operationsPerThread; ++j ) {
+						run();
+					}
+				} );
+			}
+
+			for ( auto& producer : producers ) {
+				producer.join();
+			}
+
+			wait_for( completed, static_cast< int >( threadCount ) * operationsPerThread );
+		};
+	}
+}
+
+TEST_CASE( "wake latency", "[.][benchmark]" )
+{
+	// Let the worker go to sleep, then measure how long schedule() takes on
+	// the calling thread and how long it takes the sleeping worker to resume
+	// the coroutine. The pool's spinning would hide the wake-up, so this is
+	// timed by hand rather than with BENCHMARK.
+	using clock = std::chrono::steady_clock;
+	constexpr int sampleCount = 2'000;
+
+	for ( std::uint32_t threadCount : { 1u, 4u } ) {
+		cb::static_thread_pool tp{ threadCount };
+
+		std::vector< double > scheduleTimes;
+		std::vector< double > resumeTimes;
+		for ( int i = 0; i < sampleCount; ++i ) {
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+
+			std::atomic< int > done = 0;
+			clock::time_point resumedAt;
+			auto run = [ & ]() -> fire_and_forget {
+				co_await tp.schedule();
+				resumedAt = clock::now();
+				done.store( 1, std::memory_order_release );
+			};
+
+			const auto start = clock::now();
+			run();
+			const auto scheduled = clock::now();
+			wait_for( done, 1 );
+
+			scheduleTimes.push_back( std::chrono::duration< double, std::micro >( scheduled - start ).count() );
+			resumeTimes.push_back( std::chrono::duration< double, std::micro >( resumedAt - start ).count() );
+		}
+
+		auto percentile = [ & ]( std::vector< double >& samples, double p ) {
+			const auto n = static_cast< std::size_t >( p * static_cast< double >( samples.size() - 1 ) );
+			std::nth_element( samples.begin(), samples.begin() + static_cast< std::ptrdiff_t >( n ), samples.end() );
+			return samples[ n ];
+		};
+
+		std::printf( "wake latency, %u threads (us)\n", threadCount );
+		std::printf( "  schedule() call:  p50 %8.2f  p99 %8.2f\n", percentile( scheduleTimes, 0.5 ),
+		             percentile( scheduleTimes, 0.99 ) );
+		std::printf( "  until resumed:    p50 %8.2f  p99 %8.2f\n", percentile( resumeTimes, 0.5 ),
+		             percentile( resumeTimes, 0.99 ) );
+	}
+}
+
+TEST_CASE( "fan out", "[.][benchmark]" )
+{
+	// Launch a few hundred jobs at once from outside the pool, as when
+	// loading a directory of images, either one schedule() at a time or
+	// as a single batch.
+	constexpr int jobCount = 500;
+
+	for ( std::uint32_t threadCount : { 1u, 4u, 16u } ) {
+		cb::static_thread_pool tp{ threadCount };
+
+		BENCHMARK( std::to_string( jobCount ) + " jobs one at a time onto " + std::to_string( threadCount ) +
+				   " threads" )
+		{
+			std::atomic< int > completed = 0;
+			auto run = [ & ]() -> fire_and_forget {
+				co_await tp.schedule();
+				completed.fetch_add( 1, std::memory_order_release );
+			};
+
+			for ( int i = 0; i < jobCount; ++i ) {
+				run();
+			}
+
+			wait_for( completed, jobCount );
+		};
+
+		BENCHMARK( std::to_string( jobCount ) + " jobs in a batch onto " + std::to_string( threadCount ) +
+				   " threads" )
+		{
+			std::atomic< int > completed = 0;
+			auto run = [ & ]( cb::static_thread_pool::schedule_batch& batch ) -> fire_and_forget {
+				co_await batch.schedule();
+				completed.fetch_add( 1, std::memory_order_release );
+			};
+
+			cb::static_thread_pool::schedule_batch batch{ tp };
+			for ( int i = 0; i < jobCount; ++i ) {
+				run( batch );
+			}
+			batch.submit();
+
+			wait_for( completed, jobCount );
+		};
+	}
+}
+
+TEST_CASE( "steal-heavy fan out", "[.][benchmark]" )
+{
+	// A single pool thread spawns every job, so all the other workers only
+	// get work by stealing it. Each job reads a buffer written by the
+	// spawning thread, so where the thief runs relative to it matters.
+	constexpr int jobCount = 2'000;
+	constexpr std::size_t bufferSize = 16 * 1024;
+
+	for ( bool topologyAware : { false, true } ) {
+		cb::static_thread_pool::options options;
+		options.topologyAware = topologyAware;
+		cb::static_thread_pool tp{ std::thread::hardware_concurrency(), options };
+
+		std::vector< std::vector< unsigned char > > buffers( jobCount, std::vector< unsigned char >( bufferSize ) );
+
+		BENCHMARK( std::string( topologyAware ? "topology-aware" : "unpinned" ) + ", " +
+				   std::to_string( tp.thread_count() ) + " threads" )
+		{
+			std::atomic< int > completed = 0;
+			std::atomic< unsigned > checksum = 0;
+			auto job = [ & ]( const std::vector< unsigned char >& buffer ) -> fire_and_forget {
+				co_await tp.schedule();
+				unsigned sum = 0;
+				for ( auto b : buffer ) {
+					sum += b;
+				}
+				checksum.fetch_add( sum, std::memory_order_relaxed );
+				completed.fetch_add( 1, std::memory_order_release );
+			};
+
+			auto spawner = [ & ]() -> fire_and_forget {
+				co_await tp.schedule();
+				for ( auto& buffer : buffers ) {
+					std::fill( buffer.begin(), buffer.end(), static_cast< unsigned char >( buffer.size() ) );
+					job( buffer );
+				}
+			};
+			spawner();
+
+			wait_for( completed, jobCount );
+			return checksum.load();
+		};
+	}
+}
+
+TEST_CASE( "producer/consumer fan out", "[.][benchmark]" )
+{
+	// A single pool thread produces lots of tiny jobs and every other worker
+	// has to steal them. The jobs are too short to hide a steal, so this shows
+	// how quickly the work spreads out, and how many trips to a victim's queue
+	// it takes per job.
+	constexpr int jobCount = 20'000;
+
+	for ( std::uint32_t threadCount : { 2u, 4u, 8u, 16u } ) {
+		cb::static_thread_pool tp{ threadCount };
+
+		BENCHMARK( std::to_string( jobCount ) + " jobs from one producer onto " + std::to_string( threadCount ) +
+				   " threads" )
+		{
+			std::atomic< int > completed = 0;
+			auto job = [ & ]() -> fire_and_forget {
+				co_await tp.schedule();
+				completed.fetch_add( 1, std::memory_order_release );
+			};
+
+			auto producer = [ & ]() -> fire_and_forget {
+				co_await tp.schedule();
+				for ( int i = 0; i < jobCount; ++i ) {
+					job();
+				}
+			};
+			producer();
+
+			wait_for( completed, jobCount );
+		};
+
+		const auto stats = tp.stats();
+		std::printf( "%u threads: %.3f steals and %.3f failed steals per job\n", threadCount,
+		             static_cast< double >( stats.total.steals ) / static_cast< double >( stats.total.tasksExecuted ),
+		             static_cast< double >( stats.total.failedSteals ) /
+		                 static_cast< double >( stats.total.tasksExecuted ) );
+	}
+}
+
+TEST_CASE( "coroutine frame allocation", "[.][benchmark]" )
+{
+	// Start and finish lots of small coroutines and count how many of their
+	// frames the frame allocator takes from the global heap. Timed by hand so
+	// the allocation count covers exactly the timed loop.
+	using clock = std::chrono::steady_clock;
+	constexpr int iterationCount = 200'000;
+
+	cb::static_thread_pool tp{ 1 };
+
+	auto report = [ & ]( const char* name, clock::duration elapsed, std::uint64_t allocations ) {
+		std::printf( "%-40s %8.1f ns  %6.2f heap allocations per iteration\n", name,
+		             std::chrono::duration< double, std::nano >( elapsed ).count() / iterationCount,
+		             static_cast< double >( allocations ) / iterationCount );
+	};
+
+	auto child = []( int i ) -> cb::task< int > { co_return i; };
+
+	{
+		// Move-assigning the next task destroys the previous frame on the
+		// same thread that allocated it.
+		std::uint64_t allocations = 0;
+		clock::duration elapsed{};
+		[ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			const auto allocationsBefore = cppcoro::detail::frame_allocator::heap_allocations();
+			const auto start = clock::now();
+
+			cb::task< int > t;
+			int sum = 0;
+			for ( int i = 0; i < iterationCount; ++i ) {
+				t = child( i );
+				sum += co_await t;
+			}
+
+			elapsed = clock::now() - start;
+			allocations = cppcoro::detail::frame_allocator::heap_allocations() - allocationsBefore;
+			CHECK( sum != 0 );
+		}()
+					   .join();
+		report( "task awaited on one thread", elapsed, allocations );
+	}
+
+	{
+		// join() starts a second coroutine that waits for the task.
+		const auto allocationsBefore = cppcoro::detail::frame_allocator::heap_allocations();
+		const auto start = clock::now();
+
+		cb::task< int > t;
+		int sum = 0;
+		for ( int i = 0; i < iterationCount; ++i ) {
+			t = child( i );
+			sum += t.join();
+		}
+
+		const auto elapsed = clock::now() - start;
+		report( "task joined from outside the pool", elapsed,
+		        cppcoro::detail::frame_allocator::heap_allocations() - allocationsBefore );
+		CHECK( sum != 0 );
+	}
+
+	{
+		// The frame is allocated here and freed on the pool thread when the
+		// last reference goes away there. Run in rounds so that freed frames
+		// can make their way back before the next round.
+		constexpr int roundSize = 256;
+		auto makeShared = []( int i ) -> cb::shared_task< int > { co_return i; };
+
+		std::atomic< int > completed = 0;
+		auto release = [ & ]( cb::shared_task< int > t ) -> fire_and_forget {
+			co_await tp.schedule();
+			co_await t;
+			completed.fetch_add( 1, std::memory_order_release );
+		};
+
+		const auto allocationsBefore = cppcoro::detail::frame_allocator::heap_allocations();
+		const auto start = clock::now();
+
+		for ( int i = 0; i < iterationCount; ++i ) {
+			release( makeShared( i ) );
+			if ( ( i + 1 ) % roundSize == 0 ) {
+				wait_for( completed, i + 1 );
+			}
+		}
+		wait_for( completed, iterationCount );
+
+		const auto elapsed = clock::now() - start;
+		report( "shared_task freed on another thread", elapsed,
+		        cppcoro::detail::frame_allocator::heap_allocations() - allocationsBefore );
+	}
+}
+
+TEST_CASE( "join", "[.][benchmark]" )
+{
+	// The SDL thread calls into Lua by joining a task that hops onto the
+	// Lua thread. Move-assigning the next task frees the previous frame.
+	cb::static_thread_pool tp{ 1 };
+
+	cb::task< int > t;
+
+	BENCHMARK( "join a task that already completed" )
+	{
+		t = []() -> cb::task< int > { co_return 1; }();
+		return t.join();
+	};
+
+	BENCHMARK( "join a task that runs on the pool" )
+	{
+		t = [ & ]() -> cb::task< int > {
+			co_await tp.schedule();
+			co_return 1;
+		}();
+		return t.join();
+	};
+}
+
+TEST_CASE( "parallel_for scaling", "[.][benchmark]" )
+{
+	// Premultiply the alpha of a 2048x2048 RGBA image, as done after
+	// decoding, serially and split over pools of increasing size. The loops
+	// are bounded by a count only known at run time, as the chunks are, so
+	// that the serial loop is not compiled any differently.
+	constexpr std::size_t pixelCount = 2048 * 2048;
+	constexpr std::size_t grain = 4096;
+
+	std::vector< std::uint32_t > pixels( pixelCount );
+	for ( std::size_t i = 0; i < pixelCount; ++i ) {
+		pixels[ i ] = static_cast< std::uint32_t >( i * 2654435761u );
+	}
+	const std::size_t count = pixels.size();
+
+	auto premultiply = [ & ]( std::size_t i ) {
+		const std::uint32_t p = pixels[ i ];
+		const std::uint32_t a = p >> 24;
+		const std::uint32_t r = ( ( p & 0xff ) * a ) / 255;
+		const std::uint32_t g = ( ( ( p >> 8 ) & 0xff ) * a ) / 255;
+		const std::uint32_t b = ( ( ( p >> 16 ) & 0xff ) * a ) / 255;
+		pixels[ i ] = ( a << 24 ) | ( b << 16 ) | ( g << 8 ) | r;
+	};
+
+	BENCHMARK( "premultiply serially" )
+	{
+		for ( std::size_t i = 0; i < count; ++i ) {
+			premultiply( i );
+		}
+		return pixels[ 0 ];
+	};
+
+	for ( std::uint32_t threadCount : { 1u, 2u, 4u, 8u } ) {
+		cb::static_thread_pool tp{ threadCount };
+
+		BENCHMARK( "premultiply with parallel_for on " + std::to_string( threadCount ) + " threads" )
+		{
+			cb::parallel_for( tp, { 0, count }, grain, premultiply ).join();
+			return pixels[ 0 ];
+		};
+	}
+
+	BENCHMARK( "sum serially" )
+	{
+		std::uint64_t sum = 0;
+		for ( std::size_t i = 0; i < count; ++i ) {
+			sum += pixels[ i ];
+		}
+		return sum;
+	};
+
+	for ( std::uint32_t threadCount : { 1u, 2u, 4u, 8u } ) {
+		cb::static_thread_pool tp{ threadCount };
+
+		BENCHMARK( "sum with parallel_reduce on " + std::to_string( threadCount ) + " threads" )
+		{
+			return cb::parallel_reduce(
+					   tp, { 0, count }, grain, std::uint64_t{ 0 },
+					   [ & ]( std::uint64_t sum, cb::index_range chunk ) {
+						   for ( std::size_t i = chunk.begin; i < chunk.end; ++i ) {
+							   sum += pixels[ i ];
+						   }
+						   return sum;
+					   },
+					   []( std::uint64_t a, std::uint64_t b ) { return a + b; } )
+				.join();
+		};
+	}
+}
+
+TEST_CASE( "streaming items between pool threads", "[.][benchmark]" )
+{
+	// One coroutine hands a stream of items to another on a different pool
+	// thread, either through a channel or with a hop on to a strand per item.
+	constexpr int itemCount = 100'000;
+	constexpr std::size_t capacity = 256;
+
+	cb::static_thread_pool tp{ 2 };
+
+	BENCHMARK( std::to_string( itemCount ) + " items, a strand hop each" )
+	{
+		cb::strand strand{ tp };
+		std::atomic< int > received = 0;
+		std::uint64_t sum = 0;
+		auto deliver = [ & ]( int item ) -> fire_and_forget {
+			co_await strand.schedule();
+			sum += static_cast< std::uint64_t >( item );
+			received.fetch_add( 1, std::memory_order_release );
+		};
+		auto sender = [ & ]() -> fire_and_forget {
+			co_await tp.schedule();
+			for ( int i = 0; i < itemCount; ++i ) {
+				deliver( i );
+			}
+		};
+		sender();
+
+		wait_for( received, itemCount );
+		return sum;
+	};
+
+	BENCHMARK( std::to_string( itemCount ) + " items through an spsc_channel" )
+	{
+		cb::spsc_channel< int > channel{ capacity };
+		std::atomic< int > done = 0;
+		std::uint64_t sum = 0;
+		auto receiver = [ & ]() -> fire_and_forget {
+			co_await tp.schedule();
+			for ( int i = 0; i < itemCount; ++i ) {
+				sum += static_cast< std::uint64_t >( co_await channel.receive() );
+			}
+			done.fetch_add( 1, std::memory_order_release );
+		};
+		auto sender = [ & ]() -> fire_and_forget {
+			co_await tp.schedule();
+			for ( int i = 0; i < itemCount; ++i ) {
+				co_await channel.send( i );
+			}
+			// The last send may still be on its way out of the channel when the receiver is done.
+			done.fetch_add( 1, std::memory_order_release );
+		};
+		receiver();
+		sender();
+
+		wait_for( done, 2 );
+		return sum;
+	};
+
+	BENCHMARK( std::to_string( itemCount ) + " items through an mpsc_channel" )
+	{
+		cb::mpsc_channel< int > channel{ capacity };
+		std::atomic< int > done = 0;
+		std::uint64_t sum = 0;
+		auto receiver = [ & ]() -> fire_and_forget {
+			co_await tp.schedule();
+			for ( int i = 0; i < itemCount; ++i ) {
+				sum += static_cast< std::uint64_t >( co_await channel.receive() );
+			}
+			done.fetch_add( 1, std::memory_order_release );
+		};
+		auto sender = [ & ]() -> fire_and_forget {
+			co_await tp.schedule();
+			for ( int i = 0; i < itemCount; ++i ) {
+				co_await channel.send( i );
+			}
+			// The last send may still be on its way out of the channel when the receiver is done.
+			done.fetch_add( 1, std::memory_order_release );
+		};
+		receiver();
+		sender();
+
+		wait_for( done, 2 );
+		return sum;
+	};
+}
@@ -2,13 +2,33 @@
 #include <catch.hpp>
 
 #include <tasks/task.h>
+#include <tasks/affine_task.h>
+#include <tasks/async_latch.h>
+#include <tasks/async_mutex.h>
+#include <tasks/async_scope.h>
+#include <tasks/async_semaphore.h>
+#include <tasks/cancellation.h>
+#include <tasks/file_io.h>
+#include <tasks/mpsc_channel.h>
+#include <tasks/parallel.h>
 #include <tasks/shared_task.h>
+#include <tasks/spsc_channel.h>
 #include <tasks/static_thread_pool.h>
+#include <tasks/strand.h>
+#include <tasks/task_category.h>
+#include <tasks/trace.h>
+#include <tasks/when_all.h>
+#include <tasks/when_any.h>
 
 #include <string>
 #include <concepts>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <thread>
 #include <chrono>
+#include <utility>
+#include <vector>
 using namespace std::chrono_literals;
 
 TEST_CASE( "task starts before being awaited" )
@@ -147,6 +167,1787 @@ TEST_CASE( "task<>.join() test: multiple threads" )
 	}
 }
 
+namespace
+{
+// Passed by value to a coroutine, counts the frames it was moved into that have been freed.
+struct frame_counter
+{
+	explicit frame_counter( std::atomic< int >& counter ) : freed( &counter ) {}
+	frame_counter( frame_counter&& other ) noexcept : freed( std::exchange( other.freed, nullptr ) ) {}
+	~frame_counter()
+	{
+		if ( freed ) {
+			freed->fetch_add( 1 );
+		}
+	}
+
+	std::atomic< int >* freed;
+};
+
+void wait_for_count( const std::atomic< int >& count, int value )
+{
+	const auto deadline = std::chrono::steady_clock::now() + 5s;
+	while ( count.load() != value && std::chrono::steady_clock::now() < deadline ) {
+		std::this_thread::yield();
+	}
+}
+}  // namespace
+
+TEST_CASE( "task frees its coroutine frame, or leaves it to the coroutine while running" )
+{
+	std::atomic< int > freed = 0;
+
+	SECTION( "destroyed after completing" )
+	{
+		auto makeTask = []( frame_counter ) -> cb::task< int > { co_return 1; };
+		{
+			auto task = makeTask( frame_counter{ freed } );
+			CHECK( task.join() == 1 );
+			CHECK( freed == 0 );
+		}
+		CHECK( freed == 1 );
+	}
+
+	SECTION( "destroyed while running" )
+	{
+		cb::static_thread_pool tp{ 1 };
+		std::binary_semaphore release{ 0 };
+		auto makeTask = [ & ]( frame_counter ) -> cb::task<> {
+			co_await tp.schedule();
+			release.acquire();
+		};
+
+		{
+			[[maybe_unused]] auto task = makeTask( frame_counter{ freed } );
+		}
+		CHECK( freed == 0 );
+
+		release.release();
+		wait_for_count( freed, 1 );
+		CHECK( freed == 1 );
+	}
+}
+
+TEST_CASE( "async_scope join resumes once all spawned work has completed" )
+{
+	cb::async_scope scope;
+
+	SECTION( "nothing spawned" )
+	{
+		bool joined = false;
+		auto join = [ & ]() -> cb::task<> {
+			co_await scope.join();
+			joined = true;
+		}();
+		CHECK( joined );
+	}
+
+	SECTION( "work spawned on a pool" )
+	{
+		cb::static_thread_pool tp{ 4 };
+
+		constexpr int workCount = 1'000;
+		std::atomic< int > done = 0;
+		std::atomic< int > freed = 0;
+		auto work = [ & ]( frame_counter ) -> cb::task<> {
+			co_await tp.schedule();
+			done.fetch_add( 1 );
+		};
+
+		for ( int i = 0; i < workCount; ++i ) {
+			scope.spawn( work( frame_counter{ freed } ) );
+		}
+
+		[ & ]() -> cb::task<> { co_await scope.join(); }().join();
+		CHECK( done == workCount );
+
+		// The last frames are freed once the join has been resumed from inside them.
+		wait_for_count( freed, workCount );
+		CHECK( freed == workCount );
+	}
+}
+
+TEST_CASE( "join from a pool thread runs other pool work while waiting" )
+{
+	// A single pool thread, so a join() that only blocked it would never finish.
+	cb::static_thread_pool tp{ 1 };
+
+	SECTION( "joined task needs the pool" )
+	{
+		auto inner = [ & ]( int i ) -> cb::task< int > {
+			co_await tp.schedule();
+			co_return i;
+		};
+
+		auto outer = [ & ]() -> cb::task< int > {
+			co_await tp.schedule();
+			int sum = 0;
+			for ( int i = 0; i < 100; ++i ) {
+				sum += inner( i ).join();
+			}
+			co_return sum;
+		};
+
+		CHECK( outer().join() == 100 * 99 / 2 );
+	}
+
+	SECTION( "joined task waits for a timer" )
+	{
+		auto delayed = [ & ]() -> cb::task< bool > {
+			co_await tp.schedule_after( std::chrono::milliseconds{ 20 } );
+			co_return true;
+		};
+
+		auto outer = [ & ]() -> cb::task< bool > {
+			co_await tp.schedule();
+			co_return delayed().join();
+		};
+
+		CHECK( outer().join() );
+	}
+
+	SECTION( "joined task completes on another thread" )
+	{
+		std::binary_semaphore release{ 0 };
+		std::thread other;
+		auto elsewhere = [ & ]() -> cb::task< int > {
+			struct resume_on_other_thread
+			{
+				std::thread& thread;
+				std::binary_semaphore& release;
+				bool await_ready() const noexcept { return false; }
+				void await_suspend( std::coroutine_handle<> h )
+				{
+					thread = std::thread{ [ this, h ] {
+						release.acquire();
+						h.resume();
+					} };
+				}
+				void await_resume() const noexcept {}
+			};
+			co_await resume_on_other_thread{ other, release };
+			co_return 42;
+		};
+
+		auto outer = [ & ]() -> cb::task< int > {
+			co_await tp.schedule();
+			auto t = elsewhere();
+			release.release();
+			co_return t.join();
+		};
+
+		CHECK( outer().join() == 42 );
+		other.join();
+	}
+}
+
+TEST_CASE( "join from a pool thread holding a strand blocks instead" )
+{
+	cb::static_thread_pool tp{ 2 };
+	cb::strand strand{ tp };
+
+	constexpr int nestedCount = 20;
+	std::binary_semaphore joining{ 0 };
+	std::atomic< bool > queued{ false };
+	std::atomic< int > sawStrand{ 0 };
+	int ranOnStrand = 0;
+
+	// Completes on the pool once the work below has queued up.
+	auto inner = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		while ( !queued.load() ) {
+			std::this_thread::yield();
+		}
+	};
+
+	auto hold = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		co_await strand.schedule();
+		auto t = inner();
+		joining.release();
+		t.join();
+		++ranOnStrand;
+	};
+	auto holder = hold();
+	joining.acquire();
+
+	// Queued while the join is pending. Running any of it nested in the join
+	// would run it with the strand held.
+	auto nested = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		if ( cb::strand::current() != nullptr ) {
+			sawStrand.fetch_add( 1 );
+		}
+		co_await strand.schedule();
+		++ranOnStrand;
+	};
+
+	std::vector< cb::task<> > tasks;
+	for ( int i = 0; i < nestedCount; ++i ) {
+		tasks.push_back( nested() );
+	}
+	queued.store( true );
+
+	holder.join();
+	for ( auto& t : tasks ) {
+		t.join();
+	}
+
+	CHECK( ranOnStrand == nestedCount + 1 );
+	CHECK( sawStrand == 0 );
+}
+
+TEST_CASE( "work scheduled from a pool thread is run or stolen exactly once" )
+{
+	// Spawning from inside the pool pushes onto the worker's local queue,
+	// which has to grow past its initial size while the other workers
+	// steal from it.
+	cb::static_thread_pool tp{ 4 };
+
+	constexpr int taskCount = 5'000;
+	std::atomic< int > runCount = 0;
+
+	auto child = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		runCount.fetch_add( 1, std::memory_order_relaxed );
+	};
+
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+
+		std::vector< cb::task<> > children;
+		children.reserve( taskCount );
+		for ( int i = 0; i < taskCount; ++i ) {
+			children.push_back( child() );
+		}
+
+		for ( auto& c : children ) {
+			co_await c;
+		}
+	}()
+				   .join();
+
+	CHECK( runCount == taskCount );
+}
+
+TEST_CASE( "work that overflows a worker's local queue stays on that worker" )
+{
+	// With a single worker nothing gets stolen, so spawning more than the
+	// local queue can hold pushes the remainder into the overflow queue.
+	cb::static_thread_pool tp{ 1 };
+
+	constexpr int taskCount = 150'000;
+	int runCount = 0;
+
+	auto child = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		++runCount;
+	};
+
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+
+		std::vector< cb::task<> > children;
+		children.reserve( taskCount );
+		for ( int i = 0; i < taskCount; ++i ) {
+			children.push_back( child() );
+		}
+
+		for ( auto& c : children ) {
+			co_await c;
+		}
+	}()
+				   .join();
+
+	CHECK( runCount == taskCount );
+}
+
+TEST_CASE( "work stolen in batches from a worker's overflow queue is run exactly once" )
+{
+	// A single producer fills its local queue and its overflow queue, the
+	// other workers steal up to half of either at a time and pass the
+	// batches on between themselves.
+	cb::static_thread_pool tp{ 4 };
+
+	constexpr int taskCount = 150'000;
+	std::atomic< int > runCount = 0;
+
+	auto child = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		runCount.fetch_add( 1, std::memory_order_relaxed );
+	};
+
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+
+		std::vector< cb::task<> > children;
+		children.reserve( taskCount );
+		for ( int i = 0; i < taskCount; ++i ) {
+			children.push_back( child() );
+		}
+
+		for ( auto& c : children ) {
+			co_await c;
+		}
+	}()
+				   .join();
+
+	CHECK( runCount == taskCount );
+}
+
+TEST_CASE( "work is stolen across a topology-aware pool" )
+{
+	// Where the topology can't be read this is a plain pool, otherwise the
+	// workers are pinned and steal from their closest neighbours first.
+	cb::static_thread_pool::options options;
+	options.topologyAware = true;
+	cb::static_thread_pool tp{ 4, options };
+
+	constexpr int taskCount = 5'000;
+	std::atomic< int > runCount = 0;
+
+	auto child = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		runCount.fetch_add( 1, std::memory_order_relaxed );
+	};
+
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+
+		std::vector< cb::task<> > children;
+		children.reserve( taskCount );
+		for ( int i = 0; i < taskCount; ++i ) {
+			children.push_back( child() );
+		}
+
+		for ( auto& c : children ) {
+			co_await c;
+		}
+	}()
+				   .join();
+
+	CHECK( runCount == taskCount );
+}
+
+TEST_CASE( "work scheduled from many external threads is run exactly once" )
+{
+	// Every schedule() from outside the pool goes through the global queue.
+	// Use enough items that producers and consumers wrap across many blocks.
+	cb::static_thread_pool tp{ 4 };
+
+	constexpr int producerCount = 8;
+	constexpr int tasksPerProducer = 2'000;
+	std::atomic< int > runCount = 0;
+
+	auto child = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		runCount.fetch_add( 1, std::memory_order_relaxed );
+	};
+
+	std::vector< std::vector< cb::task<> > > tasks( producerCount );
+	std::vector< std::thread > producers;
+	for ( std::size_t p = 0; p < producerCount; ++p ) {
+		producers.emplace_back( [ &, p ] {
+			for ( int i = 0; i < tasksPerProducer; ++i ) {
+				tasks[ p ].push_back( child() );
+			}
+		} );
+	}
+
+	for ( auto& producer : producers ) {
+		producer.join();
+	}
+
+	for ( auto& producerTasks : tasks ) {
+		for ( auto& t : producerTasks ) {
+			t.join();
+		}
+	}
+
+	CHECK( runCount == producerCount * tasksPerProducer );
+}
+
+TEST_CASE( "workers that have gone to sleep are woken up for new work" )
+{
+	// Give the workers long enough to stop spinning and go to sleep before
+	// each round, so every round has to wake them up again, both from outside
+	// the pool and from a worker spawning more work.
+	cb::static_thread_pool tp{ 4 };
+
+	std::atomic< int > runCount = 0;
+	auto child = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		runCount.fetch_add( 1, std::memory_order_relaxed );
+	};
+
+	constexpr int roundCount = 100;
+	for ( int round = 0; round < roundCount; ++round ) {
+		std::this_thread::sleep_for( std::chrono::milliseconds( 2 ) );
+
+		[ & ]() -> cb::task<> {
+			co_await tp.schedule();
+
+			auto a = child();
+			auto b = child();
+			auto c = child();
+			co_await a;
+			co_await b;
+			co_await c;
+		}()
+					   .join();
+	}
+
+	CHECK( runCount == roundCount * 3 );
+}
+
+TEST_CASE( "more urgent work is run first" )
+{
+	// With a single worker, everything scheduled while the parent is running
+	// is still queued when it suspends, so the run order is down to priority.
+	cb::static_thread_pool tp{ 1 };
+	using priority = cb::static_thread_pool::priority;
+
+	std::vector< priority > runOrder;
+	auto child = [ & ]( priority p ) -> cb::task<> {
+		co_await tp.schedule( p );
+		runOrder.push_back( p );
+	};
+
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+
+		std::vector< cb::task<> > children;
+		for ( auto p : { priority::low, priority::normal, priority::high, priority::low, priority::high } ) {
+			children.push_back( child( p ) );
+		}
+
+		for ( auto& c : children ) {
+			co_await c;
+		}
+	}()
+				   .join();
+
+	CHECK( runOrder ==
+		   std::vector< priority >{ priority::high, priority::high, priority::normal, priority::low, priority::low } );
+}
+
+TEST_CASE( "less urgent work is not starved by more urgent work" )
+{
+	cb::static_thread_pool tp{ 1 };
+	using priority = cb::static_thread_pool::priority;
+
+	std::atomic< bool > lowRan = false;
+	int highRunCount = 0;
+
+	auto lowPriorityWork = [ & ]() -> cb::task<> {
+		co_await tp.schedule( priority::low );
+		lowRan = true;
+	};
+
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+
+		auto low = lowPriorityWork();
+
+		// Keep the high priority lane busy until the low priority work gets a turn.
+		while ( !lowRan && highRunCount < 100'000 ) {
+			co_await tp.schedule( priority::high );
+			++highRunCount;
+		}
+
+		co_await low;
+	}()
+				   .join();
+
+	CHECK( lowRan );
+	CHECK( highRunCount < 100'000 );
+}
+
+TEST_CASE( "work scheduled in a batch is run exactly once" )
+{
+	cb::static_thread_pool tp{ 4 };
+	using priority = cb::static_thread_pool::priority;
+
+	// Enough operations to fill several blocks of the global queue.
+	constexpr int taskCount = 1'000;
+	std::atomic< int > runCount = 0;
+
+	auto child = [ & ]( cb::static_thread_pool::schedule_batch& batch, priority p ) -> cb::task<> {
+		co_await batch.schedule( p );
+		runCount.fetch_add( 1, std::memory_order_relaxed );
+	};
+
+	SECTION( "from outside the pool" )
+	{
+		std::vector< cb::task<> > children;
+		cb::static_thread_pool::schedule_batch batch{ tp };
+		for ( int i = 0; i < taskCount; ++i ) {
+			children.push_back( child( batch, i % 3 == 0 ? priority::high : priority::normal ) );
+		}
+
+		CHECK( batch.size() == taskCount );
+		CHECK( runCount == 0 );
+		batch.submit();
+		CHECK( batch.size() == 0 );
+
+		for ( auto& c : children ) {
+			c.join();
+		}
+	}
+
+	SECTION( "from a pool thread" )
+	{
+		[ & ]() -> cb::task<> {
+			co_await tp.schedule();
+
+			std::vector< cb::task<> > children;
+			cb::static_thread_pool::schedule_batch batch{ tp };
+			for ( int i = 0; i < taskCount; ++i ) {
+				children.push_back( child( batch, priority::low ) );
+			}
+			batch.submit();
+
+			for ( auto& c : children ) {
+				co_await c;
+			}
+		}()
+					   .join();
+	}
+
+	SECTION( "when the batch is destroyed" )
+	{
+		std::vector< cb::task<> > children;
+		{
+			cb::static_thread_pool::schedule_batch batch{ tp };
+			for ( int i = 0; i < taskCount; ++i ) {
+				children.push_back( child( batch, priority::normal ) );
+			}
+		}
+
+		for ( auto& c : children ) {
+			c.join();
+		}
+	}
+
+	CHECK( runCount == taskCount );
+}
+
+TEST_CASE( "scheduler counters account for every task that was run" )
+{
+	cb::static_thread_pool tp{ 4 };
+
+	constexpr int taskCount = 1'000;
+
+	auto child = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+	};
+
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+
+		std::vector< cb::task<> > children;
+		children.reserve( taskCount );
+		for ( int i = 0; i < taskCount; ++i ) {
+			children.push_back( child() );
+		}
+
+		for ( auto& c : children ) {
+			co_await c;
+		}
+	}()
+				   .join();
+
+	// Every resume is counted before it happens, so all of them are visible
+	// once the root task has completed.
+	const auto stats = tp.stats();
+	REQUIRE( stats.threads.size() == tp.thread_count() );
+	CHECK( stats.total.tasksExecuted == taskCount + 1 );
+	CHECK( stats.total.tasksExecuted == stats.total.localPops + stats.total.globalDequeues + stats.total.steals );
+	CHECK( stats.total.globalDequeues >= 1 );
+	CHECK( stats.total.localQueueHighWater >= 1 );
+	CHECK( stats.total.wakeUps <= stats.total.sleeps );
+
+	std::uint64_t tasksExecuted = 0;
+	for ( const auto& thread : stats.threads ) {
+		tasksExecuted += thread.tasksExecuted;
+	}
+	CHECK( tasksExecuted == stats.total.tasksExecuted );
+}
+
+TEST_CASE( "latency_histogram keeps every duration within its precision" )
+{
+	cb::latency_histogram h;
+	CHECK( h.value_at_percentile( 50.0 ) == 0ns );
+
+	for ( std::uint64_t ns : { 0ull, 7ull, 31ull, 32ull, 1'000ull, 123'456ull, 10'000'000'000ull } ) {
+		const auto index = cb::latency_histogram::bucket_index( ns );
+		CHECK( cb::latency_histogram::bucket_lowest_ns( index ) <= ns );
+		CHECK( cb::latency_histogram::bucket_highest_ns( index ) >= ns );
+		CHECK( cb::latency_histogram::bucket_highest_ns( index ) - cb::latency_histogram::bucket_lowest_ns( index ) <=
+			   ns / cb::latency_histogram::sub_bucket_count );
+	}
+
+	for ( int i = 1; i <= 100; ++i ) {
+		h.record( std::chrono::microseconds( i ) );
+	}
+	CHECK( h.count() == 100 );
+	CHECK( h.value_at_percentile( 50.0 ) >= 50us );
+	CHECK( h.value_at_percentile( 50.0 ) <= 50us + 50us / cb::latency_histogram::sub_bucket_count );
+	CHECK( h.max() >= 100us );
+	CHECK( h.max() <= 100us + 100us / cb::latency_histogram::sub_bucket_count );
+}
+
+namespace
+{
+const cb::task_category testPoolCategory{ "test-pool" };
+const cb::task_category testStrandCategory{ "test-strand" };
+}  // namespace
+
+TEST_CASE( "work scheduled with a category is recorded in its histograms" )
+{
+	// A single worker runs the jobs one after the other, so the later ones
+	// wait in the queue for the earlier ones.
+	cb::static_thread_pool tp{ 1 };
+	cb::strand strand{ tp };
+
+	constexpr int jobCount = 4;
+	auto poolJob = [ & ]() -> cb::task<> {
+		co_await tp.schedule( testPoolCategory );
+		std::this_thread::sleep_for( 2ms );
+	};
+	auto strandJob = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		co_await strand.schedule( testStrandCategory );
+	};
+
+	std::vector< cb::task<> > jobs;
+	for ( int i = 0; i < jobCount; ++i ) {
+		jobs.push_back( poolJob() );
+		jobs.push_back( strandJob() );
+	}
+	for ( auto& job : jobs ) {
+		job.join();
+	}
+
+	// A job is recorded once it has returned control to the worker, which
+	// may be just after join() has returned.
+	auto find = [ & ]( const cb::task_category& category ) {
+		const auto deadline = std::chrono::steady_clock::now() + 5s;
+		while ( true ) {
+			for ( const auto& snapshot : tp.category_stats() ) {
+				if ( snapshot.category == &category &&
+					 ( snapshot.runTime.count() == jobCount || std::chrono::steady_clock::now() > deadline ) ) {
+					return snapshot;
+				}
+			}
+			std::this_thread::sleep_for( 1ms );
+		}
+	};
+
+	const auto poolStats = find( testPoolCategory );
+	CHECK( poolStats.queueWait.count() == jobCount );
+	CHECK( poolStats.runTime.count() == jobCount );
+	CHECK( poolStats.runTime.value_at_percentile( 50.0 ) >= 2ms );
+	CHECK( poolStats.queueWait.max() >= 5ms );
+
+	const auto strandStats = find( testStrandCategory );
+	CHECK( strandStats.queueWait.count() == jobCount );
+	CHECK( strandStats.runTime.count() == jobCount );
+
+	std::FILE* out = std::tmpfile();
+	REQUIRE( out != nullptr );
+	tp.write_category_stats( out );
+	CHECK( std::ftell( out ) > 0 );
+	std::fclose( out );
+}
+
+TEST_CASE( "spin policy sets how long idle workers poll before sleeping" )
+{
+	cb::static_thread_pool::options opts;
+	opts.spin.spinCount = 200;
+
+	auto hop = [ & ]( cb::static_thread_pool& tp ) -> cb::task<> { co_await tp.schedule(); };
+
+	SECTION( "fixed" )
+	{
+		cb::static_thread_pool tp{ 2, opts };
+		hop( tp ).join();
+
+		const auto stats = tp.stats();
+		CHECK( stats.total.spinCount == 200 );
+		CHECK( stats.total.wakeLatency == std::chrono::nanoseconds{ 0 } );
+	}
+
+	SECTION( "adaptive with long idle gaps" )
+	{
+		opts.spin.adaptive = true;
+		cb::static_thread_pool tp{ 1, opts };
+
+		// Only post once the worker has gone to sleep, however long its
+		// spinning takes, so that every post has to wake it up.
+		constexpr std::uint64_t gapCount = 10;
+		for ( std::uint64_t i = 0; i < gapCount; ++i ) {
+			for ( auto stats = tp.stats(); stats.total.sleeps <= stats.total.wakeUps; stats = tp.stats() ) {
+				std::this_thread::yield();
+			}
+			hop( tp ).join();
+		}
+
+		const auto stats = tp.stats();
+		CHECK( stats.total.sleeps >= gapCount );
+		CHECK( stats.total.wakeLatency > std::chrono::nanoseconds{ 0 } );
+		CHECK( stats.total.spinCount >= opts.spin.minSpinCount );
+		CHECK( stats.total.spinCount <= opts.spin.maxSpinCount );
+	}
+}
+
+TEST_CASE( "schedule_after resumes on the pool once the delay has passed" )
+{
+	cb::static_thread_pool tp{ 2 };
+	using clock = cb::static_thread_pool::clock;
+
+	const auto callerThread = std::this_thread::get_id();
+	auto delayed = [ & ]( clock::duration delay ) -> cb::task< clock::duration > {
+		const auto start = clock::now();
+		co_await tp.schedule_after( delay );
+		CHECK( std::this_thread::get_id() != callerThread );
+		co_return clock::now() - start;
+	};
+
+	SECTION( "from outside the pool" )
+	{
+		CHECK( delayed( 20ms ).join() >= 20ms );
+	}
+
+	SECTION( "from a pool thread" )
+	{
+		[ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			CHECK( co_await delayed( 20ms ) >= 20ms );
+		}()
+					   .join();
+	}
+
+	SECTION( "when every worker has gone to sleep" )
+	{
+		std::this_thread::sleep_for( 20ms );
+		CHECK( delayed( 100ms ).join() >= 100ms );
+	}
+
+	SECTION( "with a deadline that has passed already" )
+	{
+		[ & ]() -> cb::task<> {
+			co_await tp.schedule_at( clock::now() - 1s );
+			CHECK( std::this_thread::get_id() != callerThread );
+		}()
+					   .join();
+	}
+}
+
+TEST_CASE( "timers fire in order of their deadlines" )
+{
+	// With a single worker the timers can only be resumed one at a time, in
+	// the order they expire. The longer delays start out on the higher levels
+	// of the timer wheel and have to be moved down before they expire.
+	cb::static_thread_pool tp{ 1 };
+
+	// All deadlines are relative to the same start, a little ahead, so that
+	// a stall while the timers are being set up can't reorder them.
+	const auto start = cb::static_thread_pool::clock::now() + 20ms;
+
+	std::vector< int > fired;
+	auto timer = [ & ]( int delayMs ) -> cb::task<> {
+		co_await tp.schedule_at( start + std::chrono::milliseconds( delayMs ) );
+		fired.push_back( delayMs );
+	};
+
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+
+		std::vector< cb::task<> > timers;
+		for ( int delayMs : { 90, 10, 250, 0, 40, 130 } ) {
+			timers.push_back( timer( delayMs ) );
+		}
+
+		for ( auto& t : timers ) {
+			co_await t;
+		}
+	}()
+				   .join();
+
+	CHECK( fired == std::vector< int >{ 0, 10, 40, 90, 130, 250 } );
+}
+
+TEST_CASE( "many timers from many threads each fire exactly once" )
+{
+	cb::static_thread_pool tp{ 4 };
+	using clock = cb::static_thread_pool::clock;
+
+	constexpr int producerCount = 4;
+	constexpr int timersPerProducer = 500;
+	std::atomic< int > firedCount = 0;
+	std::atomic< int > earlyCount = 0;
+
+	auto timer = [ & ]( clock::time_point deadline ) -> cb::task<> {
+		co_await tp.schedule_at( deadline );
+		if ( clock::now() < deadline ) {
+			earlyCount.fetch_add( 1, std::memory_order_relaxed );
+		}
+		firedCount.fetch_add( 1, std::memory_order_relaxed );
+	};
+
+	std::vector< std::thread > producers;
+	for ( int p = 0; p < producerCount; ++p ) {
+		producers.emplace_back( [ & ] {
+			std::vector< cb::task<> > timers;
+			for ( int i = 0; i < timersPerProducer; ++i ) {
+				timers.push_back( timer( clock::now() + std::chrono::microseconds( ( i * 7919 ) % 80'000 ) ) );
+			}
+			for ( auto& t : timers ) {
+				t.join();
+			}
+		} );
+	}
+	for ( auto& p : producers ) {
+		p.join();
+	}
+
+	CHECK( firedCount == producerCount * timersPerProducer );
+	CHECK( earlyCount == 0 );
+}
+
+TEST_CASE( "coroutine frames can outlive the thread that allocated them" )
+{
+	auto makeTask = []( int i ) -> cb::shared_task< int > { co_return i; };
+
+	constexpr int taskCount = 1'000;
+	std::vector< cb::shared_task< int > > tasks;
+	std::thread{ [ & ] {
+		for ( int i = 0; i < taskCount; ++i ) {
+			tasks.push_back( makeTask( i ) );
+		}
+	} }.join();
+
+	[ & ]() -> cb::task<> {
+		int sum = 0;
+		for ( auto& t : tasks ) {
+			sum += co_await t;
+		}
+		CHECK( sum == taskCount * ( taskCount - 1 ) / 2 );
+	}()
+				   .join();
+
+	// Freed here, after the allocating thread has exited, and then
+	// reused by the next thread to start.
+	tasks.clear();
+
+	std::thread{ [ & ] {
+		for ( int i = 0; i < taskCount; ++i ) {
+			tasks.push_back( makeTask( i ) );
+		}
+		tasks.clear();
+	} }.join();
+}
+
+namespace
+{
+// Suspends the awaiting coroutine until the test resumes it by hand.
+struct manual_resume
+{
+	std::coroutine_handle<> waiter;
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend( std::coroutine_handle<> h ) noexcept { waiter = h; }
+	void await_resume() const noexcept {}
+};
+}  // namespace
+
+TEST_CASE( "when_all waits for every task without blocking a pool thread" )
+{
+	// A single pool thread, so blocking it in join() would never finish.
+	cb::static_thread_pool tp{ 1 };
+
+	auto decode = [ & ]( int i ) -> cb::task< int > {
+		co_await tp.schedule();
+		co_return i;
+	};
+
+	SECTION( "a vector of tasks" )
+	{
+		constexpr int taskCount = 40;
+		auto buildAtlas = [ & ]() -> cb::task< int > {
+			co_await tp.schedule();
+
+			std::vector< cb::task< int > > images;
+			for ( int i = 0; i < taskCount; ++i ) {
+				images.push_back( decode( i ) );
+			}
+
+			int sum = 0;
+			for ( int image : co_await cb::when_all( std::move( images ) ) ) {
+				sum += image;
+			}
+			co_return sum;
+		};
+
+		CHECK( buildAtlas().join() == taskCount * ( taskCount - 1 ) / 2 );
+	}
+
+	SECTION( "tasks of different types" )
+	{
+		auto makeShared = [ & ]() -> cb::shared_task< std::string > {
+			co_await tp.schedule();
+			co_return "foo";
+		};
+		auto nothing = [ & ]() -> cb::task<> { co_await tp.schedule(); };
+
+		auto run = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+
+			auto shared = makeShared();
+			auto [ number, string, none ] = co_await cb::when_all( decode( 3 ), shared, nothing() );
+			CHECK( number == 3 );
+			CHECK( string == "foo" );
+			static_assert( std::is_same_v< decltype( none ), cb::detail::void_value > );
+
+			// The shared_task was referred to, not moved in.
+			CHECK( co_await shared == "foo" );
+		};
+
+		run().join();
+	}
+
+	SECTION( "when_all_ready gives the tasks back" )
+	{
+		auto run = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+
+			std::vector< cb::task< int > > tasks;
+			tasks.push_back( decode( 1 ) );
+			tasks.push_back( decode( 2 ) );
+			tasks = co_await cb::when_all_ready( std::move( tasks ) );
+
+			auto& first = tasks[ 0 ];
+			auto& second = tasks[ 1 ];
+			CHECK( first.await_ready() );
+			CHECK( second.await_ready() );
+			CHECK( co_await first + co_await second == 3 );
+		};
+
+		run().join();
+	}
+}
+
+TEST_CASE( "when_any resumes once the first task completes" )
+{
+	manual_resume slowEvent;
+	manual_resume fastEvent;
+	manual_resume sharedEvent;
+
+	auto waitFor = []( manual_resume& event, int value ) -> cb::task< int > {
+		co_await event;
+		co_return value;
+	};
+	auto sharedWaitFor = []( manual_resume& event, int value ) -> cb::shared_task< int > {
+		co_await event;
+		co_return value;
+	};
+
+	std::size_t first = 99;
+	auto waitForFirst = [ & ]() -> cb::task< int > {
+		auto slow = waitFor( slowEvent, 1 );
+		auto fast = waitFor( fastEvent, 2 );
+		auto shared = sharedWaitFor( sharedEvent, 3 );
+
+		first = co_await cb::when_any( slow, fast, shared );
+
+		// The others can still be awaited.
+		co_return co_await fast + co_await slow + co_await shared;
+	};
+	auto waiter = waitForFirst();
+
+	CHECK( first == 99 );
+	fastEvent.waiter.resume();
+	CHECK( first == 1 );
+
+	slowEvent.waiter.resume();
+	sharedEvent.waiter.resume();
+	CHECK( waiter.join() == 6 );
+}
+
+TEST_CASE( "when_any on tasks running on a pool" )
+{
+	cb::static_thread_pool tp{ 4 };
+
+	auto work = [ & ]( int i ) -> cb::task< int > {
+		co_await tp.schedule();
+		co_return i;
+	};
+
+	for ( int round = 0; round < 1'000; ++round ) {
+		std::vector< cb::task< int > > tasks;
+		for ( int i = 0; i < 4; ++i ) {
+			tasks.push_back( work( i ) );
+		}
+
+		auto run = [ & ]() -> cb::task<> {
+			const std::size_t first = co_await cb::when_any( tasks );
+			REQUIRE( first < tasks.size() );
+			auto& firstTask = tasks[ first ];
+			CHECK( co_await firstTask == static_cast< int >( first ) );
+
+			// Wait for the rest before they go out of scope.
+			co_await cb::when_all_ready( tasks[ 0 ], tasks[ 1 ], tasks[ 2 ], tasks[ 3 ] );
+		};
+		run().join();
+	}
+}
+
+TEST_CASE( "parallel_for calls fn exactly once for every index" )
+{
+	cb::static_thread_pool tp{ 4 };
+
+	constexpr std::size_t count = 100'000;
+	std::vector< std::atomic< int > > calls( count );
+
+	SECTION( "one index at a time" )
+	{
+		cb::parallel_for( tp, { 0, count }, 64, [ & ]( std::size_t i ) {
+			calls[ i ].fetch_add( 1, std::memory_order_relaxed );
+		} ).join();
+	}
+
+	SECTION( "a chunk at a time, from a pool thread" )
+	{
+		// Catch can't be used from several threads at once, so check the chunks afterwards.
+		std::atomic< std::size_t > largestChunk = 0;
+		auto run = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			co_await cb::parallel_for( tp, { 0, count }, 64, [ & ]( cb::index_range chunk ) {
+				std::size_t largest = largestChunk.load( std::memory_order_relaxed );
+				while ( chunk.size() > largest &&
+						!largestChunk.compare_exchange_weak( largest, chunk.size(), std::memory_order_relaxed ) ) {
+				}
+				for ( std::size_t i = chunk.begin; i < chunk.end; ++i ) {
+					calls[ i ].fetch_add( 1, std::memory_order_relaxed );
+				}
+			} );
+		};
+		run().join();
+		CHECK( largestChunk <= 64 );
+	}
+
+	for ( auto& c : calls ) {
+		REQUIRE( c.load() == 1 );
+	}
+}
+
+TEST_CASE( "parallel_reduce folds every index exactly once" )
+{
+	cb::static_thread_pool tp{ 4 };
+
+	constexpr std::uint64_t count = 1'000'000;
+	auto plus = []( std::uint64_t a, std::uint64_t b ) { return a + b; };
+
+	CHECK( cb::parallel_reduce( tp, { 0, count }, 1'000, std::uint64_t{ 0 }, plus, plus ).join() ==
+		   count * ( count - 1 ) / 2 );
+
+	auto sumChunk = []( std::uint64_t acc, cb::index_range chunk ) {
+		for ( std::size_t i = chunk.begin; i < chunk.end; ++i ) {
+			acc += i;
+		}
+		return acc;
+	};
+	CHECK( cb::parallel_reduce( tp, { 10, 20 }, 1, std::uint64_t{ 0 }, sumChunk, plus ).join() == 145 );
+
+	CHECK( cb::parallel_reduce( tp, { 5, 5 }, 1, std::uint64_t{ 7 }, plus, plus ).join() == 7 );
+}
+
+namespace
+{
+std::filesystem::path write_temp_file( const std::string& name, const std::vector< std::byte >& data )
+{
+	auto path = std::filesystem::temp_directory_path() / name;
+	std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+	out.write( reinterpret_cast< const char* >( data.data() ), static_cast< std::streamsize >( data.size() ) );
+	return path;
+}
+} // namespace
+
+TEST_CASE( "async_read_file reads whole files" )
+{
+	cb::static_thread_pool tp{ 1 };
+
+	cb::file_io_service::options options;
+	SECTION( "default" ) {}
+	SECTION( "fallback threads" )
+	{
+		options.forceFallback = true;
+	}
+	cb::file_io_service io{ tp, options };
+	if ( options.forceFallback ) {
+		CHECK_FALSE( io.uses_io_uring() );
+	}
+
+	std::vector< std::byte > expected( 300'000 );
+	for ( std::size_t i = 0; i < expected.size(); ++i ) {
+		expected[ i ] = static_cast< std::byte >( i * 7 + i / 251 );
+	}
+	const auto path = write_temp_file( "tasks_file_io_test.bin", expected );
+	const auto emptyPath = write_temp_file( "tasks_file_io_test_empty.bin", {} );
+
+	auto contents = cb::async_read_file( io, path ).join();
+	CHECK_FALSE( contents.error );
+	CHECK( contents.data == expected );
+
+	auto empty = cb::async_read_file( io, emptyPath ).join();
+	CHECK_FALSE( empty.error );
+	CHECK( empty.data.empty() );
+
+	auto missing = cb::async_read_file( io, path.string() + ".missing" ).join();
+	CHECK( missing.error == std::errc::no_such_file_or_directory );
+	CHECK( missing.data.empty() );
+
+	std::filesystem::remove( path );
+	std::filesystem::remove( emptyPath );
+}
+
+TEST_CASE( "read_file reads whole files while holding a strand on a one worker pool" )
+{
+	cb::static_thread_pool tp{ 1 };
+	cb::strand strand{ tp };
+
+	std::vector< std::byte > expected( 100'000 );
+	for ( std::size_t i = 0; i < expected.size(); ++i ) {
+		expected[ i ] = static_cast< std::byte >( i * 3 + i / 257 );
+	}
+	const auto path = write_temp_file( "tasks_read_file_test.bin", expected );
+
+	// The pool's only worker holds the strand, so it can't complete an async read joined from here.
+	bool onStrand = false;
+	auto load = [ & ]( std::filesystem::path p ) -> cb::task< cb::file_contents > {
+		co_await strand.schedule();
+		onStrand = strand.running_in_this_thread();
+		co_return cb::read_file( p );
+	};
+
+	auto contents = load( path ).join();
+	CHECK( onStrand );
+	CHECK_FALSE( contents.error );
+	CHECK( contents.data == expected );
+
+	auto missing = load( path.string() + ".missing" ).join();
+	CHECK( missing.error == std::errc::no_such_file_or_directory );
+	CHECK( missing.data.empty() );
+
+	std::filesystem::remove( path );
+}
+
+TEST_CASE( "read_at reads from an offset and resumes on the completion pool" )
+{
+	cb::static_thread_pool tp{ 1 };
+	cb::file_io_service io{ tp };
+
+	const std::string text = "0123456789";
+	std::vector< std::byte > data( text.size() );
+	std::memcpy( data.data(), text.data(), text.size() );
+	const auto path = write_temp_file( "tasks_read_at_test.txt", data );
+
+	std::error_code error;
+	auto file = cb::read_only_file::open( path, error );
+	REQUIRE_FALSE( error );
+	CHECK( file.size( error ) == text.size() );
+
+	std::thread::id poolThread;
+	[ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		poolThread = std::this_thread::get_id();
+	}()
+				   .join();
+
+	// The checks are made after the join, not on the pool thread.
+	std::thread::id resumedOn;
+	char buffer[ 8 ] = {};
+	auto [ middle, end ] = [ & ]() -> cb::task< std::pair< cb::read_result, cb::read_result > > {
+		auto first = co_await io.read_at( file, 6, buffer, sizeof( buffer ) );
+		resumedOn = std::this_thread::get_id();
+		char unused[ 4 ];
+		auto second = co_await io.read_at( file, text.size(), unused, sizeof( unused ) );
+		co_return std::pair{ first, second };
+	}()
+								 .join();
+
+	CHECK_FALSE( middle.error );
+	CHECK( middle.bytesRead == 4 );
+	CHECK( std::string( buffer, middle.bytesRead ) == "6789" );
+	CHECK_FALSE( end.error );
+	CHECK( end.bytesRead == 0 );
+	CHECK( resumedOn == poolThread );
+
+	file = {};
+	std::filesystem::remove( path );
+}
+
+TEST_CASE( "cancellation_token reflects its source" )
+{
+	cb::cancellation_token none;
+	CHECK_FALSE( none.can_be_cancelled() );
+	CHECK_FALSE( none.is_cancellation_requested() );
+
+	cb::cancellation_token token;
+	{
+		cb::cancellation_source source;
+		token = source.token();
+		CHECK( token.can_be_cancelled() );
+		CHECK_FALSE( token.is_cancellation_requested() );
+
+		SECTION( "requested" )
+		{
+			auto copy = source;
+			copy.request_cancellation();
+			CHECK( source.is_cancellation_requested() );
+			CHECK( token.is_cancellation_requested() );
+		}
+	}
+
+	// Once requested, a token stays cancelled. Otherwise it can't be cancelled any more without a source.
+	CHECK( token.can_be_cancelled() == token.is_cancellation_requested() );
+}
+
+TEST_CASE( "cancellation_registration calls back once cancellation is requested" )
+{
+	cb::cancellation_source source;
+	int calls = 0;
+
+	{
+		cb::cancellation_registration deregistered{ source.token(), [ & ] { ++calls; } };
+	}
+
+	{
+		cb::cancellation_registration first{ source.token(), [ & ] { ++calls; } };
+		cb::cancellation_registration second{ source.token(), [ & ] { ++calls; } };
+		CHECK( calls == 0 );
+
+		source.request_cancellation();
+		CHECK( calls == 2 );
+
+		source.request_cancellation();
+		CHECK( calls == 2 );
+	}
+
+	cb::cancellation_registration late{ source.token(), [ & ] { ++calls; } };
+	CHECK( calls == 3 );
+}
+
+TEST_CASE( "cancellation_registration waits for a callback running on another thread" )
+{
+	cb::cancellation_source source;
+	std::atomic< bool > callbackStarted = false;
+	std::atomic< bool > callbackReturned = false;
+	auto registration = std::make_unique< cb::cancellation_registration >( source.token(), [ & ] {
+		callbackStarted = true;
+		std::this_thread::sleep_for( 50ms );
+		callbackReturned = true;
+	} );
+
+	std::thread canceller{ [ & ] { source.request_cancellation(); } };
+	while ( !callbackStarted ) {
+		std::this_thread::yield();
+	}
+
+	registration.reset();
+	CHECK( callbackReturned );
+	canceller.join();
+}
+
+TEST_CASE( "schedule with a cancellation token drops the work once cancelled" )
+{
+	cb::static_thread_pool tp{ 1 };
+	cb::cancellation_source source;
+
+	const auto callerThread = std::this_thread::get_id();
+	auto hop = [ & ]() -> cb::task< std::pair< bool, bool > > {
+		const bool scheduled = co_await tp.schedule( source.token() );
+		co_return std::pair{ scheduled, std::this_thread::get_id() != callerThread };
+	};
+
+	CHECK( hop().join() == std::pair{ true, true } );
+
+	SECTION( "cancelled while queued" )
+	{
+		// Keep the only thread busy so the hop stays queued until after the request.
+		std::binary_semaphore release{ 0 };
+		auto block = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			release.acquire();
+		};
+		auto blocker = block();
+
+		auto queued = hop();
+		source.request_cancellation();
+		release.release();
+		blocker.join();
+
+		CHECK( queued.join() == std::pair{ false, true } );
+	}
+
+	SECTION( "cancelled before scheduling" )
+	{
+		source.request_cancellation();
+		CHECK( hop().join() == std::pair{ false, false } );
+	}
+}
+
+TEST_CASE( "async_mutex lets one coroutine at a time hold the lock" )
+{
+	cb::static_thread_pool tp{ 4 };
+	cb::async_mutex mutex;
+
+	CHECK( mutex.try_lock() );
+	CHECK_FALSE( mutex.try_lock() );
+	mutex.unlock();
+
+	constexpr int taskCount = 50;
+	constexpr int incrementCount = 100;
+	int counter = 0;
+	int holders = 0;
+	std::atomic< int > overlaps{ 0 };
+
+	auto increment = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+		for ( int i = 0; i < incrementCount; ++i ) {
+			auto lock = co_await mutex.scoped_lock_async();
+			if ( ++holders != 1 ) {
+				overlaps.fetch_add( 1, std::memory_order_relaxed );
+			}
+			++counter;
+			--holders;
+		}
+	};
+
+	[ & ]() -> cb::task<> {
+		std::vector< cb::task<> > tasks;
+		for ( int i = 0; i < taskCount; ++i ) {
+			tasks.push_back( increment() );
+		}
+		co_await cb::when_all( std::move( tasks ) );
+	}()
+				   .join();
+
+	CHECK( counter == taskCount * incrementCount );
+	CHECK( overlaps == 0 );
+	CHECK( mutex.try_lock() );
+	mutex.unlock();
+}
+
+TEST_CASE( "async_semaphore limits how many coroutines run at once" )
+{
+	cb::static_thread_pool tp{ 4 };
+	constexpr std::uint32_t permitCount = 3;
+	cb::async_semaphore semaphore{ permitCount };
+
+	SECTION( "try_acquire and release" )
+	{
+		for ( std::uint32_t i = 0; i < permitCount; ++i ) {
+			CHECK( semaphore.try_acquire() );
+		}
+		CHECK_FALSE( semaphore.try_acquire() );
+		CHECK( semaphore.available() == 0 );
+
+		semaphore.release( permitCount );
+		CHECK( semaphore.available() == permitCount );
+	}
+
+	SECTION( "waiters are handed permits in order of priority" )
+	{
+		cb::async_semaphore empty{ 0 };
+		std::vector< int > order;
+		auto wait = [ & ]( int i, cb::async_semaphore::priority p ) -> cb::task<> {
+			co_await empty.acquire( p );
+			order.push_back( i );
+		};
+
+		std::vector< cb::task<> > tasks;
+		tasks.push_back( wait( 0, cb::async_semaphore::priority::low ) );
+		tasks.push_back( wait( 1, cb::async_semaphore::priority::normal ) );
+		tasks.push_back( wait( 2, cb::async_semaphore::priority::low ) );
+		tasks.push_back( wait( 3, cb::async_semaphore::priority::high ) );
+		tasks.push_back( wait( 4, cb::async_semaphore::priority::normal ) );
+
+		// Resumes them all inside this call.
+		empty.release( 5 );
+		for ( auto& t : tasks ) {
+			t.join();
+		}
+
+		CHECK( order == std::vector< int >{ 3, 1, 4, 0, 2 } );
+	}
+
+	SECTION( "waiters are handed the released permits" )
+	{
+		constexpr int taskCount = 100;
+		std::atomic< int > running{ 0 };
+		std::atomic< int > maxRunning{ 0 };
+		std::atomic< int > finished{ 0 };
+
+		auto limited = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			auto permit = co_await semaphore.scoped_acquire();
+
+			const int now = running.fetch_add( 1 ) + 1;
+			int seen = maxRunning.load();
+			while ( now > seen && !maxRunning.compare_exchange_weak( seen, now ) ) {
+			}
+
+			// Give the others a chance to pile up behind the permits.
+			co_await tp.schedule();
+
+			running.fetch_sub( 1 );
+			finished.fetch_add( 1 );
+		};
+
+		[ & ]() -> cb::task<> {
+			std::vector< cb::task<> > tasks;
+			for ( int i = 0; i < taskCount; ++i ) {
+				tasks.push_back( limited() );
+			}
+			co_await cb::when_all( std::move( tasks ) );
+		}()
+					   .join();
+
+		CHECK( finished == taskCount );
+		CHECK( maxRunning <= static_cast< int >( permitCount ) );
+		CHECK( semaphore.available() == permitCount );
+	}
+}
+
+TEST_CASE( "async_latch resumes its waiters once the count reaches zero" )
+{
+	cb::static_thread_pool tp{ 4 };
+
+	SECTION( "a latch that starts at zero is ready" )
+	{
+		cb::async_latch latch{ 0 };
+		CHECK( latch.is_ready() );
+		[ & ]() -> cb::task<> { co_await latch; }().join();
+	}
+
+	SECTION( "waiters and count_down on the pool" )
+	{
+		constexpr int workCount = 20;
+		constexpr int waiterCount = 5;
+		cb::async_latch latch{ workCount };
+		std::atomic< int > done{ 0 };
+		std::atomic< int > resumedEarly{ 0 };
+
+		auto wait = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			co_await latch;
+			if ( done.load() != workCount ) {
+				resumedEarly.fetch_add( 1 );
+			}
+		};
+		auto work = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			done.fetch_add( 1 );
+			latch.count_down();
+		};
+
+		[ & ]() -> cb::task<> {
+			std::vector< cb::task<> > waiters;
+			for ( int i = 0; i < waiterCount; ++i ) {
+				waiters.push_back( wait() );
+			}
+			std::vector< cb::task<> > workers;
+			for ( int i = 0; i < workCount; ++i ) {
+				workers.push_back( work() );
+			}
+			co_await cb::when_all( std::move( workers ) );
+			co_await cb::when_all( std::move( waiters ) );
+		}()
+					   .join();
+
+		CHECK( latch.is_ready() );
+		CHECK( resumedEarly == 0 );
+	}
+}
+
+TEST_CASE( "strand runs one coroutine at a time on the pool" )
+{
+	cb::static_thread_pool tp{ 4 };
+	cb::strand strand{ tp };
+
+	constexpr int taskCount = 50;
+	constexpr int hopCount = 20;
+	int counter = 0;
+	int holders = 0;
+	std::atomic< int > overlaps{ 0 };
+	std::atomic< int > notOnStrand{ 0 };
+
+	auto increment = [ & ]() -> cb::task<> {
+		for ( int i = 0; i < hopCount; ++i ) {
+			co_await tp.schedule();
+			co_await strand.schedule();
+			if ( !strand.running_in_this_thread() ) {
+				notOnStrand.fetch_add( 1, std::memory_order_relaxed );
+			}
+			if ( ++holders != 1 ) {
+				overlaps.fetch_add( 1, std::memory_order_relaxed );
+			}
+			++counter;
+			--holders;
+		}
+	};
+
+	[ & ]() -> cb::task<> {
+		std::vector< cb::task<> > tasks;
+		for ( int i = 0; i < taskCount; ++i ) {
+			tasks.push_back( increment() );
+		}
+		co_await cb::when_all( std::move( tasks ) );
+	}()
+				   .join();
+
+	CHECK( counter == taskCount * hopCount );
+	CHECK( overlaps == 0 );
+	CHECK( notOnStrand == 0 );
+}
+
+TEST_CASE( "strand runs inline when free and in order when not" )
+{
+	cb::static_thread_pool tp{ 2 };
+	cb::strand strand{ tp };
+
+	SECTION( "free strand" )
+	{
+		const auto callerThread = std::this_thread::get_id();
+		auto ranOn = [ & ]() -> cb::task< std::pair< std::thread::id, bool > > {
+			co_await strand.schedule();
+			co_return std::pair{ std::this_thread::get_id(), strand.running_in_this_thread() };
+		}()
+									.join();
+
+		CHECK( ranOn.first == callerThread );
+		CHECK( ranOn.second );
+		CHECK_FALSE( strand.running_in_this_thread() );
+	}
+
+	SECTION( "busy strand" )
+	{
+		// Hold the strand on a pool thread until everything has queued up behind it.
+		std::binary_semaphore entered{ 0 };
+		std::binary_semaphore release{ 0 };
+		auto hold = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			co_await strand.schedule();
+			entered.release();
+			release.acquire();
+		};
+		auto holder = hold();
+		entered.acquire();
+
+		std::vector< int > order;
+		auto append = [ & ]( int i, cb::strand::priority p ) -> cb::task<> {
+			co_await strand.schedule( p );
+			order.push_back( i );
+		};
+
+		std::vector< cb::task<> > tasks;
+		for ( int i = 0; i < 10; ++i ) {
+			tasks.push_back( append( i, cb::strand::priority::normal ) );
+		}
+		tasks.push_back( append( -1, cb::strand::priority::high ) );
+
+		release.release();
+		holder.join();
+		for ( auto& t : tasks ) {
+			t.join();
+		}
+
+		CHECK( order == std::vector< int >{ -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 } );
+	}
+}
+
+TEST_CASE( "affine_task resumes on the executor it started on" )
+{
+	cb::static_thread_pool tp{ 2 };
+	cb::strand strand{ tp };
+
+	auto onPool = [ & ]() -> cb::task<> {
+		co_await tp.schedule();
+	};
+
+	SECTION( "started on a strand" )
+	{
+		bool onStrand = false;
+		[ & ]() -> cb::task<> {
+			co_await strand.schedule();
+			co_await [ & ]() -> cb::affine_task<> {
+				// Completes on a pool thread that doesn't hold the strand.
+				co_await onPool();
+				onStrand = strand.running_in_this_thread();
+			}();
+		}()
+					   .join();
+
+		CHECK( onStrand );
+	}
+
+	SECTION( "scheduled on a pool, and awaiting work that completes on it" )
+	{
+		bool onPoolAfterwards = false;
+		[ & ]() -> cb::affine_task<> {
+			co_await tp.schedule();
+			co_await onPool();
+			onPoolAfterwards = cb::static_thread_pool::current() == &tp && cb::strand::current() == nullptr;
+		}()
+					   .join();
+
+		CHECK( onPoolAfterwards );
+		// Already on the pool, so no hop back to it.
+		CHECK( tp.stats().total.tasksExecuted == 2 );
+	}
+
+	SECTION( "resumed by a release inside another coroutine's turn on the strand" )
+	{
+		cb::async_semaphore semaphore{ 0 };
+		bool releasing = false;
+		bool ranDuringRelease = true;
+		bool onStrand = false;
+
+		auto wait = [ & ]() -> cb::affine_task<> {
+			co_await strand.schedule();
+			co_await semaphore.acquire();
+			ranDuringRelease = releasing;
+			onStrand = strand.running_in_this_thread();
+		};
+		auto waiter = wait();
+
+		// Resumes the waiter inline, it has to wait for the strand until this lets go of it.
+		[ & ]() -> cb::task<> {
+			co_await strand.schedule();
+			releasing = true;
+			semaphore.release();
+			releasing = false;
+		}()
+					   .join();
+		waiter.join();
+
+		CHECK_FALSE( ranDuringRelease );
+		CHECK( onStrand );
+	}
+}
+
+TEST_CASE( "spsc_channel passes every item in order" )
+{
+	SECTION( "without waiting" )
+	{
+		cb::spsc_channel< std::string > channel{ 3 };
+		REQUIRE( channel.capacity() == 4 );
+		CHECK_FALSE( channel.try_receive() );
+
+		for ( int i = 0; i < 4; ++i ) {
+			CHECK( channel.try_send( std::to_string( i ) ) );
+		}
+		std::string rejected = "rejected";
+		CHECK_FALSE( channel.try_send( std::move( rejected ) ) );
+		CHECK( rejected == "rejected" );
+
+		for ( int i = 0; i < 4; ++i ) {
+			CHECK( channel.try_receive() == std::to_string( i ) );
+		}
+		CHECK_FALSE( channel.try_receive() );
+
+		// Left for the destructor to free.
+		CHECK( channel.try_send( std::string( 100, 'x' ) ) );
+	}
+
+	SECTION( "between two pool threads" )
+	{
+		cb::static_thread_pool tp{ 2 };
+		cb::spsc_channel< int > channel{ 4 };
+		constexpr int itemCount = 100'000;
+
+		auto sender = [ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			for ( int i = 0; i < itemCount; ++i ) {
+				co_await channel.send( i );
+			}
+		};
+
+		auto receiver = [ & ]() -> cb::task< int > {
+			co_await tp.schedule();
+			int outOfOrder = 0;
+			for ( int i = 0; i < itemCount; ++i ) {
+				if ( co_await channel.receive() != i ) {
+					++outOfOrder;
+				}
+			}
+			co_return outOfOrder;
+		};
+
+		auto received = receiver();
+		sender().join();
+		CHECK( received.join() == 0 );
+		CHECK_FALSE( channel.try_receive() );
+	}
+}
+
+TEST_CASE( "mpsc_channel passes every item once, in order per sender" )
+{
+	SECTION( "without waiting" )
+	{
+		cb::mpsc_channel< std::string > channel{ 2 };
+		CHECK( channel.try_send( std::string( "a" ) ) );
+		CHECK( channel.try_send( std::string( "b" ) ) );
+		CHECK_FALSE( channel.try_send( std::string( "c" ) ) );
+		CHECK( channel.try_receive() == "a" );
+		CHECK( channel.try_send( std::string( "c" ) ) );
+		CHECK( channel.try_receive() == "b" );
+		CHECK( channel.try_receive() == "c" );
+		CHECK_FALSE( channel.try_receive() );
+	}
+
+	SECTION( "from many pool threads" )
+	{
+		cb::static_thread_pool tp{ 4 };
+		cb::mpsc_channel< std::pair< int, int > > channel{ 8 };
+		constexpr int senderCount = 4;
+		constexpr int itemsPerSender = 20'000;
+
+		auto sender = [ & ]( int id ) -> cb::task<> {
+			co_await tp.schedule();
+			for ( int i = 0; i < itemsPerSender; ++i ) {
+				co_await channel.send( { id, i } );
+			}
+		};
+
+		auto receiver = [ & ]() -> cb::task< int > {
+			co_await tp.schedule();
+			std::vector< int > next( senderCount, 0 );
+			int outOfOrder = 0;
+			for ( int i = 0; i < senderCount * itemsPerSender; ++i ) {
+				const auto [ id, item ] = co_await channel.receive();
+				if ( item != next[ static_cast< std::size_t >( id ) ]++ ) {
+					++outOfOrder;
+				}
+			}
+			co_return outOfOrder;
+		};
+
+		auto received = receiver();
+		std::vector< cb::task<> > senders;
+		for ( int id = 0; id < senderCount; ++id ) {
+			senders.push_back( sender( id ) );
+		}
+		for ( auto& s : senders ) {
+			s.join();
+		}
+		CHECK( received.join() == 0 );
+		CHECK_FALSE( channel.try_receive() );
+	}
+}
+
 struct counted
 {
 	static int default_construction_count;
@@ -196,6 +1997,40 @@ int counted::copy_construction_count;
 int counted::move_construction_count;
 int counted::destruction_count;
 
+#if CORO_TRACE
+TEST_CASE( "trace writes the spans and flows of every thread as JSON" )
+{
+	cb::static_thread_pool tp{ 2 };
+
+	{
+		CORO_TRACE_SCOPE( "test-span" );
+		CORO_TRACE_INSTANT( "test-instant" );
+		[ & ]() -> cb::task<> {
+			co_await tp.schedule();
+			CORO_TRACE_SCOPE( "test-pool-span" );
+		}()
+					   .join();
+	}
+
+	std::FILE* out = std::tmpfile();
+	REQUIRE( out != nullptr );
+	cb::trace::write_json( out );
+
+	std::string json( static_cast< std::size_t >( std::ftell( out ) ), '\0' );
+	std::rewind( out );
+	CHECK( std::fread( json.data(), 1, json.size(), out ) == json.size() );
+	std::fclose( out );
+
+	CHECK( json.starts_with( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" ) );
+	CHECK( json.find( "\"test-span\"" ) != std::string::npos );
+	CHECK( json.find( "\"test-instant\"" ) != std::string::npos );
+	CHECK( json.find( "\"test-pool-span\"" ) != std::string::npos );
+	CHECK( json.find( "\"pool worker " ) != std::string::npos );
+	CHECK( json.find( "\"ph\":\"s\"" ) != std::string::npos );
+	CHECK( json.find( "\"ph\":\"f\"" ) != std::string::npos );
+}
+#endif
+
 TEST_CASE( "result is destroyed when last reference is destroyed" )
 {
 	counted::reset_counts();